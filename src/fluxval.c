@@ -80,49 +80,147 @@
  * ystein Gody, METNO/FOU, 2015-04-23: Added support for OSISAF archive.
  * ystein Gody, METNO/FOU, 2016-01-21: Added support for 5km daily
  * files.
+ *
+ * Several products (-p ssi,dli) are validated in one pass, one session
+ * per product sharing the observations read. Output and report files
+ * are named per product, %p in the name is replaced by the product,
+ * otherwise .<product> is appended when more than one is given.
+ *
+ * Several areas (-g ns,nr) are validated in one run as well, sharing
+ * directory listings and observations, one session per product and
+ * area. Stations are mapped to each grid once and only validated
+ * against the areas covering them. Each area is written to its own
+ * output and report, %a in the name is replaced by the area, otherwise
+ * .<area> is appended (after .<product>).
+ *
+ * Long periods can be reprocessed using several threads (-P), see
+ * fluxval_sched.c. The output is identical to that of a serial run.
+ * Runs on several nodes each take a part of the products (--shard i/N),
+ * a description (<output>.shard) is written next to each output and the
+ * outputs are merged using fluxval_shardmerge.
+ *
+ * Products can be read ahead of processing (--prefetch n) to overlap
+ * waiting for the archive with processing, see fluxval_prefetch.c.
+ *
+ * Matchups are also stored in a database (-D) where reruns replace
+ * earlier matchups instead of duplicating them, see fluxval_db.c. The
+ * database is read using fluxval_query.
+ *
+ * The boxes extracted around the stations can be kept in a patch cube
+ * (--cube) and the matchups recomputed from it (--from-cube) without
+ * reading the archive, see fluxval_cube.c.
+ *
+ * Satellite estimates extracted without observations (-a) are joined
+ * with the observations when these arrive (--join), see fluxval_join.c.
+ *
+ * A candidate processing chain is validated against a reference chain
+ * (--reference) by pairing their products and writing the differences
+ * per matchup, see fluxval_pair.c.
  */
 
 #include <fluxval.h>
+#include <fluxval_sched.h>
+#include <fluxval_shardinfo.h>
+#include <fluxval_prefetch.h>
+#include <fluxval_pair.h>
 #include <dirent.h>
 #include <time.h>
 #include <unistd.h>
+#include <getopt.h>
+
+/*
+ * Options only available in long form.
+ */
+#define FV_OPT_WATCH 256
+#define FV_OPT_DELAY 257
+#define FV_OPT_STATE 258
+#define FV_OPT_STATS 259
+#define FV_OPT_SHARD 260
+#define FV_OPT_PREFETCH 261
+#define FV_OPT_CUBE 262
+#define FV_OPT_FROMCUBE 263
+#define FV_OPT_JOIN 264
+#define FV_OPT_REFERENCE 265
+#define FV_OPT_KERNEL 266
+
+#define FV_MAXPROD 2		/* ssi and dli */
+#define FV_MAXAREA 8		/* Each with its grid kept (FV_MAXGRID) */
+#define FV_MAXSESS (FV_MAXPROD*FV_MAXAREA)
+
+#if FV_MAXGRID < FV_MAXAREA
+#error FV_MAXGRID must hold the grids of FV_MAXAREA areas
+#endif
+
+static void fvprodfile(char *name, char *product, int nprod, 
+        char *area, int narea, char *out);
+static int fvmatch(char *filename, char *fntest, int nprod, char *product);
+static int fvshard_describe(char *fname, long offset, long bytes,
+        int part, int nparts, fvsession *s, char *product);
 
 int main(int argc, char *argv[]) {
 
     extern char *optarg;
     char *where="fluxval";
-    char dir2read[FMSTRING512];
+    char dir2read[FMSTRING512], prevdir[FMSTRING512];
     char *outfile, *infile, *indir, *stfile, *parea, *fntest, *datadir;
-    char product[FMSTRING16];
+    char *jsonfile = NULL, *statefile = NULL, *statsfile = NULL;
+    char *collocspec = NULL, *formatfile = NULL, *dbfile = NULL;
+    char *cubefile = NULL, *fromcube = NULL, *joinfile = NULL;
+    char *refroot = NULL, refdir[FILENAMELEN], *kernel = NULL;
+    char product[FMSTRING256], prodname[FV_MAXPROD][FMSTRING16];
+    char areaname[FV_MAXAREA][FMSTRING16];
+    char fname[FV_MAXSESS][FILENAMELEN], rname[FV_MAXSESS][FILENAMELEN];
+    char jname[FV_MAXSESS][FILENAMELEN], label[FV_MAXSESS][FMSTRING32];
+    char sesfntest[FV_MAXSESS][FMSTRING32], *rptr[FV_MAXSESS];
+    char *item, *saveptr;
     char stime[FMSTRING16], etime[FMSTRING16];
-    char timeid[FMSTRING16], obstime[FMSTRING16];
-    int h, i, j, k, l, m, n, novalobs, cmobs, geomobs, noobs;
+    int i, j, k, nprod = 0, narea = 0, nsess;
     short sflg = 0, eflg = 0, pflg =0, iflg = 0, oflg = 0, aflg = 0, dflg = 0;
     short rflg = 0, mflg = 0, gflg = 0, cflg = 0, kflg = 0, bflg = 0, wflg = 0;
-    short fflg = 0, lflg = 0;
-    short status;
-    short obsmonth;
-    osihdf ipd;
-    struct tm time_str;
-    time_t time_start, time_end;
+    short fflg = 0, lflg = 0, jflg = 0, nflg = 0, tflg = 0, watchflg = 0;
+    short Fflg = 0, vflg = 0;
+    int status = FM_OK, delay = 60, minhours = 1, nthreads = 1;
+    int shardi = 0, shardn = 0, prefetch = 0, npf;
+    char **pfname = NULL;
+    fvprefetch pf;
+    fvdb *db = NULL;
+    fvcube *cubeout = NULL, *cubein = NULL;
+    fvpairindex refindex;
+    fvpairstats pairst[FV_MAXSESS];
+    long shardoff[FV_MAXSESS], nbytes;
+    char shardfile[FILENAMELEN+sizeof(FV_SHARDSUFFIX)];
     fmsec1970 tstart, tend;
     fmtime tstartfm, tendfm;
+    struct tm time_str;
     fmstarclist starclist;
     fmfilelist filelist;
-    stlist stl;
-    stdata **std;
-    s_data sdata;
-    fmgeopos gpos;
-    float meanflux, meanvalues[3], *cmdata, meancm;
-    float meanobs;
-    float misval=-999.;
-    FILE *fp;
+    fvsched sched;
+    fvsession *s, *sp[FV_MAXSESS];
+    fvwatch watch;
+    fvstats st;
+    FILE *fp[FV_MAXSESS];
+    static struct option longopts[] = {
+        {"watch", no_argument, NULL, FV_OPT_WATCH},
+        {"delay", required_argument, NULL, FV_OPT_DELAY},
+        {"state", required_argument, NULL, FV_OPT_STATE},
+        {"stats", required_argument, NULL, FV_OPT_STATS},
+        {"shard", required_argument, NULL, FV_OPT_SHARD},
+        {"prefetch", required_argument, NULL, FV_OPT_PREFETCH},
+        {"cube", required_argument, NULL, FV_OPT_CUBE},
+        {"from-cube", required_argument, NULL, FV_OPT_FROMCUBE},
+        {"join", required_argument, NULL, FV_OPT_JOIN},
+        {"reference", required_argument, NULL, FV_OPT_REFERENCE},
+        {"kernel", required_argument, NULL, FV_OPT_KERNEL},
+        {NULL, 0, NULL, 0}
+    };
 
     /* 
      * Decode command line arguments containing path to input files (one for
      * each area produced) and name (and path) of the output file.
      */
-    while ((i = getopt(argc, argv, "ablcwfks:e:p:g:i:o:dr:m:")) != EOF) {
+    while ((i = getopt_long(argc, argv, 
+                    "ablcwfkvs:e:p:g:i:o:dr:m:j:n:t:P:F:D:",
+                    longopts, NULL)) != EOF) {
         switch (i) {
             case 's':
                 if (strlen(optarg) != 10) {
@@ -185,6 +283,13 @@ int main(int argc, char *argv[]) {
             case 'w':
                 wflg++;
                 break;
+            case 'F':
+                formatfile = optarg;
+                Fflg++;
+                break;
+            case 'D':
+                dbfile = optarg;
+                break;
             case 'a':
                 aflg++;
                 break;
@@ -194,12 +299,77 @@ int main(int argc, char *argv[]) {
             case 'l':
                 lflg++;
                 break;
+            case 'n':
+                minhours = atoi(optarg);
+                nflg++;
+                break;
+            case 't':
+                collocspec = (char *) malloc(FILENAMELEN);
+                if (!collocspec) exit(FM_MEMALL_ERR);
+                if (sprintf(collocspec,"%s",optarg) < 0) exit(FM_IO_ERR);
+                tflg++;
+                break;
             case 'k':
                 kflg++;
                 break;
+            case 'v':
+                vflg++;
+                break;
+            case 'P':
+                nthreads = atoi(optarg);
+                if (nthreads < 1) usage();
+                break;
             case 'f':
                 fflg++;
                 break;
+            case 'j':
+                jsonfile = (char *) malloc(FILENAMELEN);
+                if (!jsonfile) exit(FM_MEMALL_ERR);
+                if (sprintf(jsonfile,"%s",optarg) < 0) exit(FM_IO_ERR);
+                jflg++;
+                break;
+            case FV_OPT_WATCH:
+                watchflg++;
+                break;
+            case FV_OPT_DELAY:
+                delay = atoi(optarg);
+                if (delay < 0) usage();
+                break;
+            case FV_OPT_STATE:
+                statefile = (char *) malloc(FILENAMELEN);
+                if (!statefile) exit(FM_MEMALL_ERR);
+                if (sprintf(statefile,"%s",optarg) < 0) exit(FM_IO_ERR);
+                break;
+            case FV_OPT_SHARD:
+                if (sscanf(optarg,"%d/%d",&shardi,&shardn) != 2 ||
+                        shardn < 1 || shardi < 0 || shardi >= shardn) {
+                    usage();
+                }
+                break;
+            case FV_OPT_PREFETCH:
+                prefetch = atoi(optarg);
+                if (prefetch < 0) usage();
+                break;
+            case FV_OPT_CUBE:
+                cubefile = optarg;
+                break;
+            case FV_OPT_FROMCUBE:
+                fromcube = optarg;
+                break;
+            case FV_OPT_JOIN:
+                joinfile = optarg;
+                break;
+            case FV_OPT_REFERENCE:
+                refroot = optarg;
+                break;
+            case FV_OPT_KERNEL:
+                kernel = optarg;
+                break;
+            case FV_OPT_STATS:
+                statsfile = (char *) malloc(FILENAMELEN);
+                if (!statsfile) exit(FM_MEMALL_ERR);
+                if (sprintf(statsfile,"%s",optarg) < 0) exit(FM_IO_ERR);
+                break;
             default:
                 usage();
                 break;
@@ -208,27 +378,241 @@ int main(int argc, char *argv[]) {
 
     /*
      * Check if all necessary information was given at command line.
+     * The period is not used in watch mode, but the product directory
+     * to watch is required.
      */
-    if (!sflg || !eflg || !iflg || !oflg || !pflg) usage();
+    if (watchflg) {
+        if (!rflg || !iflg || !oflg || !pflg) usage();
+    } else if (joinfile) {
+        if (!iflg || !oflg || !pflg) usage();
+    } else if (!sflg || !eflg || !iflg || !oflg || !pflg) {
+        usage();
+    }
     if ((bflg && cflg)||(bflg && wflg)||(cflg && wflg)) usage();
-    if (!mflg) {
-        datadir = (char *) malloc(FILENAMELEN);
-        if (!datadir) exit(FM_MEMALL_ERR);
-        if (sprintf(datadir,"%s",DATAPATH) < 0) exit(FM_IO_ERR);
+    if (Fflg && (bflg || cflg || wflg)) usage();
+    for (item=strtok_r(product,",",&saveptr); item; 
+            item=strtok_r(NULL,",",&saveptr)) {
+        for (k=0; k<nprod; k++) {
+            if (strcmp(prodname[k],item) == 0) usage();
+        }
+        if (nprod == FV_MAXPROD) usage();
+        snprintf(prodname[nprod],FMSTRING16,"%s",item);
+        nprod++;
     }
+    if (nprod == 0) usage();
 
     /*
      * Create character string to test filenames against to avoid
-     * unnecessary processing...
+     * unnecessary processing... Several areas give a comma separated
+     * list of patterns, and a session per area is validated with its
+     * own pattern.
      */
     fntest = (char *) malloc(FILENAMELEN);
     if (!fntest) exit(FM_MEMALL_ERR);
-    if (dflg) {
-        sprintf(fntest,"daily");
-    } else if (lflg) {
-        sprintf(fntest,"24h_hl");
+    if (dflg || lflg) {
+        sprintf(fntest,"%s",dflg ? "daily" : "24h_hl");
+        if (joinfile && gflg && strlen(parea) >= FMSTRING16) usage();
+        snprintf(areaname[narea++],FMSTRING16,"%s",
+                (joinfile && gflg) ? parea : "");
     } else {
-        sprintf(fntest,"%s.hdf5",parea);
+        if (!gflg) usage();
+        fntest[0] = '\0';
+        for (item=strtok_r(parea,",",&saveptr); item; 
+                item=strtok_r(NULL,",",&saveptr)) {
+            for (k=0; k<narea; k++) {
+                if (strcmp(areaname[k],item) == 0) usage();
+            }
+            if (narea == FV_MAXAREA || strlen(item) >= FMSTRING16) usage();
+            if (strlen(fntest)+strlen(item)+7 >= FILENAMELEN) usage();
+            sprintf(fntest+strlen(fntest),"%s%s.hdf5",
+                    fntest[0] ? "," : "",item);
+            snprintf(areaname[narea++],FMSTRING16,"%s",item);
+        }
+        if (narea == 0) usage();
+    }
+    nsess = nprod*narea;
+    if (watchflg && nsess > 1) {
+        fmerrmsg(where,"Watch mode validates one product and area only");
+        exit(FM_IO_ERR);
+    }
+    if (watchflg && (nthreads > 1 || shardn > 0)) usage();
+    if (fromcube && (watchflg || cubefile || nthreads > 1 || shardn > 0)) {
+        usage();
+    }
+    if (joinfile && (aflg || watchflg || fromcube || cubefile || 
+                nthreads > 1 || shardn > 0)) {
+        usage();
+    }
+    if (refroot && (!rflg || aflg || watchflg || joinfile || fromcube || 
+                cubefile || dbfile || nthreads > 1 || shardn > 0 || 
+                prefetch > 0)) {
+        usage();
+    }
+    fluxval_set_loglevel(vflg);
+    if (!mflg) {
+        datadir = (char *) malloc(FILENAMELEN);
+        if (!datadir) exit(FM_MEMALL_ERR);
+        if (sprintf(datadir,"%s",DATAPATH) < 0) exit(FM_IO_ERR);
+    }
+
+    /*
+     * Prepare a validation session per product and area (session k
+     * validates product k/narea over area k%narea), timing of processing
+     * stages is kept by the sessions and a report can be requested
+     * during processing by sending SIGUSR1.
+     */
+    runstats_catch_signal();
+    for (k=0; k<nsess; k++) {
+        s = sp[k] = fluxval_session_new();
+        if (!s) exit(FM_MEMALL_ERR);
+        if (fluxval_session_set_product(s, prodname[k/narea]) != FM_OK) {
+            usage();
+        }
+        if (fluxval_session_set_mode(s, 
+                    (dflg || lflg) ? FV_MODE_DAILY : FV_MODE_PASSAGE) != FM_OK) {
+            exit(FM_IO_ERR);
+        }
+        fluxval_session_set_satonly(s, aflg);
+        if (nflg && fluxval_session_set_minhours(s, minhours) != FM_OK) {
+            usage();
+        }
+        if (Fflg) {
+            if (fluxval_session_set_obs_format(s, datadir, formatfile) 
+                    != FM_OK) exit(FM_IO_ERR);
+        } else if (fluxval_session_set_obs(s, datadir, 
+                    cflg ? FV_OBS_COMPACT : 
+                    bflg ? FV_OBS_ULRIC : 
+                    wflg ? FV_OBS_GTS : FV_OBS_BIOFORSK) != FM_OK) {
+            exit(FM_IO_ERR);
+        }
+        if (tflg && fluxval_session_set_colloc(s, collocspec) != FM_OK) {
+            usage();
+        }
+        if (kernel && fluxval_session_set_kernel(s, kernel) != FM_OK) {
+            usage();
+        }
+        fvprodfile(outfile, prodname[k/narea], nprod, 
+                areaname[k%narea], narea, fname[k]);
+        if (jflg) {
+            fvprodfile(jsonfile, prodname[k/narea], nprod, 
+                    areaname[k%narea], narea, rname[k]);
+        }
+        if (joinfile) {
+            fvprodfile(joinfile, prodname[k/narea], nprod, 
+                    areaname[k%narea], narea, jname[k]);
+        }
+        if (narea > 1) {
+            snprintf(sesfntest[k],FMSTRING32,"%s.hdf5",areaname[k%narea]);
+            snprintf(label[k],FMSTRING32,"%s %s",
+                    prodname[k/narea],areaname[k%narea]);
+        } else {
+            snprintf(sesfntest[k],FMSTRING32,"%s",fntest);
+            snprintf(label[k],FMSTRING32,"%s",prodname[k/narea]);
+        }
+    }
+    s = sp[0];
+
+    /*
+     * Decode station list information, the observations are read once
+     * for all products and areas.
+     */
+    for (k=0; k<nsess; k++) {
+        if (fluxval_session_set_stations(sp[k], stfile) != FM_OK) {
+            exit(FM_OK);
+        }
+        if (k > 0 && fluxval_session_share_obs(sp[k], sp[0]) != FM_OK) {
+            exit(FM_IO_ERR);
+        }
+    }
+
+    /*
+     * Open files to store results in
+     */
+    for (k=0; k<nsess; k++) {
+        fp[k] = fopen(fname[k],"a");
+        if (!fp[k]) {
+            fmerrmsg(where,"Could not open output file...");
+            exit(FM_OK);
+        }
+        fseek(fp[k], 0, SEEK_END);
+        shardoff[k] = ftell(fp[k]);
+        if (shardn > 0) {
+            snprintf(shardfile,sizeof(shardfile),"%s%s",
+                    fname[k],FV_SHARDSUFFIX);
+            remove(shardfile);
+        }
+        fluxval_session_set_output(sp[k], fp[k]);
+    }
+
+    /*
+     * Open database to store matchups in as well, shared by all
+     * products and threads.
+     */
+    if (dbfile) {
+        db = fluxval_db_open(dbfile);
+        if (!db) {
+            fmerrmsg(where,"Could not open matchup database %s", dbfile);
+            exit(FM_IO_ERR);
+        }
+        for (k=0; k<nsess; k++) {
+            fluxval_session_set_db(sp[k], db);
+        }
+    }
+
+    /*
+     * Open patch cube to store the boxes extracted in or to recompute
+     * the matchups from.
+     */
+    if (cubefile) {
+        cubeout = fluxval_cube_open(cubefile, 1);
+        if (!cubeout) exit(FM_IO_ERR);
+        for (k=0; k<nsess; k++) {
+            fluxval_session_set_cube(sp[k], cubeout);
+        }
+    }
+    if (fromcube) {
+        cubein = fluxval_cube_open(fromcube, 0);
+        if (!cubein) exit(FM_IO_ERR);
+    }
+
+    /*
+     * Observations are joined with satellite estimates extracted earlier
+     * without reading any products.
+     */
+    if (joinfile) {
+        for (k=0; k<nsess && status == FM_OK; k++) {
+            status = fluxval_session_set_area(sp[k], areaname[k%narea]);
+            if (status == FM_OK) status = fluxval_join(sp[k], jname[k]);
+        }
+        goto summary;
+    }
+
+    /*
+     * In watch mode products are validated as they arrive in the
+     * archive until the process is terminated.
+     */
+    if (watchflg) {
+        memset(&watch, 0, sizeof(fvwatch));
+        snprintf(watch.proddir,FMSTRING1024,"%s",indir);
+        snprintf(watch.obsdir,FMSTRING1024,"%s",datadir);
+        snprintf(watch.fntest,FMSTRING1024,"%s",fntest);
+        if (statefile) {
+            snprintf(watch.statefile,FMSTRING1024,"%s",statefile);
+        } else {
+            snprintf(watch.statefile,FMSTRING1024,"%s.processed",outfile);
+        }
+        if (statsfile) snprintf(watch.statsfile,FMSTRING1024,"%s",statsfile);
+        if (jflg) snprintf(watch.reportfile,FMSTRING1024,"%s",jsonfile);
+        watch.delay = 60*delay;
+        status = fluxval_watch(s, &watch);
+        fclose(fp[0]);
+        if (jflg) {
+            fluxval_session_report(s, jsonfile);
+        }
+        fluxval_session_free(s);
+        if (fluxval_db_close(db) != FM_OK) status = FM_IO_ERR;
+        if (fluxval_cube_close(cubeout) != FM_OK) status = FM_IO_ERR;
+        exit(status);
     }
 
     /*
@@ -238,19 +622,21 @@ int main(int argc, char *argv[]) {
         fmerrmsg(where,"Could not decode time specification");
         exit(FM_OK);
     }
-    time_start = mktime(&time_str);
     if (timecnv(etime, &time_str) != 0) {
         fmerrmsg(where,"Could not decode time specification");
         exit(FM_OK);
     }
-    time_end = mktime(&time_str);
 
     /*
-     * Decode station list information.
+     * Recompute the matchups from the patch cube instead of the archive
+     * if requested.
      */
-    if (decode_stlist(stfile, &stl) != 0) {
-        fmerrmsg(where," Could not decode station file.");
-        exit(FM_OK);
+    if (cubein) {
+        for (k=0; k<nsess && status == FM_OK; k++) {
+            status = fluxval_process_cube(sp[k], cubein, atoll(stime)*100,
+                    atoll(etime)*100+59, sesfntest[k]);
+        }
+        goto summary;
     }
 
     /*
@@ -294,22 +680,6 @@ int main(int argc, char *argv[]) {
         printf("%d - %d \n", (int) tstart, (int) tend);
     }
 
-    /*
-     * Open file to store results in
-     */
-    fp = fopen(outfile,"a");
-    if (!fp) {
-        fmerrmsg(where,"Could not open output file...");
-        exit(FM_OK);
-    }
-
-    /*
-     * Loop through data directories containing satellite estimates
-     * Currently only either SSI or DLI can be read, but this could be
-     * used in a more generic way in the future.
-     *
-     * But first some variables have to be prepared.
-     */
     /*
      * Filename for flux products
      */
@@ -318,501 +688,342 @@ int main(int argc, char *argv[]) {
         fmerrmsg(where,"Could not allocate memory for filename");
         exit(FM_OK);
     }
+
     /*
-     * Specifying the size of the data collection box. This should be
-     * configurable in the future, but is hardcoded at present...
+     * Loop through data directories containing satellite estimates.
+     * Each product is validated in turn over the directory, products
+     * sharing a directory use the same listing and are told apart by
+     * filename. Observations of the month are read once for all. With
+     * several threads the products are only collected here and
+     * validated afterwards, as are those of a part (shard) of the run.
      */
-    if (dflg || lflg) {
-        sdata.iw = 1;
-        sdata.ih = 1;
-    } else {
-        sdata.iw = 13;
-        sdata.ih = 13;
-    }
-    sdata.data = (float *) malloc((sdata.iw*sdata.ih)*sizeof(float));
-    if (!sdata.data) {
-        fmerrmsg(where,"Could not allocate memory");
-        exit(FM_MEMALL_ERR);
-    }
-    obsmonth = 0;
-    for (i=0;i<starclist.nfiles;i++) {
-        if (rflg && kflg) {
-            sprintf(dir2read,"%s/%s/%s",indir,starclist.dirname[i],product);
-        } else if (rflg && fflg) {
-            sprintf(dir2read,"%s/%s",indir,starclist.dirname[i]);
-        } else if (rflg) {
-            sprintf(dir2read,"%s",starclist.dirname[0]);
-        } else {
-            sprintf(dir2read,"%s/%s/%s",STARCPATH,starclist.dirname[i],product);
-        }
-        if (fmreaddir(dir2read, &filelist)) {
-            fmerrmsg(where,"Could not read content of %s", 
-                    dir2read);
-            continue;
-        }
-        fmfilelist_sort(&filelist);
-        fmlogmsg(where, 
-                " Directory\n\t%s\n\tcontains\n\t%d files",filelist.path, filelist.nfiles);
-        for (j=0;j<filelist.nfiles;j++) {
-            if (strstr(filelist.filename[j],fntest)) {
-                fmlogmsg(where,"Processing %s", filelist.filename[j]);
-                /*
-                 * Read the satellite derived data
-                 */
-                sprintf(infile,"%s/%s", dir2read,filelist.filename[j]);
-                fmlogmsg(where, "Reading OSISAF product %s", infile);
-                status = read_hdf5_product(infile, &ipd, 0);
-                if (status != 0) {
-                    fmerrmsg(where, "Could not read input file %s", infile);
-                    exit(FM_OK);
+    fvsched_init(&sched);
+    sched.prefetch = prefetch;
+    memset(&refindex, 0, sizeof(fvpairindex));
+    memset(pairst, 0, sizeof(pairst));
+    prevdir[0] = '\0';
+    for (i=0;i<starclist.nfiles && status == FM_OK;i++) {
+        for (k=0;k<nsess && status == FM_OK;k++) {
+            s = sp[k];
+            if (rflg && kflg) {
+                sprintf(dir2read,"%s/%s/%s",
+                        indir,starclist.dirname[i],prodname[k/narea]);
+            } else if (rflg && fflg) {
+                sprintf(dir2read,"%s/%s",indir,starclist.dirname[i]);
+            } else if (rflg) {
+                sprintf(dir2read,"%s",starclist.dirname[0]);
+            } else {
+                sprintf(dir2read,"%s/%s/%s",
+                        STARCPATH,starclist.dirname[i],prodname[k/narea]);
+            }
+            if (strcmp(dir2read,prevdir) != 0) {
+                if (prevdir[0] != '\0') fmfilelist_free(&filelist);
+                prevdir[0] = '\0';
+                runstats_start(&(s->rs), RS_DIRLIST);
+                if (fmreaddir(dir2read, &filelist)) {
+                    runstats_stop(&(s->rs), RS_DIRLIST);
+                    fmerrmsg(where,"Could not read content of %s", 
+                            dir2read);
+                    continue;
                 }
-                printf("Source: %s\n", ipd.h.source);
-                printf("Product: %s\n", ipd.h.product);
-                printf("Area: %s\n", ipd.h.area);
-                printf("\t%4d-%02d-%02d %02d:%02d\n",
-                        ipd.h.year, ipd.h.month, ipd.h.day, ipd.h.hour, ipd.h.minute);
-                for (k=0; k<ipd.h.z; k++) {
-                    printf("\tBand %d - %s\n", k, ipd.d[k].description);
+                fmfilelist_sort(&filelist);
+                runstats_stop(&(s->rs), RS_DIRLIST);
+                fvlog(FV_LOG_INFO, where, "Directory %s contains %d files",
+                        filelist.path, filelist.nfiles);
+                sprintf(prevdir,"%s",dir2read);
+            }
+
+            /*
+             * Products to validate are read ahead if requested.
+             */
+            npf = 0;
+            if (prefetch > 0 && nthreads == 1 && shardn == 0) {
+                pfname = (char **) malloc(filelist.nfiles*sizeof(char *));
+                if (!pfname) {
+                    fmerrmsg(where,"Could not allocate prefetch list");
+                    status = FM_MEMALL_ERR;
+                    break;
                 }
-                printf("\tImage width: %d\n",ipd.h.iw);
-                printf("\tImage height: %d\n",ipd.h.ih);
-
-                /*
-                 * Transform CM data to float array before further processing.
-                 */
-                if (ipd.h.z == 7 && strcmp(ipd.d[6].description,"CM") == 0) {
-                    cmdata = (float *) malloc((ipd.h.iw*ipd.h.ih)*sizeof(float));
-                    if (!cmdata) {
-                        fmerrmsg(where,
-                                "Could not allocate cmdata for %s", 
-                                filelist.filename[j]);
-                        exit(FM_MEMALL_ERR);
-                    }
-                    for (k=0;k<(ipd.h.iw*ipd.h.ih);k++) {
-                        cmdata[k] = (float) ((unsigned short *) ipd.d[6].data)[k];
+                for (j=0;j<filelist.nfiles;j++) {
+                    if (fvmatch(filelist.filename[j],sesfntest[k],nprod,
+                                prodname[k/narea])) {
+                        pfname[npf++] = filelist.filename[j];
                     }
                 }
-                /*
-                 * Get observations (if not already read)
-                 */
-                if (!aflg) {
-                    if (obsmonth != ipd.h.month) {
-                        if (obsmonth > 0) {
-                            clear_stdata(std, stl.cnt);
-                        }
-                        std = (stdata **) malloc(sizeof(stdata *));
-                        if (!std) {
-                            fmerrmsg(where," Could not allocate memory");
-                            exit(FM_OK);
-                        }
-                        fmlogmsg(where,
-                                "Reading surface observations of radiative fluxes.");
-                        if (cflg) {
-                            if (fluxval_readobs_ascii(datadir, 
-                                        ipd.h.year,ipd.h.month, 
-                                        stl, std) != 0) {
-                                fmerrmsg(where,
-                                        "Could not read autostation data\n");
-                                exit(FM_OK);
-                            }
-                        } else if (bflg) {
-                            if (fluxval_readobs_ulric(datadir, 
-                                        ipd.h.year,ipd.h.month, 
-                                        stl, std) != 0) {
-                                fmerrmsg(where,
-                                        "Could not read autostation data\n");
-                                exit(FM_OK);
-                            }
-                        } else if (wflg) {
-                            if (fluxval_readobs_gts(datadir, 
-                                        ipd.h.year,ipd.h.month, 
-                                        stl, std) != 0) {
-                                fmerrmsg(where,
-                                        "Could not read autostation data\n");
-                                exit(FM_OK);
-                            }
-                        } else {
-                            if (fluxval_readobs(datadir, 
-                                        ipd.h.year,ipd.h.month, 
-                                        stl, std) != 0) {
-                                fmerrmsg(where,
-                                        "Could not read autostation data\n");
-                                exit(FM_OK);
-                            }
-                        }
-                        obsmonth = ipd.h.month;
-                    }
+            }
+            fvprefetch_start(&pf, s, dir2read, pfname, npf, prefetch);
+            npf = 0;
+            for (j=0;j<filelist.nfiles;j++) {
+                runstats_poll(&(s->rs), jflg ? rname[k] : NULL);
+                runstats_count(&(s->rs), RC_FILESSCANNED, 1);
+                if (!fvmatch(filelist.filename[j],sesfntest[k],nprod,
+                            prodname[k/narea])) {
+                    runstats_count(&(s->rs), RC_FILESSKIPPED, 1);
+                    continue;
                 }
-                /*
-                 * Store collocated flux estimates and measurements in
-                 * file. Below all available stations are looped for each
-                 * satellite derived flux file.
-                 *
-                 * Much of the averaging below can be isolated in
-                 * subroutines to make a nicer software outline...
-                 */
-                for (k=0; k<stl.cnt; k++) {
-
-                    /*
-                     * Each station listed is processed and data
-                     * surrounding the stations is extracted and processed
-                     * before storage in collocation file.
-                     */
-                    gpos.lat = stl.id[k].lat;
-                    gpos.lon = stl.id[k].lon;
-                    /*
-                     * First the OSISAF flux data surrounding a station
-                     * are extracted on a representative subarea.
-                     */
-                    fmlogmsg(where,
-                            "Collecting OSISAF flux estimates around station %s",
-                            stl.id[k].name);
-                    if (return_product_area(gpos, ipd.h, ipd.d[0].data, &sdata) != FM_OK) {
-                        fmerrmsg(where,
-                                "Did not find valid flux data for station %s for flux file %s",
-                                stl.id[k].name, filelist.filename[j]); 
-                        continue;
-                    }
-                    /*
-                     * Average flux estimates first
-                     */
-                    if (sdata.iw == 1 && sdata.ih == 1) {
-                        meanflux = *(sdata.data);
-                    } else {
-                        /*
-                         * Generate mean value from all satellite data
-                         * and store this in collocated file for
-                         * easier analysis. This could be changed in
-                         * the future...
-                         */
-                        meanflux = 0.;
-                        novalobs = 0;
-                        for (l=0; l<(sdata.iw*sdata.ih); l++) {
-                            if (sdata.data[l] >= 0) {
-                                meanflux += sdata.data[l];
-                                novalobs++;
-                            }
-                        }
-                        meanflux /= (float) novalobs;
-                    }
+                sprintf(infile,"%s/%s", dir2read,filelist.filename[j]);
+                if (nthreads > 1 || shardn > 0) {
+                    status = fvsched_add(&sched, k, infile);
+                    if (status != FM_OK) break;
+                    continue;
+                }
+                fvprefetch_current(&pf, npf++);
+                if (refroot) {
+                    snprintf(refdir,FILENAMELEN,"%s%s",
+                            refroot,dir2read+strlen(indir));
+                    status = fvpair_index(&refindex, refdir, fntest, nprod,
+                            prodname[k/narea]);
+                    if (status != FM_OK) break;
+                    status = fvpair_process(s, infile, &refindex, 
+                            &(pairst[k]));
+                } else {
+                    status = fluxval_process_product(s, infile);
+                }
+                if (status != FM_OK) {
+                    fmerrmsg(where,"Could not process %s", infile);
+                    break;
+                }
+            }
+            runstats_count(&(s->rs), RC_BYTESPREFETCHED, 
+                    fvprefetch_stop(&pf));
+            if (pfname) free(pfname);
+            pfname = NULL;
+            fvsched_cut(&sched);
+        }
+        if (prevdir[0] != '\0') fmfilelist_free(&filelist);
+        prevdir[0] = '\0';
+    }
+    if (shardn > 0 && status == FM_OK) {
+        fvsched_select(&sched, shardi, shardn);
+    }
+    if ((nthreads > 1 || shardn > 0) && status == FM_OK) {
+        if (jflg) {
+            for (k=0; k<nsess; k++) rptr[k] = rname[k];
+            sched.report = rptr;
+        }
+        status = fvsched_run(&sched, sp, nsess, nthreads, fp);
+    }
+    fvsched_free(&sched);
 
-                    /*
-                     * Needs info on observation geometry as well...
-                     * This block should probably be extracted into a
-                     * subroutine/function...
-                     */
-                    for (m=0;m<3;m++) {
-                        meanvalues[m] = 0.;
-                    }
-                    meancm = 0.;
-                    if (!dflg && !lflg && (strstr(product,"ssi")!=NULL)) {
-                        for (m=0;m<3;m++) {
-                            if (return_product_area(gpos, ipd.h, 
-                                        ipd.d[m+3].data, &sdata) != 0) {
-                                fmerrmsg(where,
-                                        " Did not find valid geom data for station %s %s",
-                                        stl.id[k].name,
-                                        "although flux data were found...");
-                                continue;
-                            }
-                            /*
-                             * Average obs geom estimates use val obs found for
-                             * fluxes.
-                             */
-                            meanvalues[m] = 0.;
-                            geomobs = 0;
-                            if (sdata.iw == 1 && sdata.ih == 1) {
-                                meanvalues[m] = *(sdata.data);
-                            } else {
-                                for (l=0; l<(sdata.iw*sdata.ih); l++) {
-                                    if (sdata.data[l] >= 0) {
-                                        meanvalues[m] += sdata.data[l];
-                                        geomobs++;
-                                    }
-                                }
-                                meanvalues[m] /= (float) geomobs;
-                            }
-                        }
-                    }
+summary:
+    /*
+     * Dump timing and counters of processing stages and summarise the
+     * comparison per product and area when several are validated.
+     */
+    for (k=0; k<nsess; k++) {
+        fflush(fp[k]);
+        nbytes = ftell(fp[k])-shardoff[k];
+        fclose(fp[k]);
+        if (shardn > 0 && status == FM_OK) {
+            status = fvshard_describe(fname[k], shardoff[k], nbytes,
+                    shardi, shardn, sp[k], prodname[k/narea]);
+        }
+        if (jflg) {
+            fluxval_session_report(sp[k], rname[k]);
+        }
+        if (refroot) {
+            fvpair_report(label[k], &(pairst[k]));
+        } else if (nsess > 1) {
+            fluxval_session_stats(sp[k], &st, 0);
+            if (st.n > 0) {
+                fmlogmsg(where,"%s: %ld matchups, bias %.2f, rmse %.2f",
+                        label[k], st.nmatchups, st.sumdiff/st.n,
+                        sqrt(st.sumsqdiff/st.n));
+            } else {
+                fmlogmsg(where,"%s: %ld matchups", 
+                        label[k], st.nmatchups);
+            }
+        }
+        fluxval_session_free(sp[k]);
+    }
+    if (fluxval_db_close(db) != FM_OK) status = FM_IO_ERR;
+    if (fluxval_cube_close(cubeout) != FM_OK) status = FM_IO_ERR;
+    fluxval_cube_close(cubein);
+    if (refroot) fvpair_index_free(&refindex);
 
-                    /*
-                     * Process the cloud mask information.
-                     * This block should probably be extracted into a
-                     * subroutine/function...
-                     */
-                    if (!dflg && !lflg) {
-                        if ((ipd.h.z == 7) && 
-                                (strcmp(ipd.d[6].description,"CM") == 0)) {
-                            if (return_product_area(gpos, ipd.h, 
-                                        cmdata, &sdata) != 0) {
-                                fmerrmsg(where,
-                                        " Did not find valid CM data for station %s %s\n",
-                                        stl.id[j].name,
-                                        "although flux data were found...");
-                                continue;
-                            }
-                            /*
-                             * Average CM used val obs found for fluxes.
-                             */
-                            meancm = 0.;
-                            cmobs = 0;
-                            if (sdata.iw == 1 && sdata.ih == 1) {
-                                if (*(sdata.data) >= 0.99 && *(sdata.data) <= 4.01) {
-                                    meancm = 1;
-                                } else if (*(sdata.data) >= 4.99 && *(sdata.data) <= 19.01) {
-                                    meancm = 2;
-                                }
-                            } else {
-                                for (l=0; l<(sdata.iw*sdata.ih); l++) {
-                                    if (sdata.data[l] >= 0.99 && sdata.data[l] <= 4.01) {
-                                        meancm += 1;
-                                        cmobs++;
-                                    } else if (sdata.data[l] >= 4.99 && sdata.data[l] <= 19.01) {
-                                        meancm += 2;
-                                        cmobs++;
-                                    }
-
-                                }
-                                meancm /= (float) cmobs;
-                            }
-                        }
-                    }
+    exit(status);
+}
 
-                    /*
-                     * If only satellite data are to be extracted around
-                     * the stations listed, use the following...
-                     */
-                    if (aflg) {
-                        /*
-                         * First print representative acquisition
-                         * time for satellite based estimates.
-                         */
-                        fprintf(fp," %4d%02d%02d%02d%02d",
-                                ipd.h.year,ipd.h.month,ipd.h.day,
-                                ipd.h.hour,ipd.h.minute);
-                        /*
-                         * Dump satellite based estimates and
-                         * auxiliary data. The satellite data are
-                         * averaged over 13x13 pixels to
-                         * compensate for positioning error of
-                         * satellites and the different view
-                         * perspective from ground and space.
-                         */
-                        fprintf(fp,
-                                " %7.2f %3d %3d %s %.2f %.2f %.2f %.2f", 
-                                meanflux, novalobs, 
-                                (sdata.iw*sdata.ih),
-                                ipd.h.source, 
-                                meanvalues[0], 
-                                meanvalues[1], 
-                                meanvalues[2],
-                                meancm);
-                        /*
-                         * Dump all information concerning
-                         * observations.  If asynchoneous logging
-                         * is done, dump placeholders for future
-                         * in situ observations to be included.
-                         */
-                        fprintf(fp," %12s %5d %7.2f %7.2f %7.2f", 
-                                "000000000000", 0,
-                                misval,misval,misval);
-                        /*
-                         * Insert newline to mark record.
-                         */
-                        fprintf(fp,"\n");
-                        continue;
-                    }
+/*
+ * Name of output or report file for a product and area, %p in name is
+ * replaced by the product and %a by the area. Without %p (%a) the
+ * product (area) is appended as a suffix when several products (areas)
+ * are validated.
+ */
+static void fvprodfile(char *name, char *product, int nprod, 
+        char *area, int narea, char *out) {
 
-                    /*
-                     * If surface observations are available and to be
-                     * stored in the same file, process these now...
-                     */
-                    if ((*std)[k].missing) {
-                        fmerrmsg(where,
-                        "Observations are not available for station %d",k);
-                        continue;
-                    }
+    char *where="fvprodfile";
+    char *pos, tmp[FILENAMELEN];
+    int n;
 
-                    /*
-                     * Checking that sat and obs is from the same hour.
-                     * According to Sofus Lystad the Bioforsk observations
-                     * represents integration of the last hour, time is
-                     * given in UTC. The date specification below might
-                     * cause evening observations during month changes to
-                     * be missed, but this is not a major problem...
-                     *
-                     * IPY-observations (Arctic stations) are
-                     * represented at the central time. Data are collected
-                     * at 1 minute intervals and transformed into hourly
-                     * estimates, centered at observation time.
-                     *
-                     * Ekofisk are represented by 10 min intervals, where
-                     * each time represents the data from the previous 10
-                     * minutes. Data are reformatted to hourly data.
-                     */
-                    if (dflg || lflg) {
-                        sprintf(timeid,"%04d%02d%02d", 
-                            ipd.h.year, ipd.h.month, ipd.h.day);
-                    } else {
-                        if (ipd.h.minute > 10) {
-                            if (ipd.h.hour == 23) {
-                                sprintf(timeid,"%04d%02d%02d0000", 
-                                    ipd.h.year, ipd.h.month, (ipd.h.day+1));
-                            } else {
-                                if (cflg) {
-                                    sprintf(timeid,"%04d%02d%02d%02d30", 
-                                        ipd.h.year, ipd.h.month, ipd.h.day, 
-                                        ipd.h.hour);
-                                } else {
-                                    sprintf(timeid,"%04d%02d%02d%02d00", 
-                                        ipd.h.year, ipd.h.month, ipd.h.day, 
-                                        (ipd.h.hour+1));
-                                }
-                            }
-                        } else {
-                            sprintf(timeid,"%04d%02d%02d%02d00", 
-                                ipd.h.year, ipd.h.month, ipd.h.day, ipd.h.hour);
-                        }
-                    }
-                    if (stl.id[k].number == (*std)[k].id) {
-                        meanobs = 0;
-                        noobs = 0;
-                        for (h=0; h<NO_MONTHOBS; h++) {
-                            if (cflg) {
-                                /* Compensating for roundoff errors in
-                                 * time spec. */
-                                sprintf(obstime,"%s",(*std)[k].param[h].date);
-                                obstime[10] = '3';
-                                obstime[11] = '0';
-                                obstime[12] = '0';
-                            } else {
-                                sprintf(obstime,"%s",(*std)[k].param[h].date);
-                            }
-                            if (strstr(obstime,timeid)) {
-                                /*
-                                 * First print representative acquisition
-                                 * time for satellite based estimates.
-                                 */
-                                fprintf(fp," %4d%02d%02d%02d%02d",
-                                        ipd.h.year,ipd.h.month,ipd.h.day,
-                                        ipd.h.hour,ipd.h.minute);
-                                /*
-                                 * Dump satellite based estimates and
-                                 * auxiliary data. The satellite data are
-                                 * averaged over 13x13 pixels to
-                                 * compensate for positioning error of
-                                 * satellites and the different view
-                                 * perspective from ground and space.
-                                 */
-                                if (dflg || lflg) {
-                                    fprintf(fp, " %7.2f %3d", 
-                                        meanflux, (sdata.iw*sdata.ih));
-                                } else {
-                                    fprintf(fp,
-                                        " %7.2f %3d %3d %s %.2f %.2f %.2f %.2f", 
-                                        meanflux, novalobs, 
-                                        (sdata.iw*sdata.ih),
-                                        ipd.h.source, 
-                                        meanvalues[0], 
-                                        meanvalues[1], meanvalues[2],
-                                        meancm);
-                                }
-                                /*
-                                 * Dump all information concerning
-                                 * observations. 
-                                 */
-                                if (dflg || lflg) {
-                                    for (n=1;n<=24;n++) {
-                                        if (strstr(product,"ssi")){
-                                            if ((*std)[k].param[h+n].Q0 > misval) {
-                                                meanobs += (*std)[k].param[h+n].Q0;
-                                                noobs++;
-                                            }
-                                        } else {
-                                            if ((*std)[k].param[h+n].LW > misval) {
-                                                meanobs += (*std)[k].param[h+n].LW;
-                                                noobs++;
-                                            }
-                                        }
-                                    }
-                                    if (noobs == 0) {
-                                        fprintf(fp," %05d %7.2f",
-                                                (*std)[k].id,misval);
-                                        fprintf(fp,"\n");
-                                        break;
-                                    }
-                                    meanobs /= (float) noobs;
-                                    fprintf(fp," %05d %7.2f",
-                                        (*std)[k].id,meanobs);
-                                    fprintf(fp,"\n");
-                                    break;
-                                } else {
-                                    if (cflg) {
-                                        if (strstr(product,"ssi")) {
-                                            fprintf(fp,
-                                                " %12s %05d %7.2f", 
-                                                (*std)[k].param[h].date, 
-                                                (*std)[k].id,
-                                                (*std)[k].param[h].Q0);
-                                        } else {
-                                            fprintf(fp,
-                                                " %12s %05d %7.2f", 
-                                                (*std)[k].param[h].date, 
-                                                (*std)[k].id,
-                                                (*std)[k].param[h].LW);
-                                        }
-                                        fprintf(fp,"\n");
-                                    } else {
-                                        fprintf(fp,
-                                            " %12s %05d %7.2f %7.2f %7.2f", 
-                                            (*std)[k].param[h].date, 
-                                            (*std)[k].id,
-                                            (*std)[k].param[h].TTM,
-                                            (*std)[k].param[h].Q0,
-                                            (*std)[k].param[h].ST);
-                                        fprintf(fp,"\n");
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-                if ((ipd.h.z == 7) && (strcmp(ipd.d[6].description,"CM")
-                            == 0)) {
-                    free(cmdata);
-                }
-                free_osihdf(&ipd);
-            }
-        }
-        fmfilelist_free(&filelist);
+    pos = strstr(name,"%p");
+    if (pos) {
+        snprintf(tmp,FILENAMELEN,"%.*s%s%s",
+                (int) (pos-name),name,product,pos+2);
+    } else if (nprod > 1) {
+        snprintf(tmp,FILENAMELEN,"%s.%s",name,product);
+    } else {
+        snprintf(tmp,FILENAMELEN,"%s",name);
+    }
+    pos = strstr(tmp,"%a");
+    if (pos) {
+        n = snprintf(out,FILENAMELEN,"%.*s%s%s",
+                (int) (pos-tmp),tmp,area,pos+2);
+    } else if (narea > 1) {
+        n = snprintf(out,FILENAMELEN,"%s.%s",tmp,area);
+    } else {
+        n = snprintf(out,FILENAMELEN,"%s",tmp);
     }
+    if (n < 0 || n >= FILENAMELEN) {
+        fmerrmsg(where,"File name %s is too long", name);
+        exit(FM_IO_ERR);
+    }
+}
 
-    exit(FM_OK);
+/*
+ * Check whether a file is a product to validate, the product name is
+ * only checked when several products are validated.
+ */
+static int fvmatch(char *filename, char *fntest, int nprod, char *product) {
+
+    if (!fluxval_fntest(filename, fntest)) return(0);
+    if (nprod > 1 && !strstr(filename, product)) return(0);
+
+    return(1);
+}
+
+/*
+ * Describe the output of a shard for fluxval_shardmerge.
+ */
+static int fvshard_describe(char *fname, long offset, long bytes,
+        int part, int nparts, fvsession *s, char *product) {
+
+    char *where="fvshard_describe";
+    char shardfile[FILENAMELEN+sizeof(FV_SHARDSUFFIX)];
+    fvshardinfo si;
+    fvstats st;
+    FILE *fp;
+
+    memset(&si, 0, sizeof(fvshardinfo));
+    si.index = part;
+    si.nshards = nparts;
+    snprintf(si.product,FMSTRING16,"%.15s",product);
+    si.offset = offset;
+    si.bytes = bytes;
+    fp = fopen(fname,"r");
+    if (!fp) {
+        fmerrmsg(where,"Could not open %s", fname);
+        return(FM_IO_ERR);
+    }
+    if (fvshardinfo_crc(fp, offset, bytes, &(si.crc)) != FM_OK) {
+        fclose(fp);
+        return(FM_IO_ERR);
+    }
+    fclose(fp);
+    fluxval_session_stats(s, &st, 0);
+    si.nmatchups = st.nmatchups;
+    si.n = st.n;
+    si.sumdiff = st.sumdiff;
+    si.sumsqdiff = st.sumsqdiff;
+    snprintf(shardfile,sizeof(shardfile),"%s%s",fname,FV_SHARDSUFFIX);
+
+    return(fvshardinfo_write(shardfile, &si));
 }
 
 void usage(void) {
 
     fprintf(stdout,"\n");
-    fprintf(stdout," fluxval [-adlcfkbw -g <area>] -p <product> ");
+    fprintf(stdout," fluxval [-adlcfkbwv -F <format> -g <area> -n <minhours>");
+    fprintf(stdout," -t <colloc>");
+    fprintf(stdout," --kernel <kernel>] -p <product>");
     fprintf(stdout," -s <start_time> -e <end_time>");
     fprintf(stdout," -r <satestdir> -m <obsdir>");
+    fprintf(stdout," -i <stlist> -o <output> [-j <report> -P <threads>");
+    fprintf(stdout," --shard <i/N> --prefetch <n> -D <db>\n");
+    fprintf(stdout,"     --cube <cube> | --from-cube <cube> |");
+    fprintf(stdout," --reference <refdir>]\n");
+    fprintf(stdout," fluxval --join <satonly> [-dlcbw -F <format> -t <colloc>]");
+    fprintf(stdout," -p <product> -g <area>\n");
+    fprintf(stdout,"     -m <obsdir> -i <stlist> -o <output> [-j <report> -D <db>]\n");
+    fprintf(stdout," fluxval --watch [-adlcbw -F <format> -g <area>] -p <product>");
+    fprintf(stdout," -r <satestdir> -m <obsdir>");
     fprintf(stdout," -i <stlist> -o <output>\n");
-    fprintf(stdout,"     -p product: ssi or dli\n");
+    fprintf(stdout,"     [-D <db>] [--delay <minutes> --state <file> --stats <file>");
+    fprintf(stdout," -j <report>]\n");
+    fprintf(stdout,"     -p product: ssi or dli, or ssi,dli to validate both\n");
+    fprintf(stdout,"        in one pass (%%p in output and report names is\n");
+    fprintf(stdout,"        replaced by the product, else .<product> appended)\n");
     fprintf(stdout,"     -s start_time: yyyymmddhh\n");
     fprintf(stdout,"     -e end_time: yyyymmddhh\n");
-    fprintf(stdout,"     -g geographical area: ns | nr | at | gr\n");
+    fprintf(stdout,"     -g geographical area: ns | nr | at | gr, several\n");
+    fprintf(stdout,"        areas are given as a comma separated list (%%a in\n");
+    fprintf(stdout,"        output and report names is replaced by the area,\n");
+    fprintf(stdout,"        else .<area> appended)\n");
     fprintf(stdout,"     -i stlist: ASCII file containing station ids\n");
     fprintf(stdout,"     -o output: filename and path (ASCII file)\n");
     fprintf(stdout,"     -r satestdir: directory to collet satellite estimates from\n");
     fprintf(stdout,"     -m obsdir: directory to collet measurements from\n");
     fprintf(stdout,"     -a: only store satellite estimates\n");
+    fprintf(stdout,"     -v: log products and months read, -vv also\n");
+    fprintf(stdout,"        stations and files (default errors only)\n");
     fprintf(stdout,"     -d: process daily products (in old resolution), ignores option -g\n");
     fprintf(stdout,"     -l: process daily products (in new resolution), ignores option -g\n");
+    fprintf(stdout,"     -n minhours: hours with valid observations required\n");
+    fprintf(stdout,"        for daily means (default 1)\n");
+    fprintf(stdout,"     -t colloc: collocation in time of passages, comma\n");
+    fprintf(stdout,"        separated key=value (times in minutes):\n");
+    fprintf(stdout,"        period=60 align=preceding|centred|following\n");
+    fprintf(stdout,"        window=0 lag=10 interp=no (defaults, compact\n");
+    fprintf(stdout,"        observations are centred)\n");
+    fprintf(stdout,"     --kernel kernel: weighting of the pixels around a\n");
+    fprintf(stdout,"        station, box (default), gauss[:sigma] or\n");
+    fprintf(stdout,"        footprint[:radius] centred on the station (sizes\n");
+    fprintf(stdout,"        in pixels, default 2 and 3, not with --from-cube)\n");
     fprintf(stdout,"     -b: Bioforskdata extracted from KDVH\n");
     fprintf(stdout,"     -c: compact observation format (IPY stations etc.)\n");
     fprintf(stdout,"     -w: observations extracted from WMO GTS\n");
+    fprintf(stdout,"     -F format: file describing the observation files of\n");
+    fprintf(stdout,"        another network (see fluxval_obsformat.c)\n");
     fprintf(stdout,"     -k: segmented data (starc-like)\n");
     fprintf(stdout,"     -f: segmented data (OSISAF archive like)\n");
+    fprintf(stdout,"     -j report: write timing and counters of processing\n");
+    fprintf(stdout,"        stages as JSON to this file at the end of the run\n");
+    fprintf(stdout,"        and when receiving SIGUSR1\n");
+    fprintf(stdout,"     -D db: store matchups in this database as well,\n");
+    fprintf(stdout,"        replacing matchups stored by earlier runs (read\n");
+    fprintf(stdout,"        using fluxval_query), not with -a but --join\n");
+    fprintf(stdout,"     -P threads: validate using this many threads, the\n");
+    fprintf(stdout,"        output is the same as for one thread (default)\n");
+    fprintf(stdout,"     --prefetch n: read up to n products ahead of their\n");
+    fprintf(stdout,"        processing (per thread), default 0\n");
+    fprintf(stdout,"     --shard i/N: only validate part i (0 to N-1) of N\n");
+    fprintf(stdout,"        parts of the products, merge the outputs of the\n");
+    fprintf(stdout,"        parts using fluxval_shardmerge\n");
+    fprintf(stdout,"     --cube cube: store the boxes extracted around the\n");
+    fprintf(stdout,"        stations in this patch cube\n");
+    fprintf(stdout,"     --from-cube cube: recompute the matchups of the\n");
+    fprintf(stdout,"        period from the boxes in this patch cube instead\n");
+    fprintf(stdout,"        of reading the products, -r is not used\n");
+    fprintf(stdout,"     --join satonly: add observations to the satellite\n");
+    fprintf(stdout,"        estimates in this output of fluxval -a (named as\n");
+    fprintf(stdout,"        the output for several products and areas), -g\n");
+    fprintf(stdout,"        gives the area of the products, products are not\n");
+    fprintf(stdout,"        read\n");
+    fprintf(stdout,"     --reference refdir: pair the products in satestdir\n");
+    fprintf(stdout,"        with those of a reference chain in refdir (same\n");
+    fprintf(stdout,"        layout) and write their differences per matchup\n");
+    fprintf(stdout,"        (not with -a -P --shard --prefetch -D or cubes)\n");
+    fprintf(stdout,"     --watch: validate new products in satestdir as they\n");
+    fprintf(stdout,"        arrive until terminated, -s and -e are not used\n");
+    fprintf(stdout,"     --delay minutes: hold new products this long before\n");
+    fprintf(stdout,"        validation to let observations arrive (default 60),\n");
+    fprintf(stdout,"        products without observations then wait for these\n");
+    fprintf(stdout,"        for a day\n");
+    fprintf(stdout,"     --state file: products already validated in watch\n");
+    fprintf(stdout,"        mode (default <output>.processed)\n");
+    fprintf(stdout,"     --stats file: append bias and rmse per product in\n");
+    fprintf(stdout,"        watch mode\n");
     fprintf(stdout,"\n");
 
     exit(FM_OK);
@@ -39,10 +39,17 @@
  * DNMI specific files.
  */
 #include <fmutil.h>
+#include <hdf5.h>
 #include <safprod.h>
 #include <safhdf.h>
 #include <fluxval_readobs.h>
 #include <return_product_area.h>
+#include <fluxval_stats.h>
+#include <fluxval_log.h>
+#include <fluxval_api.h>
+#include <fluxval_watch.h>
+#include <fluxval_db.h>
+#include <fluxval_cube.h>
 
 /*
  * Variable definitions
@@ -110,6 +117,137 @@ typedef struct {
     char filename[50];
 } fns;
 
+/*
+ * Validation session, see fluxval_api.h and fluxval_lib.c.
+ */
+/*
+ * Daily aggregation of the observations of a month for one station.
+ * Records are assigned to the hour they end (hour-ending convention),
+ * hourly means are formed first (sub-hourly data) and prefix sums over
+ * the hours of the month make the mean of any day an O(1) lookup.
+ */
+#define FV_MONTHHOURS 744	/* 31 days */
+#define FV_MAXGRID 8		/* Product grids (areas) kept per session */
+
+#define FV_NPAR 2		/* Parameters aggregated, Q0 and LW */
+#define FV_MISVAL -999.		/* Missing observation */
+
+typedef struct {
+    double psum[FV_NPAR][FV_MONTHHOURS+1];	/* Prefix sums of hourly means */
+    short pcnt[FV_NPAR][FV_MONTHHOURS+1];	/* Prefix counts of valid hours */
+    short nrec[32];			/* Records per day of month */
+} fvdaily;
+
+/*
+ * Temporal collocation of passages with observations, all times in
+ * seconds. An observation stamped t represents the period of length
+ * period ending at t, centred on t or starting at t (align). The time
+ * of the product is shifted by lag before matching. If no period
+ * contains it, the nearest observation within window is used. With
+ * interp the observations before and after are interpolated in time.
+ */
+typedef struct {
+    int period;
+    int align;			/* FV_ALIGN_* */
+    int window;
+    int lag;
+    int interp;
+} fvcolloc;
+
+/*
+ * Observation times of a station in seconds since 1970, sorted, with
+ * the record each refers to.
+ */
+typedef struct {
+    int n;
+    long *t;
+    short *rec;
+} fvobsindex;
+
+/*
+ * Observations of the month loaded for the stations of a session. This
+ * may be shared by several sessions (e.g. validating SSI and DLI over
+ * the same stations), nref counts the sessions using it. The daily
+ * aggregates cover all parameters so that they serve any product.
+ */
+typedef struct {
+    int format;			/* FV_OBS_* */
+    fvobsformat fmt;		/* Description of the files */
+    char path[FILENAMELEN];
+    stdata *std;		/* Observations of the month loaded */
+    fvarena arena;		/* Holds std, reused between months */
+    fvdaily *daily;		/* Daily aggregates of std per station */
+    fvobsindex *oidx;		/* Sorted observation times per station */
+    int year;
+    int month;
+    int nref;
+} fvobs;
+
+/*
+ * Weighting of the pixels of the box extracted around a station. Box
+ * weighs all valid pixels equally, the others are centred on the
+ * position of the station within the centre pixel (sub-pixel offsets of
+ * s_pos): a Gaussian of distance (param is sigma in pixels) or the part
+ * of each pixel covered by a circular footprint (param is the radius in
+ * pixels).
+ */
+#define FV_KERNEL_BOX 0
+#define FV_KERNEL_GAUSS 1
+#define FV_KERNEL_FOOTPRINT 2
+
+typedef struct {
+    int type;			/* FV_KERNEL_* */
+    float param;
+} fvkernel;
+
+struct fvsession {
+    char product[FMSTRING16];	/* ssi or dli */
+    short mode;			/* FV_MODE_PASSAGE or FV_MODE_DAILY */
+    short satonly;		/* Only extract satellite estimates */
+    stlist stl;
+    fmgeopos *gpos;
+    s_pos spos[FV_MAXGRID];	/* Station positions per product grid */
+    fvkernel kern;		/* Weighting of the box */
+    float *kweight[FV_MAXGRID];	/* Weights per station and grid */
+    int ngrid;			/* Grids seen, slot used is ngrid%FV_MAXGRID */
+    s_data sdata;		/* Box extracted around stations */
+    fvobs *obs;			/* Observations, possibly shared */
+    int minhours;		/* Valid hours required for daily means */
+    fvcolloc col;		/* Collocation in time for passages */
+    FILE *fp;
+    fvdb *db;			/* Matchups are also stored here if set */
+    char area[FMSTRING16];	/* Area of the product extracted from */
+    fvcube *cube;		/* Boxes extracted are stored here if set */
+    runstats rs;
+    fvstats st;			/* Comparison of matchups written */
+    short noobs;		/* Last product skipped, no observations */
+};
+
+/*
+ * Product read in a session. Only the header is read initially, bands
+ * are read when first used if their datasets are found (nband > 0),
+ * bandname holds the dataset of each band, fid the file kept open to
+ * read them, pos the station positions for its grid. Boxes
+ * extracted are collected in store when a patch cube is written. A
+ * product read from a patch cube only holds the boxes (patch).
+ */
+#define FV_MAXBAND 16
+
+struct fvproduct {
+    osihdf ipd;
+    short hascm;		/* Band 6 is the cloud mask */
+    s_pos *pos;			/* Station positions in grid of product */
+    float *kw;			/* Kernel weights per station, NULL if box */
+    char filename[FILENAMELEN];
+    int nband;			/* Bands read on demand, 0 if all read */
+    hid_t fid;			/* Open while bands are read on demand */
+    char bandname[FV_MAXBAND][FMSTRING64];
+    char loaded[FV_MAXBAND];
+    fvpatch *store;		/* Boxes extracted, for the patch cube */
+    fvpatch *patch;		/* Boxes read from a patch cube */
+    runstats *rs;
+};
+
 /*
  * Function prototypes.
  */
@@ -119,6 +257,11 @@ short toa_flux(toain indata, toaout *outdata);
 short toa_mean(toa_m_in info, float **data);
 */
 short timecnv(char tim[], struct tm *time);
+int fluxval_fntest(char *filename, char *fntest);
+int fluxval_compared_obs(fvsession *s, fvmatchup *m, float *obs);
+int fluxval_obs_available(fvsession *s, fvproduct *p);
+long long fluxval_product_prefetch(fvsession *s, char *filename,
+        char *buf, size_t len);
 int return_product_area(fmgeopos gpos, 
     PRODhead header, float *data, s_data *a); 
 /*
@@ -0,0 +1,200 @@
+/*
+ * NAME:
+ * fluxval_api.h
+ *
+ * PURPOSE:
+ * Public interface of libfluxval, the library version of the validation
+ * performed by fluxval. This makes it possible to run many validations
+ * within one process, keeping station positions and observations in
+ * memory between calls instead of starting fluxval for each run.
+ *
+ * NOTES:
+ * A session holds the configuration (product, observation format and
+ * location, type of validation), the station list with positions
+ * projected to the product grids used, the observations of the month
+ * currently processed and the output file. Typical use is:
+ *
+ *   fvsession *s = fluxval_session_new();
+ *   fluxval_session_set_product(s, "ssi");
+ *   fluxval_session_set_mode(s, FV_MODE_PASSAGE);
+ *   fluxval_session_set_obs(s, "/path/to/obs", FV_OBS_GTS);
+ *   fluxval_session_set_stations(s, "stlist.txt");
+ *   fluxval_session_set_output(s, fp);
+ *   for each product file:
+ *       fluxval_process_product(s, filename);
+ *   fluxval_session_free(s);
+ *
+ * The individual steps (reading of a product, extraction around a
+ * station, loading of observations and collocation) are available as
+ * separate functions for callers wanting to handle the matchups
+ * themselves. Sessions validating different products over the same
+ * stations can share their observations with fluxval_session_share_obs.
+ * All functions return FM_OK (0) on success, pointers are NULL on
+ * failure.
+ *
+ * Observations of networks other than those built in (FV_OBS_*) are
+ * read with a description of their files, see fluxval_obsformat.c and
+ * fluxval_session_set_obs_format.
+ *
+ * Matchups can also be stored in a database (fluxval_db_open and
+ * fluxval_session_set_db) where reruns replace earlier matchups, see
+ * fluxval_db.c.
+ *
+ * The boxes extracted can be kept in a patch cube (fluxval_cube_open and
+ * fluxval_session_set_cube) and the matchups recomputed from it without
+ * the product archive (fluxval_process_cube), see fluxval_cube.c.
+ *
+ * Observations are added to satellite estimates extracted earlier
+ * without observations (fluxval_session_set_satonly) by fluxval_join,
+ * see fluxval_join.c. The records do not hold the area of the products,
+ * it is set by fluxval_session_set_area.
+ *
+ * The estimates in the box around a station can be weighted by their
+ * distance to the station (fluxval_session_set_kernel), the weights are
+ * computed once per station and product grid.
+ *
+ * Messages of the processing are leveled (fluxval_set_loglevel), only
+ * errors are written by default. The level applies to all sessions.
+ *
+ * The interface is kept backwards compatible, FLUXVAL_API_VERSION is
+ * increased when functions are added or a structure changes. fvmatchup
+ * ends in reserved space, new fields take from it so that its size and
+ * the offsets of the fields stay the same.
+ *
+ * BUGS:
+ * A session is not thread safe, use one session per thread
+ * (fluxval_session_clone).
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_API_H
+#define _FLUXVAL_API_H
+
+#include <stdio.h>
+
+#define FLUXVAL_API_VERSION 14
+
+/*
+ * Observation formats.
+ */
+#define FV_OBS_BIOFORSK 0	/* Bioforsk original format */
+#define FV_OBS_COMPACT 1	/* Compact format (IPY stations etc.) */
+#define FV_OBS_ULRIC 2		/* Bioforsk data extracted from KDVH */
+#define FV_OBS_GTS 3		/* Observations extracted from WMO GTS */
+#define FV_OBS_FILE 4		/* Format given by a description file */
+
+/*
+ * Type of validation.
+ */
+#define FV_MODE_PASSAGE 0	/* Passage products, 13x13 box */
+#define FV_MODE_DAILY 1		/* Daily products, single pixel */
+
+/*
+ * Alignment of the integration period of observations relative to the
+ * time they are stamped with.
+ */
+#define FV_ALIGN_PRECEDING 0	/* Period ends at the time given */
+#define FV_ALIGN_CENTRED 1	/* Period is centred on the time given */
+#define FV_ALIGN_FOLLOWING 2	/* Period starts at the time given */
+
+typedef struct fvsession fvsession;
+typedef struct fvproduct fvproduct;
+typedef struct fvdb fvdb;
+typedef struct fvcube fvcube;
+
+/*
+ * Matchup between satellite estimates around a station and the
+ * collocated observations. Satellite values are means over the box
+ * extracted, geom holds the mean observation geometry and cm the mean
+ * cloud mask (1 cloud free, 2 overcast) for passage products. reserved
+ * is zero, kept for fields added later.
+ */
+typedef struct {
+    int year;
+    int month;
+    int day;
+    int hour;
+    int minute;
+    char source[32];
+    int station;	/* Index in the station list */
+    int stid;		/* Station number */
+    float flux;
+    int nvalid;
+    int nbox;
+    float geom[3];
+    float cm;
+    char obsdate[16];
+    float obs[3];	/* TTM, Q0, ST (or Q0/LW for compact format) */
+    float dailyobs;	/* Daily mean observation */
+    int hasobs;
+    int nhours;		/* Valid hours in daily mean */
+    float cmpobs;	/* Observation compared, Q0 or LW by product */
+    int reserved[16];
+} fvmatchup;
+
+/*
+ * Running comparison of satellite estimates against observations for
+ * the matchups written (bias is satellite minus observation). Matchups
+ * without valid estimate or observation are counted in nmatchups only.
+ */
+typedef struct {
+    long nmatchups;
+    long n;
+    double sumdiff;
+    double sumsqdiff;
+} fvstats;
+
+/*
+ * Function prototypes.
+ */
+void fluxval_set_loglevel(int level);
+fvsession *fluxval_session_new(void);
+fvsession *fluxval_session_clone(fvsession *s);
+void fluxval_session_free(fvsession *s);
+int fluxval_session_set_product(fvsession *s, char *product);
+int fluxval_session_set_mode(fvsession *s, int mode);
+int fluxval_session_set_satonly(fvsession *s, int satonly);
+int fluxval_session_set_obs(fvsession *s, char *path, int format);
+int fluxval_session_set_obs_format(fvsession *s, char *path, 
+        char *formatfile);
+int fluxval_session_set_minhours(fvsession *s, int minhours);
+int fluxval_session_set_colloc(fvsession *s, char *spec);
+int fluxval_session_set_kernel(fvsession *s, char *spec);
+int fluxval_session_set_stations(fvsession *s, char *stfile);
+int fluxval_session_set_output(fvsession *s, FILE *fp);
+int fluxval_session_set_db(fvsession *s, fvdb *db);
+int fluxval_session_set_cube(fvsession *s, fvcube *c);
+int fluxval_session_set_area(fvsession *s, char *area);
+int fluxval_session_nstations(fvsession *s);
+int fluxval_session_report(fvsession *s, char *filename);
+int fluxval_session_refresh_obs(fvsession *s);
+int fluxval_session_share_obs(fvsession *s, fvsession *from);
+int fluxval_session_stats(fvsession *s, fvstats *st, int reset);
+
+fvproduct *fluxval_product_read(fvsession *s, char *filename);
+void fluxval_product_free(fvproduct *p);
+int fluxval_extract(fvsession *s, fvproduct *p, int station, fvmatchup *m);
+int fluxval_load_obs(fvsession *s, int year, int month);
+int fluxval_collocate(fvsession *s, int start, fvmatchup *m);
+int fluxval_write_matchup(fvsession *s, FILE *fp, fvmatchup *m);
+int fluxval_process_product(fvsession *s, char *filename);
+int fluxval_join(fvsession *s, char *filename);
+
+fvdb *fluxval_db_open(char *filename);
+int fluxval_db_close(fvdb *db);
+
+fvcube *fluxval_cube_open(char *filename, int writing);
+int fluxval_cube_close(fvcube *c);
+int fluxval_process_cube(fvsession *s, fvcube *c, long long start, 
+        long long end, char *fntest);
+
+#endif /* _FLUXVAL_API_H */
@@ -0,0 +1,130 @@
+/*
+ * NAME:
+ * fluxval_arena.c
+ *
+ * PURPOSE:
+ * Region (arena) allocation used for data with a common lifetime, i.e.
+ * the observations of a month and the station list. Allocation is a
+ * pointer increment and everything is released at once.
+ *
+ * NOTES:
+ * Memory is taken from blocks of at least blocksize bytes. fvarena_reset
+ * releases all allocations but keeps the memory for reuse, if more than
+ * one block was needed they are replaced by one block holding the total,
+ * so repeated use of the same amount (e.g. one month of observations
+ * after the other) runs in a single block and memory use stays flat.
+ *
+ * Allocations are aligned to 16 bytes.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval_arena.h>
+#include <string.h>
+#include <fmutil.h>
+
+#define FVA_ALIGN 16
+#define FVA_ROUND(n) (((n)+FVA_ALIGN-1) & ~((size_t) FVA_ALIGN-1))
+#define FVA_HEADER FVA_ROUND(sizeof(fvblock))
+#define FVA_DEFAULTSIZE 65536
+
+static fvblock *fva_newblock(size_t size) {
+    fvblock *b;
+
+    b = (fvblock *) malloc(FVA_HEADER+size);
+    if (!b) return(NULL);
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+
+    return(b);
+}
+
+int fvarena_init(fvarena *a, size_t blocksize) {
+
+    a->head = NULL;
+    a->blocksize = (blocksize > 0) ? FVA_ROUND(blocksize) : FVA_DEFAULTSIZE;
+    a->capacity = 0;
+
+    return(FM_OK);
+}
+
+void *fvarena_alloc(fvarena *a, size_t size) {
+    char *where="fvarena_alloc";
+    fvblock *b;
+    void *p;
+
+    size = FVA_ROUND(size);
+    if (!a->head || a->head->used+size > a->head->size) {
+        b = fva_newblock((size > a->blocksize) ? size : a->blocksize);
+        if (!b) {
+            fmerrmsg(where,"Could not allocate %lu bytes",
+                    (unsigned long) size);
+            return(NULL);
+        }
+        b->next = a->head;
+        a->head = b;
+        a->capacity += b->size;
+    }
+    p = (char *) a->head+FVA_HEADER+a->head->used;
+    a->head->used += size;
+
+    return(p);
+}
+
+char *fvarena_strdup(fvarena *a, char *str) {
+    char *p;
+
+    p = (char *) fvarena_alloc(a, strlen(str)+1);
+    if (p) strcpy(p, str);
+
+    return(p);
+}
+
+/*
+ * Release all allocations. Normally O(1), blocks are only merged the
+ * first time more than one block was used.
+ */
+int fvarena_reset(fvarena *a) {
+    char *where="fvarena_reset";
+    fvblock *b, *next;
+
+    if (!a->head) return(FM_OK);
+    if (a->head->next) {
+        for (b=a->head; b; b=next) {
+            next = b->next;
+            free(b);
+        }
+        a->head = fva_newblock(a->capacity);
+        if (!a->head) {
+            fmerrmsg(where,"Could not allocate %lu bytes",
+                    (unsigned long) a->capacity);
+            a->capacity = 0;
+            return(FM_MEMALL_ERR);
+        }
+    }
+    a->head->used = 0;
+
+    return(FM_OK);
+}
+
+void fvarena_free(fvarena *a) {
+    fvblock *b, *next;
+
+    for (b=a->head; b; b=next) {
+        next = b->next;
+        free(b);
+    }
+    a->head = NULL;
+    a->capacity = 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * NAME:
+ * fluxval_arena.h
+ * 
+ * PURPOSE:
+ * Header file for region (arena) allocation of observations and station
+ * lists.
+ *
+ * NOTES:
+ * See fluxval_arena.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_ARENA_H
+#define _FLUXVAL_ARENA_H
+
+#include <stdlib.h>
+
+typedef struct fvblock {
+    struct fvblock *next;
+    size_t size;
+    size_t used;
+} fvblock;
+
+typedef struct {
+    fvblock *head;	/* Block currently allocated from */
+    size_t blocksize;	/* Minimum size of new blocks */
+    size_t capacity;	/* Sum of block sizes */
+} fvarena;
+
+/*
+ * Function prototypes.
+ */
+int fvarena_init(fvarena *a, size_t blocksize);
+void *fvarena_alloc(fvarena *a, size_t size);
+char *fvarena_strdup(fvarena *a, char *str);
+int fvarena_reset(fvarena *a);
+void fvarena_free(fvarena *a);
+
+#endif /* _FLUXVAL_ARENA_H */
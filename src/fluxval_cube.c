@@ -0,0 +1,574 @@
+/*
+ * NAME:
+ * fluxval_cube.c
+ *
+ * PURPOSE:
+ * To keep the boxes of product data extracted around the stations
+ * (fluxval --cube) in a compressed file indexed by time, a patch cube,
+ * so that matchups can be recomputed from it (fluxval --from-cube)
+ * instead of reading the product archive again when the analysis
+ * changes (box size, cloud screening etc).
+ *
+ * NOTES:
+ * The file is a sequence of records, one per product validated. A
+ * record is a fixed header (time, product, file name of the product,
+ * type of validation and lengths) followed by the boxes compressed with
+ * zlib. The boxes of all stations within the area of the product are
+ * stored for the bands used: flux, observation geometry and cloud mask.
+ * Before compression the bytes of the values are grouped by
+ * significance (shuffled) which makes the float data compress well.
+ *
+ * Records are appended, the index is built when the cube is opened by
+ * reading the record headers only. Records are ordered by time and
+ * product file name, a product stored again replaces the record stored
+ * before. An incomplete record at the end (an interrupted run) is
+ * ignored and overwritten by the next run storing in the cube.
+ *
+ * Boxes are cropped to the box of the session reading them, boxes
+ * larger than those stored can not be recomputed.
+ *
+ * BUGS:
+ * The records are written in the byte order of the host.
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o zlib
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <fluxval_cube.h>
+
+#define FV_CUBEMAGIC "FVPC"
+#define FV_CUBEVERSION 1
+#define FV_PATCHINTS 9		/* Integers describing the boxes */
+
+/*
+ * Header of a record as written.
+ */
+typedef struct {
+    char magic[4];
+    int version;
+    long long time;
+    char product[FMSTRING16];
+    char name[FMSTRING64];
+    int mode;
+    unsigned int rawlen;
+    unsigned int len;
+} fvcuberec;
+
+static int fvpatch_slot(int band) {
+
+    if (band == 0) return(0);
+    if (band >= 3 && band <= 5) return(band-2);
+    if (band == 6) return(4);
+
+    return(-1);
+}
+
+fvpatch *fvpatch_new(int nstations, int iw, int ih) {
+
+    char *where="fvpatch_new";
+    fvpatch *pt;
+    int i;
+
+    pt = (fvpatch *) calloc(1, sizeof(fvpatch));
+    if (!pt) {
+        fmerrmsg(where,"Could not allocate patches");
+        return(NULL);
+    }
+    init_product_positions(&(pt->pos));
+    pt->iw = iw;
+    pt->ih = ih;
+    pt->maxst = nstations;
+    pt->nentry = nstations;
+    pt->number = (int *) malloc((nstations+1)*sizeof(int));
+    pt->mask = (unsigned char *) calloc(nstations+1, 1);
+    pt->data = (float *) malloc(
+            ((size_t) nstations*FV_PATCHBANDS*iw*ih+1)*sizeof(float));
+    pt->entry = (int *) malloc((nstations+1)*sizeof(int));
+    if (!pt->number || !pt->mask || !pt->data || !pt->entry) {
+        fmerrmsg(where,"Could not allocate patches of %d stations",
+                nstations);
+        fvpatch_free(pt);
+        return(NULL);
+    }
+    for (i=0; i<nstations; i++) pt->entry[i] = -1;
+
+    return(pt);
+}
+
+void fvpatch_free(fvpatch *pt) {
+
+    if (!pt) return;
+    if (pt->number) free(pt->number);
+    if (pt->mask) free(pt->mask);
+    if (pt->data) free(pt->data);
+    if (pt->entry) free(pt->entry);
+    if (pt->pos.inside) free(pt->pos.inside);
+    free(pt);
+}
+
+/*
+ * Store the box of a band extracted around a station.
+ */
+int fvpatch_put(fvpatch *pt, int station, int number, int band,
+        s_data *sd) {
+
+    char *where="fvpatch_put";
+    int e, slot, nbox = pt->iw*pt->ih;
+
+    slot = fvpatch_slot(band);
+    if (slot < 0 || station < 0 || station >= pt->nentry) return(FM_OK);
+    if (sd->iw != pt->iw || sd->ih != pt->ih) {
+        fmerrmsg(where,"Box of %dx%d does not fit patches of %dx%d",
+                sd->iw, sd->ih, pt->iw, pt->ih);
+        return(FM_IO_ERR);
+    }
+    e = pt->entry[station];
+    if (e < 0) {
+        if (pt->nst == pt->maxst) return(FM_IO_ERR);
+        e = pt->entry[station] = pt->nst++;
+        pt->number[e] = number;
+        pt->mask[e] = 0;
+    }
+    memcpy(pt->data+((size_t) e*FV_PATCHBANDS+slot)*nbox, sd->data,
+            nbox*sizeof(float));
+    pt->mask[e] |= (1 << slot);
+
+    return(FM_OK);
+}
+
+/*
+ * Return the box of a band around a station of the session, cropped to
+ * the size of sd, as return_product_area_ind would have extracted it.
+ */
+int fvpatch_box(fvpatch *pt, int station, int band, s_data *sd) {
+
+    int e, slot;
+    s_data box;
+
+    slot = fvpatch_slot(band);
+    if (slot < 0 || station < 0 || station >= pt->nentry) return(FM_IO_ERR);
+    e = pt->entry[station];
+    if (e < 0 || !(pt->mask[e] & (1 << slot))) return(FM_IO_ERR);
+    box.iw = pt->iw;
+    box.ih = pt->ih;
+    box.data = pt->data+((size_t) e*FV_PATCHBANDS+slot)*pt->iw*pt->ih;
+
+    return(return_product_area_crop(&box, sd));
+}
+
+/*
+ * Map the stations of a session to the stations stored, by number.
+ */
+int fvpatch_map(fvpatch *pt, stlist *stl) {
+
+    char *where="fvpatch_map";
+    int i, e;
+
+    if (pt->entry) free(pt->entry);
+    if (pt->pos.inside) free(pt->pos.inside);
+    pt->nentry = stl->cnt;
+    pt->entry = (int *) malloc((stl->cnt+1)*sizeof(int));
+    pt->pos.inside = (char *) malloc(stl->cnt+1);
+    if (!pt->entry || !pt->pos.inside) {
+        fmerrmsg(where,"Could not allocate station map");
+        return(FM_MEMALL_ERR);
+    }
+    pt->pos.npos = stl->cnt;
+    for (i=0; i<stl->cnt; i++) {
+        pt->entry[i] = -1;
+        for (e=0; e<pt->nst; e++) {
+            if (pt->number[e] == stl->id[i].number) {
+                pt->entry[i] = e;
+                break;
+            }
+        }
+        pt->pos.inside[i] = (pt->entry[i] >= 0);
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Group the bytes of n values of size bytes by significance, or the
+ * reverse.
+ */
+static void fvcube_shuffle(unsigned char *in, unsigned char *out,
+        size_t n, int size, int reverse) {
+
+    size_t i;
+    int b;
+
+    for (i=0; i<n; i++) {
+        for (b=0; b<size; b++) {
+            if (reverse) {
+                out[i*size+b] = in[b*n+i];
+            } else {
+                out[b*n+i] = in[i*size+b];
+            }
+        }
+    }
+}
+
+/*
+ * Append the boxes of a product to the cube.
+ */
+int fvcube_put(fvcube *c, fvpatch *pt) {
+
+    char *where="fvcube_put";
+    int e, slot, nbox = pt->iw*pt->ih, head[FV_PATCHINTS];
+    size_t nval = 0, rawlen, off;
+    uLongf len;
+    unsigned char *raw, *vals, *buf;
+    fvcuberec rec;
+
+    for (e=0; e<pt->nst; e++) {
+        for (slot=0; slot<FV_PATCHBANDS; slot++) {
+            if (pt->mask[e] & (1 << slot)) nval += nbox;
+        }
+    }
+    rawlen = sizeof(head)+32+FMSTRING16+pt->nst*(sizeof(int)+1)+
+        nval*sizeof(float);
+    raw = (unsigned char *) malloc(rawlen);
+    vals = (unsigned char *) malloc(nval*sizeof(float)+1);
+    len = compressBound(rawlen);
+    buf = (unsigned char *) malloc(len);
+    if (!raw || !vals || !buf) {
+        fmerrmsg(where,"Could not allocate record of %s", pt->name);
+        if (raw) free(raw);
+        if (vals) free(vals);
+        if (buf) free(buf);
+        return(FM_MEMALL_ERR);
+    }
+
+    /*
+     * Description of the boxes, station numbers and bands stored, then
+     * the values shuffled.
+     */
+    head[0] = pt->year;
+    head[1] = pt->month;
+    head[2] = pt->day;
+    head[3] = pt->hour;
+    head[4] = pt->minute;
+    head[5] = pt->hascm;
+    head[6] = pt->iw;
+    head[7] = pt->ih;
+    head[8] = pt->nst;
+    memcpy(raw, head, sizeof(head));
+    off = sizeof(head);
+    memcpy(raw+off, pt->source, 32);
+    off += 32;
+    memcpy(raw+off, pt->area, FMSTRING16);
+    off += FMSTRING16;
+    memcpy(raw+off, pt->number, pt->nst*sizeof(int));
+    off += pt->nst*sizeof(int);
+    memcpy(raw+off, pt->mask, pt->nst);
+    off += pt->nst;
+    nval = 0;
+    for (e=0; e<pt->nst; e++) {
+        for (slot=0; slot<FV_PATCHBANDS; slot++) {
+            if (!(pt->mask[e] & (1 << slot))) continue;
+            memcpy(vals+nval*sizeof(float),
+                    pt->data+((size_t) e*FV_PATCHBANDS+slot)*nbox,
+                    nbox*sizeof(float));
+            nval += nbox;
+        }
+    }
+    fvcube_shuffle(vals, raw+off, nval, sizeof(float), 0);
+    free(vals);
+    if (compress2(buf, &len, raw, rawlen, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        fmerrmsg(where,"Could not compress boxes of %s", pt->name);
+        free(raw);
+        free(buf);
+        return(FM_IO_ERR);
+    }
+    free(raw);
+
+    memset(&rec, 0, sizeof(fvcuberec));
+    memcpy(rec.magic, FV_CUBEMAGIC, 4);
+    rec.version = FV_CUBEVERSION;
+    rec.time = (((pt->year*100LL+pt->month)*100+pt->day)*100+pt->hour)*100+
+        pt->minute;
+    snprintf(rec.product,FMSTRING16,"%s",pt->product);
+    snprintf(rec.name,FMSTRING64,"%s",pt->name);
+    rec.mode = pt->mode;
+    rec.rawlen = (unsigned int) rawlen;
+    rec.len = (unsigned int) len;
+
+    pthread_mutex_lock(&(c->lock));
+    fseek(c->fp, 0, SEEK_END);
+    if (fwrite(&rec, sizeof(fvcuberec), 1, c->fp) != 1 ||
+            fwrite(buf, 1, len, c->fp) != len || fflush(c->fp) != 0) {
+        pthread_mutex_unlock(&(c->lock));
+        fmerrmsg(where,"Could not write boxes of %s to %s",
+                pt->name, c->filename);
+        free(buf);
+        return(FM_IO_ERR);
+    }
+    pthread_mutex_unlock(&(c->lock));
+    pt->len = (long) (sizeof(fvcuberec)+len);
+    free(buf);
+
+    return(FM_OK);
+}
+
+/*
+ * Read the boxes of record i of the index.
+ */
+fvpatch *fvcube_get(fvcube *c, int i) {
+
+    char *where="fvcube_get";
+    int e, slot, nbox, head[FV_PATCHINTS];
+    size_t off, nval, k;
+    uLongf rawlen;
+    unsigned char *buf, *raw;
+    fvcubeindex *ix = &(c->idx[i]);
+    fvpatch *pt = NULL;
+
+    buf = (unsigned char *) malloc(ix->len);
+    raw = (unsigned char *) malloc(ix->rawlen);
+    if (!buf || !raw) {
+        fmerrmsg(where,"Could not allocate record of %s", ix->name);
+        if (buf) free(buf);
+        if (raw) free(raw);
+        return(NULL);
+    }
+    pthread_mutex_lock(&(c->lock));
+    if (fseek(c->fp, ix->offset, SEEK_SET) != 0 ||
+            fread(buf, 1, ix->len, c->fp) != ix->len) {
+        pthread_mutex_unlock(&(c->lock));
+        fmerrmsg(where,"Could not read boxes of %s", ix->name);
+        free(buf);
+        free(raw);
+        return(NULL);
+    }
+    pthread_mutex_unlock(&(c->lock));
+    rawlen = ix->rawlen;
+    if (uncompress(raw, &rawlen, buf, ix->len) != Z_OK ||
+            rawlen != ix->rawlen || rawlen < sizeof(head)+32+FMSTRING16) {
+        fmerrmsg(where,"Could not decompress boxes of %s", ix->name);
+        free(buf);
+        free(raw);
+        return(NULL);
+    }
+    free(buf);
+
+    memcpy(head, raw, sizeof(head));
+    off = sizeof(head);
+    nval = rawlen-off-32-FMSTRING16;
+    if (head[6] < 1 || head[7] < 1 || head[8] < 0 ||
+            nval < head[8]*(sizeof(int)+1) ||
+            (nval-head[8]*(sizeof(int)+1))%(head[6]*head[7]*sizeof(float))
+            != 0) {
+        fmerrmsg(where,"Record of %s in %s is corrupt",
+                ix->name, c->filename);
+        free(raw);
+        return(NULL);
+    }
+    nval -= head[8]*(sizeof(int)+1);
+    pt = fvpatch_new(head[8], head[6], head[7]);
+    if (!pt) {
+        free(raw);
+        return(NULL);
+    }
+    snprintf(pt->product,FMSTRING16,"%s",ix->product);
+    snprintf(pt->name,FMSTRING64,"%s",ix->name);
+    pt->mode = ix->mode;
+    pt->year = head[0];
+    pt->month = head[1];
+    pt->day = head[2];
+    pt->hour = head[3];
+    pt->minute = head[4];
+    pt->hascm = head[5];
+    pt->nst = head[8];
+    pt->len = (long) (sizeof(fvcuberec)+ix->len);
+    memcpy(pt->source, raw+off, 32);
+    pt->source[31] = '\0';
+    off += 32;
+    memcpy(pt->area, raw+off, FMSTRING16);
+    pt->area[FMSTRING16-1] = '\0';
+    off += FMSTRING16;
+    memcpy(pt->number, raw+off, pt->nst*sizeof(int));
+    off += pt->nst*sizeof(int);
+    memcpy(pt->mask, raw+off, pt->nst);
+    off += pt->nst;
+
+    /*
+     * Unshuffle the values into the boxes of the bands stored.
+     */
+    nval /= sizeof(float);
+    buf = (unsigned char *) malloc(nval*sizeof(float)+1);
+    if (!buf) {
+        fmerrmsg(where,"Could not allocate boxes of %s", ix->name);
+        free(raw);
+        fvpatch_free(pt);
+        return(NULL);
+    }
+    fvcube_shuffle(raw+off, buf, nval, sizeof(float), 1);
+    free(raw);
+    nbox = pt->iw*pt->ih;
+    k = 0;
+    for (e=0; e<pt->nst; e++) {
+        for (slot=0; slot<FV_PATCHBANDS; slot++) {
+            if (!(pt->mask[e] & (1 << slot)) || k+nbox > nval) continue;
+            memcpy(pt->data+((size_t) e*FV_PATCHBANDS+slot)*nbox,
+                    buf+k*sizeof(float), nbox*sizeof(float));
+            k += nbox;
+        }
+    }
+    free(buf);
+
+    return(pt);
+}
+
+static int fvcube_cmpindex(const void *a, const void *b) {
+
+    const fvcubeindex *x = (const fvcubeindex *) a;
+    const fvcubeindex *y = (const fvcubeindex *) b;
+    int c;
+
+    if (x->time != y->time) return((x->time < y->time) ? -1 : 1);
+    if ((c = strcmp(x->name, y->name)) != 0) return(c);
+    if ((c = strcmp(x->product, y->product)) != 0) return(c);
+    if (x->offset != y->offset) return((x->offset < y->offset) ? -1 : 1);
+
+    return(0);
+}
+
+/*
+ * Build the index from the record headers, an incomplete record at the
+ * end is cut off when the cube is opened for writing.
+ */
+static int fvcube_scan(fvcube *c, int writing) {
+
+    char *where="fvcube_scan";
+    long size, pos = 0;
+    int i, n, max = 0;
+    fvcuberec rec;
+    fvcubeindex *idx;
+
+    fseek(c->fp, 0, SEEK_END);
+    size = ftell(c->fp);
+    rewind(c->fp);
+    c->n = 0;
+    while (pos+(long) sizeof(fvcuberec) <= size &&
+            fread(&rec, sizeof(fvcuberec), 1, c->fp) == 1) {
+        if (memcmp(rec.magic, FV_CUBEMAGIC, 4) != 0 ||
+                rec.version != FV_CUBEVERSION) {
+            fmerrmsg(where,"%s is not a patch cube (at byte %ld)",
+                    c->filename, pos);
+            return(FM_IO_ERR);
+        }
+        if (pos+(long) sizeof(fvcuberec)+(long) rec.len > size) break;
+        if (c->n == max) {
+            max = max ? 2*max : 1024;
+            idx = (fvcubeindex *) realloc(c->idx, max*sizeof(fvcubeindex));
+            if (!idx) {
+                fmerrmsg(where,"Could not allocate index of %s", c->filename);
+                return(FM_MEMALL_ERR);
+            }
+            c->idx = idx;
+        }
+        idx = &(c->idx[c->n++]);
+        idx->time = rec.time;
+        rec.product[FMSTRING16-1] = '\0';
+        rec.name[FMSTRING64-1] = '\0';
+        snprintf(idx->product,FMSTRING16,"%s",rec.product);
+        snprintf(idx->name,FMSTRING64,"%s",rec.name);
+        idx->mode = rec.mode;
+        idx->offset = pos+(long) sizeof(fvcuberec);
+        idx->len = rec.len;
+        idx->rawlen = rec.rawlen;
+        pos = idx->offset+(long) rec.len;
+        if (fseek(c->fp, pos, SEEK_SET) != 0) break;
+    }
+    if (pos < size) {
+        fmlogmsg(where,"Incomplete record at the end of %s ignored",
+                c->filename);
+        if (writing && ftruncate(fileno(c->fp), (off_t) pos) != 0) {
+            fmerrmsg(where,"Could not cut incomplete record of %s",
+                    c->filename);
+            return(FM_IO_ERR);
+        }
+    }
+
+    /*
+     * Order by time and product file, the last record of a product
+     * stored replaces earlier ones.
+     */
+    if (c->n > 1) {
+        qsort(c->idx, c->n, sizeof(fvcubeindex), fvcube_cmpindex);
+        for (i=0, n=0; i<c->n; i++) {
+            if (i+1 < c->n && c->idx[i].time == c->idx[i+1].time &&
+                    strcmp(c->idx[i].name,c->idx[i+1].name) == 0 &&
+                    strcmp(c->idx[i].product,c->idx[i+1].product) == 0) {
+                continue;
+            }
+            c->idx[n++] = c->idx[i];
+        }
+        c->n = n;
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Open a cube, it is created when opened for writing if it does not
+ * exist.
+ */
+fvcube *fluxval_cube_open(char *filename, int writing) {
+
+    char *where="fluxval_cube_open";
+    fvcube *c;
+
+    c = (fvcube *) calloc(1, sizeof(fvcube));
+    if (!c) {
+        fmerrmsg(where,"Could not allocate cube");
+        return(NULL);
+    }
+    snprintf(c->filename,FMSTRING1024,"%s",filename);
+    c->fp = fopen(filename, writing ? "r+" : "r");
+    if (!c->fp && writing && errno == ENOENT) c->fp = fopen(filename,"w+");
+    if (!c->fp) {
+        fmerrmsg(where,"Could not open %s", filename);
+        free(c);
+        return(NULL);
+    }
+    if (fvcube_scan(c, writing) != FM_OK) {
+        fclose(c->fp);
+        if (c->idx) free(c->idx);
+        free(c);
+        return(NULL);
+    }
+    pthread_mutex_init(&(c->lock), NULL);
+
+    return(c);
+}
+
+int fluxval_cube_close(fvcube *c) {
+
+    int status = FM_OK;
+
+    if (!c) return(FM_OK);
+    if (fclose(c->fp) != 0) {
+        fmerrmsg("fluxval_cube_close","Could not write %s", c->filename);
+        status = FM_IO_ERR;
+    }
+    if (c->idx) free(c->idx);
+    pthread_mutex_destroy(&(c->lock));
+    free(c);
+
+    return(status);
+}
@@ -0,0 +1,109 @@
+/*
+ * NAME:
+ * fluxval_cube.h
+ *
+ * PURPOSE:
+ * Header file for the patch cube, a file holding the boxes of product
+ * data extracted around the stations so that matchups can be recomputed
+ * without reading the archive.
+ *
+ * NOTES:
+ * See fluxval_cube.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o zlib
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_CUBE_H
+#define _FLUXVAL_CUBE_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <fmutil.h>
+#include <fluxval_readobs.h>
+#include <return_product_area.h>
+#include <fluxval_api.h>
+
+/*
+ * Bands kept per station: flux, the three bands of observation geometry
+ * and the cloud mask (product bands 0, 3-5 and 6).
+ */
+#define FV_PATCHBANDS 5
+
+/*
+ * Boxes of one product. While a product is validated the boxes extracted
+ * are collected here indexed by station (entry), when read from a cube
+ * entry and pos.inside map the stations of the session reading it to
+ * the stations stored. mask tells the bands stored per station.
+ */
+typedef struct {
+    char product[FMSTRING16];
+    char name[FMSTRING64];	/* File name of the product */
+    char source[32];
+    char area[FMSTRING16];
+    int mode;			/* FV_MODE_* of the session storing it */
+    int year;
+    int month;
+    int day;
+    int hour;
+    int minute;
+    int hascm;			/* Product has a cloud mask */
+    int iw;			/* Size of the boxes */
+    int ih;
+    int nst;			/* Stations stored */
+    int maxst;
+    int *number;		/* Station numbers */
+    unsigned char *mask;	/* Bands stored per station, bit per band */
+    float *data;		/* maxst x FV_PATCHBANDS boxes */
+    int nentry;
+    int *entry;			/* Station of session to station stored */
+    s_pos pos;			/* Only inside is used */
+    long len;			/* Bytes of the record in the cube */
+} fvpatch;
+
+/*
+ * Records of a cube, sorted by time and product file name. Records of a
+ * product stored again replace the earlier ones.
+ */
+typedef struct {
+    long long time;		/* yyyymmddhhmm */
+    char product[FMSTRING16];
+    char name[FMSTRING64];
+    int mode;
+    long offset;		/* Position of the compressed boxes */
+    unsigned int len;
+    unsigned int rawlen;
+} fvcubeindex;
+
+struct fvcube {
+    FILE *fp;
+    char filename[FMSTRING1024];
+    int n;
+    fvcubeindex *idx;
+    pthread_mutex_t lock;
+};
+
+/*
+ * Function prototypes.
+ */
+fvpatch *fvpatch_new(int nstations, int iw, int ih);
+void fvpatch_free(fvpatch *pt);
+int fvpatch_put(fvpatch *pt, int station, int number, int band, 
+        s_data *sd);
+int fvpatch_box(fvpatch *pt, int station, int band, s_data *sd);
+int fvpatch_map(fvpatch *pt, stlist *stl);
+int fvcube_put(fvcube *c, fvpatch *pt);
+fvpatch *fvcube_get(fvcube *c, int i);
+
+#endif /* _FLUXVAL_CUBE_H */
@@ -0,0 +1,281 @@
+/*
+ * NAME:
+ * fluxval_db.c
+ *
+ * PURPOSE:
+ * To keep matchups in an SQLite database file (fluxval -D) where each
+ * matchup is stored once, so that overlapping runs and reruns after
+ * failures do not produce duplicates and periods, stations and areas
+ * can be selected quickly for reporting (fluxval_query).
+ *
+ * NOTES:
+ * A matchup is identified by product, product time, source (satellite),
+ * area, station, box size and observation time (empty for daily
+ * matchups), so several observations collocated with a product are kept
+ * as in the output. Storing it again replaces the previous row. Each
+ * row holds the output line of fluxval along with the satellite
+ * estimate and the observation compared (NULL if missing).
+ * Satellite-only matchups (fluxval -a) are not stored, they would take
+ * the place of validated matchups, the records completed by fluxval
+ * --join are.
+ * Rows are ordered by product and time, an index on station and time
+ * serves selection of stations.
+ *
+ * The database is written in WAL mode, several runs on the same host
+ * can write to it, waiting for each other.
+ *
+ * BUGS:
+ * WAL mode requires the database to be on a local file system.
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o SQLite 3
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fluxval_db.h>
+
+static char *fvdb_schema =
+    "PRAGMA journal_mode=WAL;"
+    "PRAGMA synchronous=NORMAL;"
+    "CREATE TABLE IF NOT EXISTS matchup ("
+    " product TEXT NOT NULL,"
+    " time INTEGER NOT NULL,"
+    " source TEXT NOT NULL,"
+    " area TEXT NOT NULL,"
+    " station INTEGER NOT NULL,"
+    " nbox INTEGER NOT NULL,"
+    " obstime TEXT NOT NULL,"
+    " flux REAL,"
+    " nvalid INTEGER,"
+    " obs REAL,"
+    " line TEXT NOT NULL,"
+    " PRIMARY KEY (product, time, source, area, station, nbox, obstime)"
+    ") WITHOUT ROWID;"
+    "CREATE INDEX IF NOT EXISTS matchup_station ON matchup (station, time);";
+
+static int fvdb_error(fvdb *d, char *where, char *what) {
+
+    fmerrmsg(where,"%s: %s", what, sqlite3_errmsg(d->db));
+
+    return(FM_IO_ERR);
+}
+
+fvdb *fluxval_db_open(char *filename) {
+
+    char *where="fluxval_db_open";
+    char *msg = NULL;
+    fvdb *d;
+
+    d = (fvdb *) malloc(sizeof(fvdb));
+    if (!d) {
+        fmerrmsg(where,"Could not allocate database");
+        return(NULL);
+    }
+    memset(d, 0, sizeof(fvdb));
+    if (sqlite3_open(filename, &(d->db)) != SQLITE_OK) {
+        fvdb_error(d, where, filename);
+        sqlite3_close(d->db);
+        free(d);
+        return(NULL);
+    }
+    sqlite3_busy_timeout(d->db, 600000);
+    if (sqlite3_exec(d->db, fvdb_schema, NULL, NULL, &msg) != SQLITE_OK) {
+        fmerrmsg(where,"Could not create tables in %s: %s", filename, msg);
+        sqlite3_free(msg);
+        sqlite3_close(d->db);
+        free(d);
+        return(NULL);
+    }
+    if (sqlite3_prepare_v2(d->db,
+                "INSERT OR REPLACE INTO matchup VALUES "
+                "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", -1, &(d->put), NULL)
+            != SQLITE_OK) {
+        fvdb_error(d, where, filename);
+        fmerrmsg(where,"%s may have been created by an earlier version",
+                filename);
+        sqlite3_close(d->db);
+        free(d);
+        return(NULL);
+    }
+    pthread_mutex_init(&(d->lock), NULL);
+
+    return(d);
+}
+
+/*
+ * Store a matchup, replacing any stored before. obstime is the time of
+ * the observation collocated, empty if the matchup has none.
+ */
+int fvdb_put(fvdb *d, char *product, char *area, fvmatchup *m,
+        char *obstime, int hasobs, float obs, char *line) {
+
+    char *where="fvdb_put";
+    int status = FM_OK;
+    sqlite3_stmt *st = d->put;
+
+    pthread_mutex_lock(&(d->lock));
+    if (!d->intrans) {
+        if (sqlite3_exec(d->db, "BEGIN IMMEDIATE", NULL, NULL, NULL)
+                != SQLITE_OK) {
+            pthread_mutex_unlock(&(d->lock));
+            return(fvdb_error(d, where, "Could not start transaction"));
+        }
+        d->intrans = 1;
+    }
+    sqlite3_bind_text(st, 1, product, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(st, 2,
+            (((m->year*100LL+m->month)*100+m->day)*100+m->hour)*100+
+            m->minute);
+    sqlite3_bind_text(st, 3, m->source, -1, SQLITE_STATIC);
+    sqlite3_bind_text(st, 4, area, -1, SQLITE_STATIC);
+    sqlite3_bind_int(st, 5, m->stid);
+    sqlite3_bind_int(st, 6, m->nbox);
+    sqlite3_bind_text(st, 7, obstime, -1, SQLITE_STATIC);
+    sqlite3_bind_double(st, 8, m->flux);
+    sqlite3_bind_int(st, 9, m->nvalid);
+    if (hasobs) {
+        sqlite3_bind_double(st, 10, obs);
+    } else {
+        sqlite3_bind_null(st, 10);
+    }
+    sqlite3_bind_text(st, 11, line, -1, SQLITE_STATIC);
+    if (sqlite3_step(st) != SQLITE_DONE) {
+        status = fvdb_error(d, where, "Could not store matchup");
+    } else {
+        d->nput++;
+    }
+    sqlite3_reset(st);
+    pthread_mutex_unlock(&(d->lock));
+
+    return(status);
+}
+
+/*
+ * Commit the matchups stored since the last commit.
+ */
+int fvdb_commit(fvdb *d) {
+
+    char *where="fvdb_commit";
+    int status = FM_OK;
+
+    pthread_mutex_lock(&(d->lock));
+    if (d->intrans) {
+        if (sqlite3_exec(d->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+            status = fvdb_error(d, where, "Could not commit matchups");
+        }
+        d->intrans = 0;
+    }
+    pthread_mutex_unlock(&(d->lock));
+
+    return(status);
+}
+
+int fluxval_db_close(fvdb *d) {
+
+    int status;
+
+    if (!d) return(FM_OK);
+    status = fvdb_commit(d);
+    sqlite3_finalize(d->put);
+    sqlite3_close(d->db);
+    pthread_mutex_destroy(&(d->lock));
+    free(d);
+
+    return(status);
+}
+
+/*
+ * Prepare the selection of q appended to sql.
+ */
+static sqlite3_stmt *fvdb_select(fvdb *d, fvdbquery *q, char *sql,
+        char *tail) {
+
+    char *where="fvdb_select";
+    char buf[FMSTRING1024];
+    sqlite3_stmt *st;
+
+    snprintf(buf, FMSTRING1024, "%s WHERE (?1 = '' OR product = ?1)"
+            " AND (?2 = '' OR area = ?2) AND time >= ?3 AND time <= ?4"
+            " AND (?5 = 0 OR station = ?5) %s", sql, tail);
+    if (sqlite3_prepare_v2(d->db, buf, -1, &st, NULL) != SQLITE_OK) {
+        fvdb_error(d, where, "Could not prepare query");
+        return(NULL);
+    }
+    sqlite3_bind_text(st, 1, q->product, -1, SQLITE_STATIC);
+    sqlite3_bind_text(st, 2, q->area, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(st, 3, q->start);
+    sqlite3_bind_int64(st, 4, q->end > 0 ? q->end : 999999999999LL);
+    sqlite3_bind_int(st, 5, q->station);
+
+    return(st);
+}
+
+/*
+ * Write the lines of the matchups selected, ordered by time.
+ */
+int fvdb_query(fvdb *d, fvdbquery *q, FILE *fp) {
+
+    char *where="fvdb_query";
+    int status;
+    sqlite3_stmt *st;
+
+    st = fvdb_select(d, q, "SELECT line FROM matchup",
+            "ORDER BY product, time, source, area, station, nbox, obstime");
+    if (!st) return(FM_IO_ERR);
+    while ((status = sqlite3_step(st)) == SQLITE_ROW) {
+        fprintf(fp, "%s\n", (char *) sqlite3_column_text(st, 0));
+    }
+    sqlite3_finalize(st);
+    if (status != SQLITE_DONE) {
+        return(fvdb_error(d, where, "Could not read matchups"));
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Write bias and rmse (satellite minus observation) of the matchups
+ * selected, per product and area.
+ */
+int fvdb_summary(fvdb *d, fvdbquery *q, FILE *fp) {
+
+    char *where="fvdb_summary";
+    int status;
+    long n;
+    double sumdiff, sumsqdiff;
+    sqlite3_stmt *st;
+
+    st = fvdb_select(d, q, "SELECT product, area, count(*),"
+            " count(obs), total(flux-obs), total((flux-obs)*(flux-obs))"
+            " FROM matchup", "GROUP BY product, area");
+    if (!st) return(FM_IO_ERR);
+    fprintf(fp, "%-8s %-8s %9s %9s %8s %8s\n",
+            "product", "area", "matchups", "compared", "bias", "rmse");
+    while ((status = sqlite3_step(st)) == SQLITE_ROW) {
+        n = (long) sqlite3_column_int64(st, 3);
+        sumdiff = sqlite3_column_double(st, 4);
+        sumsqdiff = sqlite3_column_double(st, 5);
+        fprintf(fp, "%-8s %-8s %9ld %9ld %8.2f %8.2f\n",
+                (char *) sqlite3_column_text(st, 0),
+                (char *) sqlite3_column_text(st, 1),
+                (long) sqlite3_column_int64(st, 2), n,
+                (n > 0) ? sumdiff/n : 0.,
+                (n > 0) ? sqrt(sumsqdiff/n) : 0.);
+    }
+    sqlite3_finalize(st);
+    if (status != SQLITE_DONE) {
+        return(fvdb_error(d, where, "Could not summarise matchups"));
+    }
+
+    return(FM_OK);
+}
@@ -0,0 +1,69 @@
+/*
+ * NAME:
+ * fluxval_db.h
+ *
+ * PURPOSE:
+ * Header file for the matchup database, an SQLite file holding each
+ * matchup once however often it is produced.
+ *
+ * NOTES:
+ * See fluxval_db.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o SQLite 3
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_DB_H
+#define _FLUXVAL_DB_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <fmutil.h>
+#include <fluxval_api.h>
+
+/*
+ * Open database, shared by the sessions of a run. Matchups are stored
+ * in a transaction committed after each product.
+ */
+struct fvdb {
+    sqlite3 *db;
+    sqlite3_stmt *put;
+    int intrans;		/* Transaction open */
+    long nput;			/* Matchups stored */
+    pthread_mutex_t lock;
+};
+
+/*
+ * Selection of matchups, empty strings and zeros select all. Times are
+ * yyyymmddhhmm.
+ */
+typedef struct {
+    char product[FMSTRING16];
+    char area[FMSTRING16];
+    long long start;
+    long long end;
+    int station;
+} fvdbquery;
+
+/*
+ * Function prototypes.
+ */
+int fvdb_put(fvdb *d, char *product, char *area, fvmatchup *m,
+        char *obstime, int hasobs, float obs, char *line);
+int fvdb_commit(fvdb *d);
+int fvdb_query(fvdb *d, fvdbquery *q, FILE *fp);
+int fvdb_summary(fvdb *d, fvdbquery *q, FILE *fp);
+
+#endif /* _FLUXVAL_DB_H */
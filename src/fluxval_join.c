@@ -0,0 +1,137 @@
+/*
+ * NAME:
+ * fluxval_join.c
+ *
+ * PURPOSE:
+ * To add observations to satellite estimates extracted earlier without
+ * observations (fluxval -a), so that products can be extracted as they
+ * arrive and the observations attached when these are delivered later
+ * (fluxval --join). The products are not read again.
+ *
+ * NOTES:
+ * Each record of the satellite only output is collocated with the
+ * observations of the session as the product it was extracted from
+ * would have been, and the matchups are written as fluxval writes them
+ * when validating the product. Records of stations without collocated
+ * observations are dropped, as are records of stations not in the
+ * station list of the session.
+ *
+ * The records hold the satellite estimates rounded as written, bias and
+ * rmse are computed from these. They do not hold the area of the
+ * product, the area of the session (fluxval_session_set_area) is used,
+ * e.g. when storing the matchups in a database.
+ *
+ * BUGS:
+ * Satellite only output written before the station number was included
+ * in the records (station 0) can not be joined.
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval.h>
+#include <ctype.h>
+
+/*
+ * Decode a satellite only record into the satellite part of a matchup.
+ * Returns FM_OK if the record is a satellite only record.
+ */
+static int fluxval_join_decode(char *line, fvmatchup *m) {
+
+    char date[FMSTRING16], obsdate[FMSTRING16];
+
+    memset(m, 0, sizeof(fvmatchup));
+    if (sscanf(line," %15s %f %d %d %31s %f %f %f %f %15s %d",
+                date, &(m->flux), &(m->nvalid), &(m->nbox), m->source,
+                &(m->geom[0]), &(m->geom[1]), &(m->geom[2]), &(m->cm),
+                obsdate, &(m->stid)) != 11) {
+        return(FM_IO_ERR);
+    }
+    if (strlen(date) != 12 || strcmp(obsdate,"000000000000") != 0 ||
+            sscanf(date,"%4d%2d%2d%2d%2d", &(m->year), &(m->month),
+                &(m->day), &(m->hour), &(m->minute)) != 5) {
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+int fluxval_join(fvsession *s, char *filename) {
+
+    char *where="fluxval_join";
+    char *line = NULL, *c;
+    size_t len = 0;
+    long nrec = 0, nbad = 0, nunknown = 0;
+    int k, h, status = FM_OK;
+    fvmatchup m;
+    FILE *fp;
+
+    if (s->satonly) {
+        fmerrmsg(where,"Observations can not be joined in a session %s",
+                "extracting satellite estimates only");
+        return(FM_IO_ERR);
+    }
+    fp = fopen(filename,"r");
+    if (!fp) {
+        fmerrmsg(where,"Could not open %s", filename);
+        return(FM_IO_ERR);
+    }
+    fvlog(FV_LOG_INFO, where,"Joining observations with %s", filename);
+
+    while (status == FM_OK && getline(&line, &len, fp) != -1) {
+        for (c=line; isspace((unsigned char) *c); c++);
+        if (*c == '\0') continue;
+        nrec++;
+        if (fluxval_join_decode(line, &m) != FM_OK || m.stid == 0) {
+            nbad++;
+            continue;
+        }
+
+        /*
+         * Locate the station in the station list of the session.
+         */
+        for (k=0; k<s->stl.cnt; k++) {
+            if (s->stl.id[k].number == m.stid) break;
+        }
+        if (k == s->stl.cnt) {
+            nunknown++;
+            continue;
+        }
+        m.station = k;
+
+        if (fluxval_load_obs(s, m.year, m.month) != FM_OK) {
+            status = FM_IO_ERR;
+            break;
+        }
+        h = -1;
+        while ((h = fluxval_collocate(s, h+1, &m)) >= 0) {
+            if (fluxval_write_matchup(s, s->fp, &m) != FM_OK) {
+                status = FM_IO_ERR;
+                break;
+            }
+            if (s->mode == FV_MODE_DAILY) break;
+        }
+    }
+    if (line) free(line);
+    fclose(fp);
+    if (s->db && fvdb_commit(s->db) != FM_OK) status = FM_IO_ERR;
+
+    if (nbad > 0) {
+        fmerrmsg(where,"%ld of %ld records of %s are not satellite only %s",
+                nbad, nrec, filename, "records with station number");
+    }
+    if (nrec > 0 && nbad == nrec) status = FM_IO_ERR;
+    if (nunknown > 0) {
+        fmlogmsg(where,"%ld records of stations not listed skipped",
+                nunknown);
+    }
+
+    return(status);
+}
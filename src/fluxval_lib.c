@@ -0,0 +1,2144 @@
+/*
+ * NAME:
+ * fluxval_lib.c
+ *
+ * PURPOSE:
+ * The core of the validation performed by fluxval, reading of flux
+ * products, extraction of satellite estimates around stations, loading of
+ * observations and collocation, organised as a library (libfluxval) with
+ * a session object keeping station positions and observations in memory
+ * between calls.
+ *
+ * NOTES:
+ * See fluxval_api.h for the interface. The functionality was previously
+ * implemented in main() of fluxval.c, which now uses this library.
+ *
+ * Checking that sat and obs is from the same hour. According to Sofus
+ * Lystad the Bioforsk observations represents integration of the last
+ * hour, time is given in UTC. The date specification below might cause
+ * evening observations during month changes to be missed, but this is not
+ * a major problem...
+ *
+ * IPY-observations (Arctic stations) are represented at the central time.
+ * Data are collected at 1 minute intervals and transformed into hourly
+ * estimates, centered at observation time.
+ *
+ * Ekofisk are represented by 10 min intervals, where each time represents
+ * the data from the previous 10 minutes. Data are reformatted to hourly
+ * data.
+ *
+ * BUGS:
+ * Only either SSI or DLI can be validated in a session.
+ *
+ * The HDF5 library is not thread safe in default builds, reading of
+ * products is serialised between sessions used in different threads.
+ *
+ * Bands are only read when used, their datasets are found among the two
+ * dimensional datasets of the image size in the root group by the
+ * description attribute, which must match that of the band in the
+ * header for one dataset only. Otherwise the whole product is read by
+ * read_hdf5_product.
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o I/O functions for HDF5 file handling (including libhdf5)
+ * o SAF product definitions
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static pthread_mutex_t fluxval_hdf5lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *fluxval_obs_names[] = {"bioforsk", "compact", "ulric", "gts"};
+
+/*
+ * Default collocation in time for the observation networks. All are
+ * hourly and stamped at the end of the hour unless the description of
+ * the format says otherwise (the compact format is stamped at the
+ * centre). Products stamped up to 10 minutes into the hour are
+ * attributed to the previous hour (lag).
+ */
+static int fluxval_colloc_defaults(fvsession *s) {
+
+    s->col.period = 3600;
+    s->col.align = FV_ALIGN_PRECEDING;
+    s->col.window = 0;
+    s->col.lag = 600;
+    s->col.interp = 0;
+    if (s->obs->fmt.colloc[0]) {
+        return(fluxval_session_set_colloc(s, s->obs->fmt.colloc));
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Observation cache of a session, shared between sessions by reference
+ * counting. The last session releasing it frees it.
+ */
+static fvobs *fluxval_obs_new(int format, fvobsformat *fmt, char *path) {
+
+    char *where="fluxval_obs_new";
+    fvobs *o;
+
+    o = (fvobs *) malloc(sizeof(fvobs));
+    if (!o) {
+        fmerrmsg(where,"Could not allocate observation cache");
+        return(NULL);
+    }
+    memset(o, 0, sizeof(fvobs));
+    o->format = format;
+    if (fmt) {
+        o->fmt = *fmt;
+    } else if (fvobsformat_builtin(fluxval_obs_names[format], 
+                &(o->fmt)) != FM_OK) {
+        free(o);
+        return(NULL);
+    }
+    snprintf(o->path,FILENAMELEN,"%s",path);
+    fvarena_init(&(o->arena), 0);
+    o->nref = 1;
+
+    return(o);
+}
+
+static void fluxval_obs_release(fvobs *o) {
+
+    if (!o) return;
+    if (--o->nref > 0) return;
+    fvarena_free(&(o->arena));
+    free(o);
+}
+
+/*
+ * Give the session a cache of its own before its station list or
+ * observation source is changed, other sessions keep the shared one.
+ */
+static int fluxval_obs_detach(fvsession *s) {
+
+    fvobs *o;
+
+    if (s->obs->nref == 1) return(FM_OK);
+    o = fluxval_obs_new(s->obs->format, &(s->obs->fmt), s->obs->path);
+    if (!o) return(FM_MEMALL_ERR);
+    fluxval_obs_release(s->obs);
+    s->obs = o;
+
+    return(FM_OK);
+}
+
+/*
+ * Forget the kernel weights and grids met, they are prepared again for
+ * the grids of the products read next.
+ */
+static void fluxval_kernel_clear(fvsession *s) {
+
+    int g;
+
+    for (g=0; g<FV_MAXGRID; g++) {
+        if (s->kweight[g]) free(s->kweight[g]);
+        s->kweight[g] = NULL;
+    }
+    s->ngrid = 0;
+}
+
+/*
+ * Weights of the pixels of the box around each station for the grid in
+ * slot g, centred on the position of the station within the centre
+ * pixel and normalised to a sum of 1. The footprint covering a pixel is
+ * estimated from 4x4 points within it. No weights are needed for box
+ * averages or single pixels.
+ */
+static int fluxval_kernel_prepare(fvsession *s, int g) {
+
+    char *where="fluxval_kernel_prepare";
+    int k, i, j, a, b, c, n, hw, hh;
+    float *w, dx, dy, x, y, v, sum, r2;
+    s_pos *pos = &(s->spos[g]);
+
+    if (s->kweight[g]) free(s->kweight[g]);
+    s->kweight[g] = NULL;
+    n = s->sdata.iw*s->sdata.ih;
+    if (s->kern.type == FV_KERNEL_BOX || n == 1 || s->stl.cnt == 0) {
+        return(FM_OK);
+    }
+    s->kweight[g] = (float *) malloc(s->stl.cnt*n*sizeof(float));
+    if (!s->kweight[g]) {
+        fmerrmsg(where,"Could not allocate kernel weights");
+        return(FM_MEMALL_ERR);
+    }
+    hw = s->sdata.iw/2;
+    hh = s->sdata.ih/2;
+    r2 = s->kern.param*s->kern.param;
+    for (k=0; k<s->stl.cnt; k++) {
+        w = s->kweight[g]+k*n;
+        sum = 0.;
+        for (i=0; i<s->sdata.ih; i++) {
+            for (j=0; j<s->sdata.iw; j++) {
+                dx = (float) (j-hw)-pos->sx[k];
+                dy = (float) (i-hh)-pos->sy[k];
+                if (s->kern.type == FV_KERNEL_GAUSS) {
+                    v = expf(-(dx*dx+dy*dy)/(2.*r2));
+                } else {
+                    c = 0;
+                    for (a=0; a<4; a++) {
+                        y = dy-0.5+(a+0.5)/4.;
+                        for (b=0; b<4; b++) {
+                            x = dx-0.5+(b+0.5)/4.;
+                            if (x*x+y*y <= r2) c++;
+                        }
+                    }
+                    v = (float) c/16.;
+                }
+                w[i*s->sdata.iw+j] = v;
+                sum += v;
+            }
+        }
+        for (i=0; i<n && sum > 0.; i++) {
+            w[i] /= sum;
+        }
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Messages written, 0 errors only, 1 also products and months read, 2
+ * also stations and files (see fluxval_log.c).
+ */
+void fluxval_set_loglevel(int level) {
+
+    fvlog_set_level(level);
+}
+
+fvsession *fluxval_session_new(void) {
+
+    char *where="fluxval_session_new";
+    int g;
+    fvsession *s;
+
+    s = (fvsession *) malloc(sizeof(fvsession));
+    if (!s) {
+        fmerrmsg(where,"Could not allocate session");
+        return(NULL);
+    }
+    memset(s, 0, sizeof(fvsession));
+    sprintf(s->product,"ssi");
+    s->mode = FV_MODE_PASSAGE;
+    s->obs = fluxval_obs_new(FV_OBS_BIOFORSK, NULL, DATAPATH);
+    if (!s->obs) {
+        free(s);
+        return(NULL);
+    }
+    s->fp = stdout;
+    s->minhours = 1;
+    fluxval_colloc_defaults(s);
+    for (g=0; g<FV_MAXGRID; g++) init_product_positions(&(s->spos[g]));
+    runstats_init(&(s->rs));
+
+    /*
+     * Specifying the size of the data collection box. This should be
+     * configurable in the future, but is hardcoded at present...
+     */
+    s->sdata.iw = 13;
+    s->sdata.ih = 13;
+    s->sdata.data = (float *) malloc((s->sdata.iw*s->sdata.ih)*sizeof(float));
+    if (!s->sdata.data) {
+        fmerrmsg(where,"Could not allocate memory");
+        fluxval_obs_release(s->obs);
+        free(s);
+        return(NULL);
+    }
+
+    return(s);
+}
+
+void fluxval_session_free(fvsession *s) {
+
+    int g;
+
+    if (!s) return;
+    fluxval_obs_release(s->obs);
+    if (s->stl.cnt) clear_stlist(&(s->stl));
+    if (s->gpos) free(s->gpos);
+    for (g=0; g<FV_MAXGRID; g++) {
+        clear_product_positions(&(s->spos[g]));
+        if (s->kweight[g]) free(s->kweight[g]);
+    }
+    if (s->sdata.data) free(s->sdata.data);
+    free(s);
+}
+
+int fluxval_session_set_product(fvsession *s, char *product) {
+
+    char *where="fluxval_session_set_product";
+
+    if (!strstr(product,"ssi") && !strstr(product,"dli")) {
+        fmerrmsg(where,"Product %s is not supported", product);
+        return(FM_IO_ERR);
+    }
+    snprintf(s->product,FMSTRING16,"%s",product);
+
+    return(FM_OK);
+}
+
+int fluxval_session_set_mode(fvsession *s, int mode) {
+
+    char *where="fluxval_session_set_mode";
+    int size;
+
+    if (mode == FV_MODE_DAILY) {
+        size = 1;
+    } else if (mode == FV_MODE_PASSAGE) {
+        size = 13;
+    } else {
+        fmerrmsg(where,"Unknown mode %d", mode);
+        return(FM_IO_ERR);
+    }
+    s->mode = mode;
+    s->sdata.iw = size;
+    s->sdata.ih = size;
+    fluxval_kernel_clear(s);
+
+    return(FM_OK);
+}
+
+int fluxval_session_set_satonly(fvsession *s, int satonly) {
+
+    s->satonly = satonly ? 1 : 0;
+
+    return(FM_OK);
+}
+
+int fluxval_session_set_obs(fvsession *s, char *path, int format) {
+
+    char *where="fluxval_session_set_obs";
+
+    if (format < FV_OBS_BIOFORSK || format > FV_OBS_GTS) {
+        fmerrmsg(where,"Unknown observation format %d", format);
+        return(FM_IO_ERR);
+    }
+    if (fluxval_obs_detach(s) != FM_OK) return(FM_MEMALL_ERR);
+    if (s->obs->month > 0) {
+        clear_stdata(&(s->obs->std), s->stl.cnt, &(s->obs->arena));
+        s->obs->month = 0;
+    }
+    s->obs->format = format;
+    if (fvobsformat_builtin(fluxval_obs_names[format], 
+                &(s->obs->fmt)) != FM_OK) return(FM_IO_ERR);
+    snprintf(s->obs->path,FILENAMELEN,"%s",path);
+
+    return(fluxval_colloc_defaults(s));
+}
+
+/*
+ * Observations in a format described by formatfile (see
+ * fluxval_obsformat.c), e.g. networks without a built in reader.
+ */
+int fluxval_session_set_obs_format(fvsession *s, char *path, 
+        char *formatfile) {
+
+    fvobsformat fmt;
+
+    if (fvobsformat_read(formatfile, &fmt) != FM_OK) return(FM_IO_ERR);
+    if (fluxval_obs_detach(s) != FM_OK) return(FM_MEMALL_ERR);
+    if (s->obs->month > 0) {
+        clear_stdata(&(s->obs->std), s->stl.cnt, &(s->obs->arena));
+        s->obs->month = 0;
+    }
+    s->obs->format = FV_OBS_FILE;
+    s->obs->fmt = fmt;
+    snprintf(s->obs->path,FILENAMELEN,"%s",path);
+
+    return(fluxval_colloc_defaults(s));
+}
+
+/*
+ * Override the collocation in time of the network selected by
+ * fluxval_session_set_obs. The specification is a comma separated list
+ * of key=value, times are given in minutes:
+ *   period=<min>   integration period of observations
+ *   align=preceding|centred|following
+ *   window=<min>   accept nearest observation within this distance
+ *   lag=<min>      shift product time back before matching
+ *   interp=yes|no  interpolate observations before and after in time
+ */
+int fluxval_session_set_colloc(fvsession *s, char *spec) {
+
+    char *where="fluxval_session_set_colloc";
+    char buf[FMSTRING256], *item, *value, *saveptr;
+    fvcolloc col;
+
+    col = s->col;
+    snprintf(buf,FMSTRING256,"%s",spec);
+    for (item=strtok_r(buf,",",&saveptr); item; 
+            item=strtok_r(NULL,",",&saveptr)) {
+        value = strchr(item,'=');
+        if (!value) {
+            fmerrmsg(where,"Expected key=value, got %s", item);
+            return(FM_IO_ERR);
+        }
+        *value++ = '\0';
+        if (strcmp(item,"period") == 0) {
+            col.period = 60*atoi(value);
+        } else if (strcmp(item,"window") == 0) {
+            col.window = 60*atoi(value);
+        } else if (strcmp(item,"lag") == 0) {
+            col.lag = 60*atoi(value);
+        } else if (strcmp(item,"align") == 0) {
+            if (strcmp(value,"preceding") == 0) {
+                col.align = FV_ALIGN_PRECEDING;
+            } else if (strcmp(value,"centred") == 0 || 
+                    strcmp(value,"centered") == 0) {
+                col.align = FV_ALIGN_CENTRED;
+            } else if (strcmp(value,"following") == 0) {
+                col.align = FV_ALIGN_FOLLOWING;
+            } else {
+                fmerrmsg(where,"Unknown alignment %s", value);
+                return(FM_IO_ERR);
+            }
+        } else if (strcmp(item,"interp") == 0) {
+            col.interp = (strcmp(value,"yes") == 0 || 
+                    strcmp(value,"1") == 0);
+        } else {
+            fmerrmsg(where,"Unknown collocation parameter %s", item);
+            return(FM_IO_ERR);
+        }
+    }
+    if (col.period <= 0 || col.window < 0) {
+        fmerrmsg(where,"Period must be positive and window not negative");
+        return(FM_IO_ERR);
+    }
+    s->col = col;
+
+    return(FM_OK);
+}
+
+/*
+ * Number of hours with valid observations required for a daily mean,
+ * days with fewer are reported as missing.
+ */
+int fluxval_session_set_minhours(fvsession *s, int minhours) {
+
+    char *where="fluxval_session_set_minhours";
+
+    if (minhours < 1 || minhours > 24) {
+        fmerrmsg(where,"Valid hours required must be 1-24, not %d", minhours);
+        return(FM_IO_ERR);
+    }
+    s->minhours = minhours;
+
+    return(FM_OK);
+}
+
+/*
+ * Weighting of the estimates in the box around a station when averaged,
+ * spec is one of
+ *   box              all valid pixels weigh the same (default)
+ *   gauss[:sigma]    Gaussian of the distance to the station, sigma in
+ *                    pixels (default 2)
+ *   footprint[:r]    part of each pixel within r pixels of the station
+ *                    (default 3)
+ * Single pixels (daily products) are not weighted.
+ */
+int fluxval_session_set_kernel(fvsession *s, char *spec) {
+
+    char *where="fluxval_session_set_kernel";
+    char buf[FMSTRING64], *value;
+    fvkernel kern;
+
+    snprintf(buf,FMSTRING64,"%s",spec);
+    value = strchr(buf,':');
+    if (value) *value++ = '\0';
+    if (strcmp(buf,"box") == 0) {
+        kern.type = FV_KERNEL_BOX;
+        kern.param = 0.;
+    } else if (strcmp(buf,"gauss") == 0) {
+        kern.type = FV_KERNEL_GAUSS;
+        kern.param = value ? atof(value) : 2.;
+    } else if (strcmp(buf,"footprint") == 0) {
+        kern.type = FV_KERNEL_FOOTPRINT;
+        kern.param = value ? atof(value) : 3.;
+    } else {
+        fmerrmsg(where,"Unknown kernel %s", spec);
+        return(FM_IO_ERR);
+    }
+    if (kern.type != FV_KERNEL_BOX && kern.param <= 0.) {
+        fmerrmsg(where,"Kernel size must be positive in %s", spec);
+        return(FM_IO_ERR);
+    }
+    s->kern = kern;
+    fluxval_kernel_clear(s);
+
+    return(FM_OK);
+}
+
+static int fluxval_stations_prepare(fvsession *s);
+
+/*
+ * Decode the station list and prepare positions for projection.
+ */
+int fluxval_session_set_stations(fvsession *s, char *stfile) {
+
+    char *where="fluxval_session_set_stations";
+    int g;
+
+    if (fluxval_obs_detach(s) != FM_OK) return(FM_MEMALL_ERR);
+    if (s->obs->month > 0) {
+        clear_stdata(&(s->obs->std), s->stl.cnt, &(s->obs->arena));
+        s->obs->month = 0;
+    }
+    if (s->stl.cnt) clear_stlist(&(s->stl));
+    if (s->gpos) free(s->gpos);
+    s->gpos = NULL;
+    for (g=0; g<FV_MAXGRID; g++) clear_product_positions(&(s->spos[g]));
+    fluxval_kernel_clear(s);
+
+    if (decode_stlist(stfile, &(s->stl)) != 0) {
+        fmerrmsg(where," Could not decode station file.");
+        return(FM_IO_ERR);
+    }
+
+    return(fluxval_stations_prepare(s));
+}
+
+/*
+ * Prepare the observation arena and positions of the station list
+ * decoded.
+ */
+static int fluxval_stations_prepare(fvsession *s) {
+
+    char *where="fluxval_stations_prepare";
+    int k;
+
+    /*
+     * Size the observation arena to hold a month for all stations, it
+     * is then reused for every month read.
+     */
+    fvarena_free(&(s->obs->arena));
+    fvarena_init(&(s->obs->arena), s->stl.cnt*(sizeof(stdata)+
+                NO_MONTHOBS*sizeof(parlist)+sizeof(fvdaily)+
+                sizeof(fvobsindex)+NO_MONTHOBS*(sizeof(long)+sizeof(short))+
+                64)+64);
+
+    /*
+     * Station positions are projected once, image indices are only
+     * recomputed when the product grid changes.
+     */
+    s->gpos = (fmgeopos *) malloc(s->stl.cnt*sizeof(fmgeopos));
+    if (!s->gpos) {
+        fmerrmsg(where,"Could not allocate memory for station positions");
+        return(FM_MEMALL_ERR);
+    }
+    for (k=0; k<s->stl.cnt; k++) {
+        s->gpos[k].lat = s->stl.id[k].lat;
+        s->gpos[k].lon = s->stl.id[k].lon;
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Create a session with the configuration and station list of s, but
+ * with observations and product grids of its own and output to stdout.
+ * Used to process products of the same run in several threads.
+ */
+fvsession *fluxval_session_clone(fvsession *s) {
+
+    char *where="fluxval_session_clone";
+    fvsession *c;
+
+    c = fluxval_session_new();
+    if (!c) return(NULL);
+    snprintf(c->product,FMSTRING16,"%s",s->product);
+    fluxval_session_set_mode(c, s->mode);
+    c->satonly = s->satonly;
+    c->minhours = s->minhours;
+    c->obs->format = s->obs->format;
+    c->obs->fmt = s->obs->fmt;
+    snprintf(c->obs->path,FILENAMELEN,"%s",s->obs->path);
+    c->col = s->col;
+    c->kern = s->kern;
+    c->db = s->db;
+    c->cube = s->cube;
+    if (s->stl.cnt) {
+        if (copy_stlist(&(c->stl), &(s->stl)) != FM_OK || 
+                fluxval_stations_prepare(c) != FM_OK) {
+            fmerrmsg(where,"Could not copy station list");
+            fluxval_session_free(c);
+            return(NULL);
+        }
+    }
+
+    return(c);
+}
+
+int fluxval_session_set_output(fvsession *s, FILE *fp) {
+
+    s->fp = fp;
+
+    return(FM_OK);
+}
+
+/*
+ * Store matchups in db as well as writing them, db is owned by the
+ * caller and may be shared by several sessions.
+ */
+int fluxval_session_set_db(fvsession *s, fvdb *db) {
+
+    s->db = db;
+
+    return(FM_OK);
+}
+
+/*
+ * Store the boxes extracted in a patch cube, c is owned by the caller
+ * and may be shared by several sessions.
+ */
+int fluxval_session_set_cube(fvsession *s, fvcube *c) {
+
+    s->cube = c;
+
+    return(FM_OK);
+}
+
+/*
+ * Area of the matchups joined with observations (fluxval_join), the
+ * area of products validated is taken from the products.
+ */
+int fluxval_session_set_area(fvsession *s, char *area) {
+
+    char *where="fluxval_session_set_area";
+
+    if (strlen(area) >= FMSTRING16) {
+        fmerrmsg(where,"Area name %s is too long", area);
+        return(FM_IO_ERR);
+    }
+    snprintf(s->area,FMSTRING16,"%s",area);
+
+    return(FM_OK);
+}
+
+int fluxval_session_nstations(fvsession *s) {
+
+    return(s->stl.cnt);
+}
+
+int fluxval_session_report(fvsession *s, char *filename) {
+
+    return(runstats_report(&(s->rs), filename));
+}
+
+/*
+ * Drop the observations held in memory, these are read again when the
+ * next product is processed. Used when observation files are updated.
+ */
+int fluxval_session_refresh_obs(fvsession *s) {
+
+    if (s->obs->month > 0) {
+        clear_stdata(&(s->obs->std), s->stl.cnt, &(s->obs->arena));
+        s->obs->month = 0;
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Let session s use the observations of session from, e.g. to validate
+ * SSI and DLI over the same stations reading the observations once.
+ * Both sessions must use the same station list, set before sharing.
+ * The collocation of s is kept. Changing the stations or observation
+ * source of either session later gives it observations of its own again.
+ */
+int fluxval_session_share_obs(fvsession *s, fvsession *from) {
+
+    char *where="fluxval_session_share_obs";
+    int k;
+
+    if (s->obs == from->obs) return(FM_OK);
+    if (s->stl.cnt != from->stl.cnt) {
+        fmerrmsg(where,"Sessions do not use the same station list");
+        return(FM_IO_ERR);
+    }
+    for (k=0; k<s->stl.cnt; k++) {
+        if (s->stl.id[k].number != from->stl.id[k].number) {
+            fmerrmsg(where,"Sessions do not use the same station list");
+            return(FM_IO_ERR);
+        }
+    }
+    fluxval_obs_release(s->obs);
+    s->obs = from->obs;
+    s->obs->nref++;
+
+    return(FM_OK);
+}
+
+/*
+ * Return the comparison of matchups written since the session was
+ * created or last reset.
+ */
+int fluxval_session_stats(fvsession *s, fvstats *st, int reset) {
+
+    *st = s->st;
+    if (reset) memset(&(s->st), 0, sizeof(fvstats));
+
+    return(FM_OK);
+}
+
+/*
+ * Check a filename against the comma separated list of patterns in
+ * fntest (e.g. "ns.hdf5,nr.hdf5" when several areas are validated).
+ */
+int fluxval_fntest(char *filename, char *fntest) {
+
+    char buf[FILENAMELEN], *item, *saveptr;
+
+    if (!strchr(fntest,',')) return(strstr(filename,fntest) != NULL);
+
+    snprintf(buf,FILENAMELEN,"%s",fntest);
+    for (item=strtok_r(buf,",",&saveptr); item; 
+            item=strtok_r(NULL,",",&saveptr)) {
+        if (strstr(filename,item)) return(1);
+    }
+
+    return(0);
+}
+
+/*
+ * Datasets that may hold bands, the two dimensional datasets of the
+ * image size in the root group with their description attribute (empty
+ * if none). full is set if there were more than FV_MAXCAND.
+ */
+#define FV_MAXCAND (2*FV_MAXBAND)
+
+typedef struct {
+    fvproduct *p;
+    int n;
+    short full;
+    char name[FV_MAXCAND][FMSTRING64];
+    char desc[FV_MAXCAND][FMSTRING64];
+} fvbandscan;
+
+/*
+ * Read the description attribute of a dataset, returns 1 if found.
+ */
+static int fluxval_band_desc(hid_t d, char *desc, int len) {
+
+    hid_t a, t, mt;
+    char *vs = NULL;
+    size_t n;
+    int ok = 0;
+
+    desc[0] = '\0';
+    if (H5Aexists(d, "description") <= 0) return(0);
+    a = H5Aopen(d, "description", H5P_DEFAULT);
+    if (a < 0) return(0);
+    t = H5Aget_type(a);
+    if (H5Tget_class(t) == H5T_STRING) {
+        if (H5Tis_variable_str(t) > 0) {
+            mt = H5Tcopy(H5T_C_S1);
+            H5Tset_size(mt, H5T_VARIABLE);
+            if (H5Aread(a, mt, &vs) >= 0 && vs) {
+                ok = (snprintf(desc, len, "%s", vs) < len);
+                H5free_memory(vs);
+            }
+            H5Tclose(mt);
+        } else {
+            n = H5Tget_size(t);
+            vs = (char *) calloc(n+1, 1);
+            if (vs && H5Aread(a, t, vs) >= 0) {
+                ok = (snprintf(desc, len, "%s", vs) < len);
+            }
+            if (vs) free(vs);
+        }
+    }
+    H5Tclose(t);
+    H5Aclose(a);
+    if (!ok) desc[0] = '\0';
+
+    return(ok);
+}
+
+/*
+ * Collect the datasets that may hold bands in a group.
+ */
+static herr_t fluxval_band_find(hid_t g, const char *name, 
+        const H5L_info_t *info, void *data) {
+
+    fvbandscan *sc = (fvbandscan *) data;
+    hid_t d, sp;
+    hsize_t dims[2];
+    int rank;
+
+    H5E_BEGIN_TRY {
+        d = H5Dopen2(g, name, H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (d < 0) return(0);
+    sp = H5Dget_space(d);
+    rank = H5Sget_simple_extent_ndims(sp);
+    if (rank == 2) {
+        H5Sget_simple_extent_dims(sp, dims, NULL);
+        if (dims[0] == (hsize_t) sc->p->ipd.h.ih && 
+                dims[1] == (hsize_t) sc->p->ipd.h.iw) {
+            if (sc->n < FV_MAXCAND && strlen(name) < FMSTRING64) {
+                strcpy(sc->name[sc->n], name);
+                fluxval_band_desc(d, sc->desc[sc->n], FMSTRING64);
+                sc->n++;
+            } else {
+                sc->full = 1;
+            }
+        }
+    }
+    H5Sclose(sp);
+    H5Dclose(d);
+
+    return(0);
+}
+
+/*
+ * Find the datasets of the bands of a product so that these can be read
+ * when used. Band k is the only dataset with the description of band k
+ * in the header. Returns FM_OK if all bands were found, in distinct
+ * datasets, with the datatype given in the header. The file is then
+ * kept open for reading the bands until the product is freed.
+ */
+static int fluxval_band_open(fvproduct *p) {
+
+    hid_t f, d, t;
+    hsize_t idx = 0;
+    int i, k, m, ok;
+    char used[FV_MAXCAND];
+    fvbandscan *sc;
+
+    p->nband = 0;
+    p->fid = -1;
+    if (!p->ipd.d || p->ipd.h.z < 1 || p->ipd.h.z > FV_MAXBAND) {
+        return(FM_IO_ERR);
+    }
+    sc = (fvbandscan *) malloc(sizeof(fvbandscan));
+    if (!sc) return(FM_MEMALL_ERR);
+    sc->p = p;
+    sc->n = 0;
+    sc->full = 0;
+    H5E_BEGIN_TRY {
+        f = H5Fopen(p->filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (f < 0) {
+        free(sc);
+        return(FM_IO_ERR);
+    }
+    H5Literate(f, H5_INDEX_NAME, H5_ITER_INC, &idx, fluxval_band_find, sc);
+    ok = !sc->full;
+    memset(used, 0, FV_MAXCAND);
+    for (k=0; ok && k<p->ipd.h.z; k++) {
+        m = -1;
+        if (p->ipd.d[k].description[0] == '\0') ok = 0;
+        for (i=0; ok && i<sc->n; i++) {
+            if (strcmp(sc->desc[i], p->ipd.d[k].description) != 0) continue;
+            if (m >= 0) ok = 0;
+            m = i;
+        }
+        if (m < 0 || used[m]) ok = 0;
+        if (ok) {
+            used[m] = 1;
+            strcpy(p->bandname[k], sc->name[m]);
+        }
+    }
+    free(sc);
+    if (ok) p->nband = p->ipd.h.z;
+    for (k=0; ok && k<p->ipd.h.z; k++) {
+        d = H5Dopen2(f, p->bandname[k], H5P_DEFAULT);
+        if (d < 0) {
+            ok = 0;
+            break;
+        }
+        t = H5Dget_type(d);
+        switch (p->ipd.d[k].datatype) {
+            case OSI_FLOAT:
+                ok = (H5Tget_class(t) == H5T_FLOAT && H5Tget_size(t) == 4);
+                break;
+            case OSI_USHORT:
+                ok = (H5Tget_class(t) == H5T_INTEGER && H5Tget_size(t) == 2);
+                break;
+            case OSI_UCHAR:
+                ok = (H5Tget_class(t) == H5T_INTEGER && H5Tget_size(t) == 1);
+                break;
+            default:
+                ok = 0;
+        }
+        H5Tclose(t);
+        H5Dclose(d);
+    }
+    if (!ok) {
+        H5Fclose(f);
+        p->nband = 0;
+        return(FM_IO_ERR);
+    }
+    p->fid = f;
+    memset(p->loaded, 0, FV_MAXBAND);
+
+    return(FM_OK);
+}
+
+static size_t fluxval_band_size(fvproduct *p, int k) {
+
+    size_t n = (size_t) p->ipd.h.iw*p->ipd.h.ih;
+
+    switch (p->ipd.d[k].datatype) {
+        case OSI_USHORT:
+            return(n*sizeof(unsigned short));
+        case OSI_UCHAR:
+            return(n*sizeof(unsigned char));
+        default:
+            return(n*sizeof(float));
+    }
+}
+
+/*
+ * Return the data of band k, read when first used.
+ */
+static void *fluxval_band(fvproduct *p, int k) {
+
+    char *where="fluxval_band";
+    hid_t d, t;
+    herr_t status = -1;
+
+    if (k < 0 || k >= p->ipd.h.z) return(NULL);
+    if (p->nband == 0 || p->loaded[k]) return(p->ipd.d[k].data);
+
+    p->ipd.d[k].data = malloc(fluxval_band_size(p, k));
+    if (!p->ipd.d[k].data) {
+        fmerrmsg(where,"Could not allocate band %d of %s", k, p->filename);
+        return(NULL);
+    }
+    switch (p->ipd.d[k].datatype) {
+        case OSI_USHORT:
+            t = H5T_NATIVE_USHORT;
+            break;
+        case OSI_UCHAR:
+            t = H5T_NATIVE_UCHAR;
+            break;
+        default:
+            t = H5T_NATIVE_FLOAT;
+    }
+    runstats_start(p->rs, RS_READPROD);
+    pthread_mutex_lock(&fluxval_hdf5lock);
+    d = H5Dopen2(p->fid, p->bandname[k], H5P_DEFAULT);
+    if (d >= 0) {
+        status = H5Dread(d, t, H5S_ALL, H5S_ALL, H5P_DEFAULT, 
+                p->ipd.d[k].data);
+        H5Dclose(d);
+    }
+    pthread_mutex_unlock(&fluxval_hdf5lock);
+    runstats_stop(p->rs, RS_READPROD);
+    if (status < 0) {
+        fmerrmsg(where,"Could not read band %d of %s", k, p->filename);
+        free(p->ipd.d[k].data);
+        p->ipd.d[k].data = NULL;
+        return(NULL);
+    }
+    p->loaded[k] = 1;
+
+    return(p->ipd.d[k].data);
+}
+
+static short fluxval_hascm(fvproduct *p) {
+
+    return(p->ipd.h.z == 7 && strcmp(p->ipd.d[6].description,"CM") == 0);
+}
+
+/*
+ * Read the header of the satellite derived data, the bands are read
+ * when used (see fluxval_band).
+ */
+fvproduct *fluxval_product_read(fvsession *s, char *filename) {
+
+    char *where="fluxval_product_read";
+    int k, g, status, newgrid;
+    struct stat sbuf;
+    fvproduct *p;
+
+    p = (fvproduct *) malloc(sizeof(fvproduct));
+    if (!p) {
+        fmerrmsg(where,"Could not allocate product");
+        return(NULL);
+    }
+    p->pos = NULL;
+    p->kw = NULL;
+    p->nband = 0;
+    p->fid = -1;
+    p->store = NULL;
+    p->patch = NULL;
+    p->rs = &(s->rs);
+    snprintf(p->filename,FILENAMELEN,"%s",filename);
+
+    fvlog(FV_LOG_DEBUG, where, "Reading OSISAF product %s", filename);
+    runstats_start(&(s->rs), RS_READPROD);
+    pthread_mutex_lock(&fluxval_hdf5lock);
+    p->ipd.d = NULL;
+    status = read_hdf5_product(filename, &(p->ipd), 1);
+    if (status == 0 && fluxval_band_open(p) != FM_OK) {
+        free_osihdf(&(p->ipd));
+        status = read_hdf5_product(filename, &(p->ipd), 0);
+    }
+    pthread_mutex_unlock(&fluxval_hdf5lock);
+    if (status != 0) {
+        runstats_stop(&(s->rs), RS_READPROD);
+        fmerrmsg(where, "Could not read input file %s", filename);
+        free(p);
+        return(NULL);
+    }
+    runstats_stop(&(s->rs), RS_READPROD);
+    runstats_count(&(s->rs), RC_FILESREAD, 1);
+    if (stat(filename, &sbuf) == 0) {
+        runstats_count(&(s->rs), RC_BYTESREAD, (long long) sbuf.st_size);
+    }
+
+    if (fvlog_level() >= FV_LOG_DEBUG) {
+        fvlog(FV_LOG_DEBUG, where, 
+                "Source %s, product %s, area %s, %4d-%02d-%02d %02d:%02d, "
+                "%dx%d pixels", p->ipd.h.source, p->ipd.h.product, 
+                p->ipd.h.area, p->ipd.h.year, p->ipd.h.month, p->ipd.h.day,
+                p->ipd.h.hour, p->ipd.h.minute, p->ipd.h.iw, p->ipd.h.ih);
+        for (k=0; k<p->ipd.h.z; k++) {
+            fvlog(FV_LOG_DEBUG, where, "Band %d - %s", 
+                    k, p->ipd.d[k].description);
+        }
+    }
+
+    p->hascm = fluxval_hascm(p);
+
+    /*
+     * Convert station positions to image indices for this grid. The
+     * indices of the last FV_MAXGRID grids (areas) are kept, so this is
+     * only done the first time a grid is met.
+     */
+    for (g=0; g<s->ngrid && g<FV_MAXGRID; g++) {
+        if (return_product_positions_match(p->ipd.h, &(s->spos[g]))) break;
+    }
+    newgrid = (g == s->ngrid || g == FV_MAXGRID);
+    if (newgrid) {
+        g = (s->ngrid++)%FV_MAXGRID;
+    }
+    p->pos = &(s->spos[g]);
+    if (s->stl.cnt > 0 && return_product_positions(s->gpos, s->stl.cnt,
+                p->ipd.h, p->pos) != FM_OK) {
+        fmerrmsg(where,
+                "Could not project stations to grid of %s", filename);
+        fluxval_product_free(p);
+        return(NULL);
+    }
+    if (newgrid && fluxval_kernel_prepare(s, g) != FM_OK) {
+        fluxval_product_free(p);
+        return(NULL);
+    }
+    p->kw = s->kweight[g];
+
+    return(p);
+}
+
+void fluxval_product_free(fvproduct *p) {
+
+    int k;
+
+    if (!p) return;
+    for (k=0; k<p->nband; k++) {
+        if (!p->loaded[k]) {
+            runstats_count(p->rs, RC_BANDBYTESSKIPPED, 
+                    (long long) fluxval_band_size(p, k));
+        }
+    }
+    if (p->fid >= 0) {
+        pthread_mutex_lock(&fluxval_hdf5lock);
+        H5Fclose(p->fid);
+        pthread_mutex_unlock(&fluxval_hdf5lock);
+    }
+    if (p->store) fvpatch_free(p->store);
+    if (p->patch) {
+        fvpatch_free(p->patch);
+    } else {
+        free_osihdf(&(p->ipd));
+    }
+    free(p);
+}
+
+/*
+ * Whether band k is extracted in session s (see fluxval_extract): the
+ * flux, the observation geometry of passage SSI products and the cloud
+ * mask of passage products.
+ */
+static int fluxval_band_used(fvsession *s, fvproduct *p, int k) {
+
+    if (k == 0) return(1);
+    if (s->mode != FV_MODE_PASSAGE) return(0);
+    if (k >= 3 && k <= 5) return(strstr(s->product,"ssi") != NULL);
+    if (k == 6) return(p->hascm);
+
+    return(0);
+}
+
+typedef struct {
+    long long off;
+    long long len;
+} fvextent;
+
+static int fluxval_extent_cmp(const void *a, const void *b) {
+
+    long long d = ((fvextent *) a)->off-((fvextent *) b)->off;
+
+    return((d > 0)-(d < 0));
+}
+
+static int fluxval_extent_put(fvextent **ext, int *n, int *max,
+        haddr_t addr, hsize_t size) {
+
+    fvextent *t;
+
+    if (*n == *max) {
+        t = (fvextent *) realloc(*ext, (*max+256)*sizeof(fvextent));
+        if (!t) return(FM_MEMALL_ERR);
+        *ext = t;
+        *max += 256;
+    }
+    (*ext)[*n].off = (long long) addr;
+    (*ext)[*n].len = (long long) size;
+    (*n)++;
+
+    return(FM_OK);
+}
+
+/*
+ * Add the storage of dataset d, contiguous or the chunks of a chunked
+ * dataset, to the extents. Returns FM_OK if its location is known.
+ */
+static int fluxval_extent_add(hid_t d, fvextent **ext, int *n, int *max) {
+
+    haddr_t addr;
+#if H5_VERSION_GE(1,10,5)
+    hsize_t i, nchunk, size;
+    unsigned mask;
+    hid_t sp;
+    herr_t status;
+#endif
+
+    addr = H5Dget_offset(d);
+    if (addr != HADDR_UNDEF) {
+        return(fluxval_extent_put(ext, n, max, addr, 
+                    H5Dget_storage_size(d)));
+    }
+#if H5_VERSION_GE(1,10,5)
+    sp = H5Dget_space(d);
+    status = H5Dget_num_chunks(d, sp, &nchunk);
+    for (i=0; status >= 0 && i<nchunk; i++) {
+        status = H5Dget_chunk_info(d, sp, i, NULL, &mask, &addr, &size);
+        if (status >= 0 && addr != HADDR_UNDEF &&
+                fluxval_extent_put(ext, n, max, addr, size) != FM_OK) {
+            status = -1;
+        }
+    }
+    H5Sclose(sp);
+
+    return((status >= 0) ? FM_OK : FM_IO_ERR);
+#else
+    return(FM_IO_ERR);
+#endif
+}
+
+/*
+ * Read ahead the parts of a product that session s will read, leaving
+ * them in the page cache (see fluxval_prefetch.c). The header is read
+ * as fluxval_product_read does, then only the storage of the bands
+ * extracted is read, not that of the bands skipped. buf is a buffer of
+ * len bytes. Returns the bytes of bands read, or -1 if the bands are not
+ * read on demand but the product as a whole.
+ */
+long long fluxval_product_prefetch(fvsession *s, char *filename,
+        char *buf, size_t len) {
+
+    fvproduct *p;
+    fvextent *ext = NULL;
+    hid_t d;
+    int i, k, fd, n = 0, max = 0, status;
+    long long bytes = 0, off, end;
+    ssize_t nr;
+
+    p = (fvproduct *) calloc(1, sizeof(fvproduct));
+    if (!p) return(-1);
+    snprintf(p->filename,FILENAMELEN,"%s",filename);
+    pthread_mutex_lock(&fluxval_hdf5lock);
+    status = (read_hdf5_product(filename, &(p->ipd), 1) == 0) ? FM_OK : 
+        FM_IO_ERR;
+    if (status == FM_OK) status = fluxval_band_open(p);
+    if (status == FM_OK) {
+        p->hascm = fluxval_hascm(p);
+        for (k=0; k<p->nband && status == FM_OK; k++) {
+            if (!fluxval_band_used(s, p, k)) continue;
+            d = H5Dopen2(p->fid, p->bandname[k], H5P_DEFAULT);
+            status = (d >= 0) ? fluxval_extent_add(d, &ext, &n, &max) :
+                FM_IO_ERR;
+            if (d >= 0) H5Dclose(d);
+        }
+        H5Fclose(p->fid);
+    }
+    if (p->ipd.d) free_osihdf(&(p->ipd));
+    pthread_mutex_unlock(&fluxval_hdf5lock);
+    free(p);
+    if (status != FM_OK) {
+        if (ext) free(ext);
+        return(-1);
+    }
+
+    /*
+     * Read the extents in the order of the file.
+     */
+    fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        qsort(ext, n, sizeof(fvextent), fluxval_extent_cmp);
+        for (i=0; i<n; i++) {
+            posix_fadvise(fd, ext[i].off, ext[i].len, POSIX_FADV_WILLNEED);
+        }
+        for (i=0; i<n; i++) {
+            off = ext[i].off;
+            end = ext[i].off+ext[i].len;
+            while (off < end && (nr = pread(fd, buf, 
+                            (end-off < (long long) len) ? end-off : len, 
+                            off)) > 0) {
+                off += nr;
+                bytes += nr;
+            }
+        }
+        close(fd);
+    }
+    if (ext) free(ext);
+
+    return(bytes);
+}
+
+/*
+ * Extract the box of band k around a station, from the image or from
+ * the boxes read from a patch cube. Boxes extracted from the image are
+ * collected for the patch cube when one is written. Bands are extracted
+ * in their own type (e.g. the cloud mask as unsigned short), only the
+ * box is converted to float.
+ */
+static int fluxval_box(fvsession *s, fvproduct *p, int station, int k,
+        s_data *sd) {
+
+    void *data;
+
+    if (p->patch) return(fvpatch_box(p->patch, station, k, sd));
+    if (k == 6 && !p->hascm) return(FM_IO_ERR);
+    data = fluxval_band(p, k);
+    if (!data || return_product_area_typed(p->pos->xyp[station], p->ipd.h,
+                data, p->ipd.d[k].datatype, sd) != FM_OK) {
+        return(FM_IO_ERR);
+    }
+    if (p->store) {
+        return(fvpatch_put(p->store, station, s->stl.id[station].number,
+                    k, sd));
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Extract the OSISAF flux data surrounding a station on a
+ * representative subarea along with observation geometry and cloud mask
+ * for passage products. The satellite part of the matchup is filled in.
+ */
+int fluxval_extract(fvsession *s, fvproduct *p, int station, fvmatchup *m) {
+
+    char *where="fluxval_extract";
+    int i, l, novalobs, geomobs, cmobs;
+    float meanflux, meancm, sumw, v, *w;
+    s_data *sd = &(s->sdata);
+    osihdf *ipd = &(p->ipd);
+
+    memset(m, 0, sizeof(fvmatchup));
+    m->year = ipd->h.year;
+    m->month = ipd->h.month;
+    m->day = ipd->h.day;
+    m->hour = ipd->h.hour;
+    m->minute = ipd->h.minute;
+    snprintf(m->source,sizeof(m->source),"%s",ipd->h.source);
+    snprintf(s->area,FMSTRING16,"%.15s",ipd->h.area);
+    m->station = station;
+    m->stid = s->stl.id[station].number;
+
+    fvlog(FV_LOG_DEBUG, where,
+            "Collecting OSISAF flux estimates around station %s",
+            s->stl.id[station].name);
+    /*
+     * Stations outside the area of the product are skipped quietly,
+     * they are validated against the products of other areas.
+     */
+    if (!p->pos->inside[station]) {
+        runstats_count(&(s->rs), RC_STATIONSMISSED, 1);
+        return(FM_IO_ERR);
+    }
+
+    if (!p->patch && !fluxval_band(p, 0)) return(FM_IO_ERR);
+    runstats_start(&(s->rs), RS_EXTRACT);
+    if (fluxval_box(s, p, station, 0, sd) != FM_OK) {
+        runstats_stop(&(s->rs), RS_EXTRACT);
+        runstats_count(&(s->rs), RC_STATIONSMISSED, 1);
+        fvlog_err(where,
+                "Did not find valid flux data for station %s for flux file %s",
+                s->stl.id[station].name, p->filename);
+        return(FM_IO_ERR);
+    }
+    runstats_count(&(s->rs), RC_STATIONSHIT, 1);
+
+    /*
+     * Average flux estimates first. Generate mean value from all
+     * satellite data and store this in collocated file for easier
+     * analysis. This could be changed in the future...
+     */
+    if (sd->iw == 1 && sd->ih == 1) {
+        meanflux = *(sd->data);
+        novalobs = 1;
+    } else if (p->kw) {
+        /*
+         * Weighted mean over the valid pixels using the kernel weights
+         * of the station, a dot product kept free of branches so that
+         * the compiler can vectorise it. Estimates are not valid if no
+         * valid pixel has weight.
+         */
+        w = p->kw+station*sd->iw*sd->ih;
+        meanflux = 0.;
+        sumw = 0.;
+        novalobs = 0;
+        for (l=0; l<(sd->iw*sd->ih); l++) {
+            v = (float) (sd->data[l] >= 0);
+            sumw += w[l]*v;
+            meanflux += w[l]*v*sd->data[l];
+            novalobs += (int) v;
+        }
+        if (sumw > 0.) {
+            meanflux /= sumw;
+        } else {
+            novalobs = 0;
+        }
+    } else {
+        meanflux = 0.;
+        novalobs = 0;
+        for (l=0; l<(sd->iw*sd->ih); l++) {
+            if (sd->data[l] >= 0) {
+                meanflux += sd->data[l];
+                novalobs++;
+            }
+        }
+        meanflux /= (float) novalobs;
+    }
+    m->flux = meanflux;
+    m->nvalid = novalobs;
+    m->nbox = sd->iw*sd->ih;
+
+    /*
+     * Observation geometry for passage SSI products. Average obs geom
+     * estimates use val obs found for fluxes.
+     */
+    if (s->mode == FV_MODE_PASSAGE && (strstr(s->product,"ssi")!=NULL)) {
+        for (i=0;i<3;i++) {
+            if (fluxval_box(s, p, station, i+3, sd) != FM_OK) {
+                fvlog_err(where,
+                        "Did not find valid geom data for station %s %s",
+                        s->stl.id[station].name,
+                        "although flux data were found...");
+                continue;
+            }
+            geomobs = 0;
+            if (sd->iw == 1 && sd->ih == 1) {
+                m->geom[i] = *(sd->data);
+            } else {
+                for (l=0; l<(sd->iw*sd->ih); l++) {
+                    if (sd->data[l] >= 0) {
+                        m->geom[i] += sd->data[l];
+                        geomobs++;
+                    }
+                }
+                m->geom[i] /= (float) geomobs;
+            }
+        }
+    }
+
+    runstats_stop(&(s->rs), RS_EXTRACT);
+
+    /*
+     * Process the cloud mask information. Average CM used val obs found
+     * for fluxes. Extraction and conversion of the cloud mask box are
+     * timed on their own.
+     */
+    if (s->mode == FV_MODE_PASSAGE && p->hascm) {
+        runstats_start(&(s->rs), RS_CMCONV);
+        if (fluxval_box(s, p, station, 6, sd) != FM_OK) {
+            runstats_stop(&(s->rs), RS_CMCONV);
+            fvlog_err(where,
+                    "Did not find valid CM data for station %s %s",
+                    s->stl.id[station].name,
+                    "although flux data were found...");
+            return(FM_IO_ERR);
+        }
+        meancm = 0.;
+        cmobs = 0;
+        if (sd->iw == 1 && sd->ih == 1) {
+            if (*(sd->data) >= 0.99 && *(sd->data) <= 4.01) {
+                meancm = 1;
+            } else if (*(sd->data) >= 4.99 && *(sd->data) <= 19.01) {
+                meancm = 2;
+            }
+        } else {
+            for (l=0; l<(sd->iw*sd->ih); l++) {
+                if (sd->data[l] >= 0.99 && sd->data[l] <= 4.01) {
+                    meancm += 1;
+                    cmobs++;
+                } else if (sd->data[l] >= 4.99 && sd->data[l] <= 19.01) {
+                    meancm += 2;
+                    cmobs++;
+                }
+            }
+            meancm /= (float) cmobs;
+        }
+        m->cm = meancm;
+        runstats_stop(&(s->rs), RS_CMCONV);
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Days since 1970-01-01 for a date in the Gregorian calendar.
+ */
+static long fluxval_days(int year, int month, int day) {
+    long era, yoe, doy, doe;
+
+    year -= (month <= 2);
+    era = (year >= 0 ? year : year-399)/400;
+    yoe = year-era*400;
+    doy = (153*(month+(month > 2 ? -3 : 9))+2)/5+day-1;
+    doe = yoe*365+yoe/4-yoe/100+doy;
+
+    return(era*146097+doe-719468);
+}
+
+/*
+ * Aggregate the observations of the month loaded into daily prefix
+ * sums, Q0 (for SSI) and LW (for DLI) at once. Each record is assigned to
+ * the hour it ends (a record at 01:00 covers 00:00-01:00, the record at
+ * 00:00 belongs to the previous day), records within the same hour are
+ * averaged first. Records are not assumed to be consecutive or hourly.
+ */
+static int fluxval_daily_prepare(fvsession *s, int year, int month) {
+
+    char *where="fluxval_daily_prepare";
+    int h, k, i, j, n, yy, mm, dd, hh, mi;
+    long t, t0, slot;
+    double hsum[FV_NPAR][FV_MONTHHOURS];
+    short hcnt[FV_NPAR][FV_MONTHHOURS];
+    float value[FV_NPAR];
+    fvdaily *dl;
+    parlist *par;
+
+    s->obs->daily = (fvdaily *) fvarena_alloc(&(s->obs->arena), 
+            s->stl.cnt*sizeof(fvdaily));
+    if (!s->obs->daily) {
+        fmerrmsg(where,"Could not allocate daily aggregates");
+        return(FM_MEMALL_ERR);
+    }
+    t0 = fluxval_days(year, month, 1)*1440;
+
+    for (k=0; k<s->stl.cnt; k++) {
+        dl = &(s->obs->daily[k]);
+        memset(dl, 0, sizeof(fvdaily));
+        memset(hsum, 0, sizeof(hsum));
+        memset(hcnt, 0, sizeof(hcnt));
+        if (s->obs->std[k].missing) continue;
+        for (h=0; h<NO_MONTHOBS; h++) {
+            par = &(s->obs->std[k].param[h]);
+            mi = 0;
+            n = sscanf(par->date,"%4d%2d%2d%2d%2d",&yy,&mm,&dd,&hh,&mi);
+            if (n < 4) continue;
+            if (yy == year && mm == month && dd >= 1 && dd <= 31) {
+                dl->nrec[dd]++;
+            }
+            t = fluxval_days(yy, mm, dd)*1440+hh*60+mi-t0;
+            if (t <= 0) continue;
+            slot = (t-1)/60;
+            if (slot >= FV_MONTHHOURS) continue;
+            value[0] = par->Q0;
+            value[1] = par->LW;
+            for (j=0; j<FV_NPAR; j++) {
+                if (value[j] > FV_MISVAL) {
+                    hsum[j][slot] += value[j];
+                    hcnt[j][slot]++;
+                }
+            }
+        }
+        for (j=0; j<FV_NPAR; j++) {
+            for (i=0; i<FV_MONTHHOURS; i++) {
+                dl->psum[j][i+1] = dl->psum[j][i];
+                dl->pcnt[j][i+1] = dl->pcnt[j][i];
+                if (hcnt[j][i] > 0) {
+                    dl->psum[j][i+1] += hsum[j][i]/hcnt[j][i];
+                    dl->pcnt[j][i+1]++;
+                }
+            }
+        }
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Observation times are indexed as seconds since 1970 and sorted,
+ * keeping the order of the file for equal times. Records without a
+ * valid time are left out.
+ */
+typedef struct {
+    long t;
+    int rec;
+} fvobstime;
+
+static int fluxval_cmpobstime(const void *a, const void *b) {
+    const fvobstime *oa = a, *ob = b;
+
+    if (oa->t < ob->t) return(-1);
+    if (oa->t > ob->t) return(1);
+    return(oa->rec-ob->rec);
+}
+
+static int fluxval_obs_index(fvsession *s) {
+
+    char *where="fluxval_obs_index";
+    int h, k, n, sorted, yy, mm, dd, hh, mi, ss;
+    fvobstime ot[NO_MONTHOBS];
+    fvobsindex *ix;
+
+    s->obs->oidx = (fvobsindex *) fvarena_alloc(&(s->obs->arena), 
+            s->stl.cnt*sizeof(fvobsindex));
+    if (!s->obs->oidx) {
+        fmerrmsg(where,"Could not allocate observation index");
+        return(FM_MEMALL_ERR);
+    }
+    for (k=0; k<s->stl.cnt; k++) {
+        ix = &(s->obs->oidx[k]);
+        ix->n = 0;
+        ix->t = (long *) fvarena_alloc(&(s->obs->arena), 
+                NO_MONTHOBS*sizeof(long));
+        ix->rec = (short *) fvarena_alloc(&(s->obs->arena), 
+                NO_MONTHOBS*sizeof(short));
+        if (!ix->t || !ix->rec) {
+            fmerrmsg(where,"Could not allocate observation index");
+            return(FM_MEMALL_ERR);
+        }
+        if (s->obs->std[k].missing) continue;
+        sorted = 1;
+        for (h=0; h<NO_MONTHOBS; h++) {
+            mi = ss = 0;
+            n = sscanf(s->obs->std[k].param[h].date,"%4d%2d%2d%2d%2d%2d",
+                    &yy,&mm,&dd,&hh,&mi,&ss);
+            if (n < 4) continue;
+            ot[ix->n].t = fluxval_days(yy, mm, dd)*86400+hh*3600+mi*60+ss;
+            ot[ix->n].rec = h;
+            if (ix->n > 0 && ot[ix->n].t < ot[ix->n-1].t) sorted = 0;
+            ix->n++;
+        }
+        if (!sorted) {
+            qsort(ot, ix->n, sizeof(fvobstime), fluxval_cmpobstime);
+        }
+        for (h=0; h<ix->n; h++) {
+            ix->t[h] = ot[h].t;
+            ix->rec[h] = (short) ot[h].rec;
+        }
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Position of the first observation at or after time t.
+ */
+static int fluxval_lower_bound(fvobsindex *ix, long t) {
+    int lo = 0, hi = ix->n, mid;
+
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (ix->t[mid] < t) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return(lo);
+}
+
+static int fluxval_obs_prepare(fvsession *s) {
+
+    char *where="fluxval_obs_prepare";
+
+    if (s->mode == FV_MODE_DAILY) {
+        if (s->obs->daily) return(FM_OK);
+        if (fluxval_daily_prepare(s, s->obs->year, s->obs->month) != FM_OK) {
+            fmerrmsg(where,"Could not aggregate daily observations");
+            return(FM_MEMALL_ERR);
+        }
+    } else {
+        if (s->obs->oidx) return(FM_OK);
+        if (fluxval_obs_index(s) != FM_OK) {
+            fmerrmsg(where,"Could not index observation times");
+            return(FM_MEMALL_ERR);
+        }
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Get observations (if not already read) for the month specified. The
+ * daily aggregates or time index needed by the session are built on
+ * first use, sessions sharing the observations may need either.
+ */
+int fluxval_load_obs(fvsession *s, int year, int month) {
+
+    char *where="fluxval_load_obs";
+    int status;
+
+    if (s->obs->month == month && s->obs->year == year) {
+        return(fluxval_obs_prepare(s));
+    }
+
+    if (s->obs->month > 0) {
+        clear_stdata(&(s->obs->std), s->stl.cnt, &(s->obs->arena));
+        s->obs->month = 0;
+    }
+    s->obs->daily = NULL;
+    s->obs->oidx = NULL;
+    fvlog(FV_LOG_INFO, where,
+            "Reading surface observations of radiative fluxes for %4d-%02d",
+            year, month);
+    runstats_start(&(s->rs), RS_READOBS);
+    status = fluxval_readobs_format(s->obs->path, year, month,
+            s->stl, &(s->obs->fmt), &(s->obs->std), &(s->obs->arena));
+    runstats_stop(&(s->rs), RS_READOBS);
+    if (status != 0) {
+        fmerrmsg(where,
+                "Could not read autostation data\n");
+        return(FM_IO_ERR);
+    }
+    runstats_count(&(s->rs), RC_OBSFILES, 1);
+    s->obs->year = year;
+    s->obs->month = month;
+
+    return(fluxval_obs_prepare(s));
+}
+
+/*
+ * Fill the observation part of a matchup from an observation record.
+ */
+static void fluxval_fill_obs(fvsession *s, fvmatchup *m, int stid, 
+        parlist *par) {
+
+    m->hasobs = 1;
+    m->stid = stid;
+    snprintf(m->obsdate,sizeof(m->obsdate),"%s",par->date);
+    if (strstr(s->product,"ssi")) {
+        m->cmpobs = par->Q0;
+    } else {
+        m->cmpobs = (s->obs->fmt.haslw) ? par->LW : FV_MISVAL;
+    }
+    if (s->obs->fmt.single) {
+        m->obs[0] = (strstr(s->product,"ssi")) ? par->Q0 : par->LW;
+    } else {
+        m->obs[0] = par->TTM;
+        m->obs[1] = par->Q0;
+        m->obs[2] = par->ST;
+    }
+}
+
+/*
+ * Linear interpolation in time between two records, w is the weight of
+ * the second. Missing values are not interpolated. The time of the
+ * nearest record is used.
+ */
+static float fluxval_interp(float v1, float v2, double w) {
+
+    if (v1 <= FV_MISVAL || v2 <= FV_MISVAL) return(FV_MISVAL);
+
+    return((float) (v1+(v2-v1)*w));
+}
+
+static void fluxval_interp_obs(parlist *p1, parlist *p2, double w, 
+        parlist *par) {
+
+    *par = (w < 0.5) ? *p1 : *p2;
+    par->TTM = fluxval_interp(p1->TTM, p2->TTM, w);
+    par->Q0 = fluxval_interp(p1->Q0, p2->Q0, w);
+    par->ST = fluxval_interp(p1->ST, p2->ST, w);
+    par->LW = fluxval_interp(p1->LW, p2->LW, w);
+}
+
+/*
+ * Search the observations loaded for the station of the matchup for a
+ * record collocated with the product time, starting at position start
+ * in the time sorted observations. The observation part of the matchup
+ * is filled in. Returns the position of the record used (the day of
+ * month for daily validation), further collocated records are found by
+ * calling again with start set to this plus one. -1 is returned if no
+ * collocated observation was found.
+ */
+int fluxval_collocate(fvsession *s, int start, fvmatchup *m) {
+
+    char *where="fluxval_collocate";
+    int k, n, p, a, b, j;
+    long t, off, win;
+    double w;
+    stdata *st;
+    fvdaily *dl;
+    fvobsindex *ix;
+    fvcolloc *col;
+    parlist par;
+
+    k = m->station;
+    st = &(s->obs->std[k]);
+    m->hasobs = 0;
+
+    if (st->missing) {
+        fvlog_err(where,
+                "Observations are not available for station %d",k);
+        return(-1);
+    }
+    if (s->stl.id[k].number != st->id) return(-1);
+
+    /*
+     * Daily means are looked up in the aggregates prepared when the
+     * observations were loaded. A day is only reported if records for
+     * it exist, the mean is missing if less than minhours hours had
+     * valid observations.
+     */
+    if (s->mode == FV_MODE_DAILY) {
+        if (start > 0 || !s->obs->daily) return(-1);
+        if (m->year != s->obs->year || m->month != s->obs->month ||
+                m->day < 1 || m->day > 31) return(-1);
+        dl = &(s->obs->daily[k]);
+        if (dl->nrec[m->day] == 0) return(-1);
+        a = (m->day-1)*24;
+        b = m->day*24;
+        m->hasobs = 1;
+        m->stid = st->id;
+        j = (strstr(s->product,"ssi")) ? 0 : 1;
+        m->nhours = dl->pcnt[j][b]-dl->pcnt[j][a];
+        if (m->nhours > 0 && m->nhours >= s->minhours) {
+            m->dailyobs = (dl->psum[j][b]-dl->psum[j][a])/m->nhours;
+        } else {
+            m->dailyobs = FV_MISVAL;
+        }
+        return(m->day);
+    }
+
+    /*
+     * Passages. The observations whose period contains the product time
+     * (shifted by lag) are found by binary search, if there are several
+     * (duplicates) they are returned by subsequent calls.
+     */
+    if (!s->obs->oidx) return(-1);
+    ix = &(s->obs->oidx[k]);
+    if (ix->n == 0) return(-1);
+    col = &(s->col);
+    if (col->align == FV_ALIGN_PRECEDING) {
+        a = col->period;
+    } else if (col->align == FV_ALIGN_CENTRED) {
+        a = col->period/2;
+    } else {
+        a = 0;
+    }
+    t = fluxval_days(m->year, m->month, m->day)*86400+
+        m->hour*3600+m->minute*60-col->lag;
+
+    runstats_start(&(s->rs), RS_COLLOC);
+    if (col->interp) {
+        /*
+         * Interpolate between the observations with centre of period
+         * before and after the product time.
+         */
+        p = -1;
+        if (start == 0) {
+            off = col->period/2-a;
+            win = (col->window > 0) ? col->window : col->period;
+            n = fluxval_lower_bound(ix, t-off+1);
+            if (n > 0 && n < ix->n && 
+                    t-(ix->t[n-1]+off) <= win && (ix->t[n]+off)-t <= win) {
+                p = n-1;
+                w = (double) (t-(ix->t[p]+off))/(double) (ix->t[n]-ix->t[p]);
+                fluxval_interp_obs(&(st->param[ix->rec[p]]),
+                        &(st->param[ix->rec[n]]), w, &par);
+                fluxval_fill_obs(s, m, st->id, &par);
+            }
+        }
+        runstats_stop(&(s->rs), RS_COLLOC);
+        return(p);
+    }
+
+    p = fluxval_lower_bound(ix, t+a-col->period);
+    if (p < start) p = start;
+    if (p < ix->n && ix->t[p] < t+a) {
+        fluxval_fill_obs(s, m, st->id, &(st->param[ix->rec[p]]));
+        runstats_stop(&(s->rs), RS_COLLOC);
+        return(p);
+    }
+
+    /*
+     * Nearest observation outside the period if a window is given.
+     */
+    if (start == 0 && col->window > 0) {
+        n = -1;
+        win = col->window+1;
+        if (p > 0 && (t+a-col->period)-ix->t[p-1] < win) {
+            n = p-1;
+            win = (t+a-col->period)-ix->t[p-1];
+        }
+        if (p < ix->n && ix->t[p]-(t+a) < win) {
+            n = p;
+        }
+        if (n >= 0) {
+            fluxval_fill_obs(s, m, st->id, &(st->param[ix->rec[n]]));
+            runstats_stop(&(s->rs), RS_COLLOC);
+            return(n);
+        }
+    }
+    runstats_stop(&(s->rs), RS_COLLOC);
+
+    return(-1);
+}
+
+/*
+ * The observation a matchup is compared with, Q0 for SSI and LW for DLI
+ * (missing if the format has no LW column) or the daily mean. Returns 1
+ * if both the satellite estimate and the observation are valid.
+ */
+int fluxval_compared_obs(fvsession *s, fvmatchup *m, float *obs) {
+
+    if (s->mode == FV_MODE_DAILY) {
+        *obs = m->dailyobs;
+    } else {
+        *obs = m->cmpobs;
+    }
+
+    return(!s->satonly && m->nvalid > 0 && *obs > FV_MISVAL);
+}
+
+/*
+ * Dump a matchup in the format used by fluxval. First representative
+ * acquisition time for satellite based estimates is printed, then
+ * satellite based estimates and auxiliary data. The satellite data are
+ * averaged over 13x13 pixels to compensate for positioning error of
+ * satellites and the different view perspective from ground and space.
+ * Then all information concerning observations is dumped. If
+ * asynchoneous logging is done, placeholders for future in situ
+ * observations to be included are dumped along with the station number,
+ * the observations are included later by fluxval_join.
+ */
+int fluxval_write_matchup(fvsession *s, FILE *fp, fvmatchup *m) {
+
+    char *where="fluxval_write_matchup";
+    char line[FMSTRING512];
+    int n, status, hasobs;
+    float obs;
+
+    runstats_start(&(s->rs), RS_OUTPUT);
+    n = snprintf(line,FMSTRING512," %4d%02d%02d%02d%02d",
+            m->year,m->month,m->day,m->hour,m->minute);
+    if (s->mode == FV_MODE_DAILY && !s->satonly) {
+        n += snprintf(line+n,FMSTRING512-n, " %7.2f %3d", m->flux, m->nbox);
+    } else {
+        n += snprintf(line+n,FMSTRING512-n,
+                " %7.2f %3d %3d %s %.2f %.2f %.2f %.2f",
+                m->flux, m->nvalid, m->nbox, m->source,
+                m->geom[0], m->geom[1], m->geom[2], m->cm);
+    }
+    if (s->satonly) {
+        snprintf(line+n,FMSTRING512-n," %12s %05d %7.2f %7.2f %7.2f",
+                "000000000000", m->stid,
+                FV_MISVAL,FV_MISVAL,FV_MISVAL);
+    } else if (s->mode == FV_MODE_DAILY) {
+        snprintf(line+n,FMSTRING512-n," %05d %7.2f", m->stid, m->dailyobs);
+    } else if (s->obs->fmt.single) {
+        snprintf(line+n,FMSTRING512-n," %12s %05d %7.2f", 
+                m->obsdate, m->stid, m->obs[0]);
+    } else {
+        snprintf(line+n,FMSTRING512-n," %12s %05d %7.2f %7.2f %7.2f",
+                m->obsdate, m->stid, m->obs[0], m->obs[1], m->obs[2]);
+    }
+
+    hasobs = fluxval_compared_obs(s, m, &obs);
+
+    /*
+     * Insert newline to mark record.
+     */
+    status = fprintf(fp,"%s\n",line);
+    if (status >= 0 && s->db && !s->satonly &&
+            fvdb_put(s->db, s->product, s->area, m,
+                (s->mode == FV_MODE_DAILY) ? "" : m->obsdate,
+                hasobs, obs, line) != FM_OK) status = -1;
+    runstats_stop(&(s->rs), RS_OUTPUT);
+    if (status < 0) {
+        fmerrmsg(where,"Could not write matchup");
+        return(FM_IO_ERR);
+    }
+    runstats_count(&(s->rs), RC_MATCHUPS, 1);
+
+    /*
+     * Update comparison against observations.
+     */
+    s->st.nmatchups++;
+    if (hasobs) {
+        s->st.n++;
+        s->st.sumdiff += (m->flux-obs);
+        s->st.sumsqdiff += (m->flux-obs)*(m->flux-obs);
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Check whether any station inside the area of a product has an
+ * observation collocated with it, before the bands are read.
+ */
+int fluxval_obs_available(fvsession *s, fvproduct *p) {
+
+    int k;
+    fvmatchup m;
+
+    for (k=0; k<s->stl.cnt; k++) {
+        if (!p->pos->inside[k] || s->obs->std[k].missing) continue;
+        memset(&m, 0, sizeof(fvmatchup));
+        m.year = p->ipd.h.year;
+        m.month = p->ipd.h.month;
+        m.day = p->ipd.h.day;
+        m.hour = p->ipd.h.hour;
+        m.minute = p->ipd.h.minute;
+        m.station = k;
+        if (fluxval_collocate(s, 0, &m) >= 0) return(1);
+    }
+
+    return(0);
+}
+
+/*
+ * Store collocated flux estimates and measurements in the output file.
+ * All available stations are looped for the satellite derived flux
+ * file. Products without any collocated observation are skipped before
+ * their bands are read, unless only satellite data are extracted or the
+ * boxes are stored in a patch cube, noobs of the session tells if the
+ * product was skipped (e.g. for watch mode to try it again when the
+ * observations arrive). The product is freed.
+ */
+static int fluxval_process(fvsession *s, fvproduct *p) {
+
+    char *where="fluxval_process";
+    int k, h;
+    fvmatchup m;
+
+    s->noobs = 0;
+    if (!s->satonly) {
+        if (fluxval_load_obs(s, p->ipd.h.year, p->ipd.h.month) != FM_OK) {
+            fluxval_product_free(p);
+            return(FM_IO_ERR);
+        }
+        if (!p->store && !fluxval_obs_available(s, p)) {
+            fvlog(FV_LOG_INFO, where,"No observations collocated with %s", 
+                    p->filename);
+            runstats_count(&(s->rs), RC_FILESNOOBS, 1);
+            s->noobs = 1;
+            fluxval_product_free(p);
+            return(FM_OK);
+        }
+    }
+
+    for (k=0; k<s->stl.cnt; k++) {
+        if (fluxval_extract(s, p, k, &m) != FM_OK) continue;
+
+        /*
+         * If only satellite data are to be extracted around the stations
+         * listed, dump these...
+         */
+        if (s->satonly) {
+            if (fluxval_write_matchup(s, s->fp, &m) != FM_OK) {
+                fluxval_product_free(p);
+                return(FM_IO_ERR);
+            }
+            continue;
+        }
+
+        /*
+         * Otherwise dump all collocated observations, for daily
+         * products only the first is used.
+         */
+        h = -1;
+        while ((h = fluxval_collocate(s, h+1, &m)) >= 0) {
+            if (fluxval_write_matchup(s, s->fp, &m) != FM_OK) {
+                fluxval_product_free(p);
+                return(FM_IO_ERR);
+            }
+            if (s->mode == FV_MODE_DAILY) break;
+        }
+    }
+
+    if (p->store) {
+        if (fvcube_put(s->cube, p->store) != FM_OK) {
+            fluxval_product_free(p);
+            return(FM_IO_ERR);
+        }
+        runstats_count(&(s->rs), RC_CUBEBYTES, p->store->len);
+    }
+    fluxval_product_free(p);
+    if (s->db && fvdb_commit(s->db) != FM_OK) return(FM_IO_ERR);
+
+    return(FM_OK);
+}
+
+/*
+ * Prepare the collection of the boxes of a product for the patch cube.
+ */
+static fvpatch *fluxval_patch_new(fvsession *s, fvproduct *p) {
+
+    fvpatch *pt;
+    char *name;
+
+    pt = fvpatch_new(s->stl.cnt, s->sdata.iw, s->sdata.ih);
+    if (!pt) return(NULL);
+    name = strrchr(p->filename,'/');
+    snprintf(pt->name,FMSTRING64,"%.63s",name ? name+1 : p->filename);
+    snprintf(pt->product,FMSTRING16,"%s",s->product);
+    snprintf(pt->source,32,"%s",p->ipd.h.source);
+    snprintf(pt->area,FMSTRING16,"%.15s",p->ipd.h.area);
+    pt->mode = s->mode;
+    pt->year = p->ipd.h.year;
+    pt->month = p->ipd.h.month;
+    pt->day = p->ipd.h.day;
+    pt->hour = p->ipd.h.hour;
+    pt->minute = p->ipd.h.minute;
+    pt->hascm = p->hascm;
+
+    return(pt);
+}
+
+/*
+ * Validate a product of the archive.
+ */
+int fluxval_process_product(fvsession *s, char *filename) {
+
+    char *where="fluxval_process_product";
+    fvproduct *p;
+
+    int status;
+
+    fvlog(FV_LOG_INFO, where,"Processing %s", filename);
+    p = fluxval_product_read(s, filename);
+    if (!p) return(FM_IO_ERR);
+    if (s->cube) {
+        p->store = fluxval_patch_new(s, p);
+        if (!p->store) {
+            fluxval_product_free(p);
+            return(FM_MEMALL_ERR);
+        }
+    }
+    status = fluxval_process(s, p);
+    fvlog_flush();
+
+    return(status);
+}
+
+/*
+ * Product holding the boxes of a patch cube record, the stations of the
+ * session are matched to those stored by number.
+ */
+static fvproduct *fluxval_patch_product(fvsession *s, fvpatch *pt) {
+
+    char *where="fluxval_patch_product";
+    fvproduct *p;
+
+    p = (fvproduct *) malloc(sizeof(fvproduct));
+    if (!p) {
+        fmerrmsg(where,"Could not allocate product");
+        return(NULL);
+    }
+    memset(p, 0, sizeof(fvproduct));
+    p->fid = -1;
+    if (fvpatch_map(pt, &(s->stl)) != FM_OK) {
+        free(p);
+        return(NULL);
+    }
+    p->patch = pt;
+    p->pos = &(pt->pos);
+    p->hascm = pt->hascm;
+    p->rs = &(s->rs);
+    snprintf(p->filename,FILENAMELEN,"%s",pt->name);
+    snprintf(p->ipd.h.source,sizeof(p->ipd.h.source),"%s",pt->source);
+    snprintf(p->ipd.h.area,sizeof(p->ipd.h.area),"%s",pt->area);
+    p->ipd.h.year = pt->year;
+    p->ipd.h.month = pt->month;
+    p->ipd.h.day = pt->day;
+    p->ipd.h.hour = pt->hour;
+    p->ipd.h.minute = pt->minute;
+
+    return(p);
+}
+
+/*
+ * Recompute the matchups of the products of the session stored in a
+ * patch cube, for products of times from start to end (yyyymmddhhmm).
+ * fntest selects the product files as for the archive (NULL for all).
+ * The products are processed in order of time. Weighted kernels are not
+ * supported as the positions of the stations within the pixels are not
+ * stored.
+ */
+int fluxval_process_cube(fvsession *s, fvcube *c, long long start,
+        long long end, char *fntest) {
+
+    char *where="fluxval_process_cube";
+    int i, status;
+    fvcubeindex *ix;
+    fvpatch *pt;
+    fvproduct *p;
+
+    if (s->kern.type != FV_KERNEL_BOX && s->sdata.iw*s->sdata.ih > 1) {
+        fmerrmsg(where,"Boxes of a patch cube can only be averaged");
+        return(FM_IO_ERR);
+    }
+    for (i=0; i<c->n; i++) {
+        ix = &(c->idx[i]);
+        if (ix->time < start || ix->time > end) continue;
+        if (strcmp(ix->product,s->product) || ix->mode != s->mode) continue;
+        if (fntest && !fluxval_fntest(ix->name, fntest)) continue;
+        fvlog(FV_LOG_INFO, where,"Processing %s from %s", 
+                ix->name, c->filename);
+        runstats_start(&(s->rs), RS_READPROD);
+        pt = fvcube_get(c, i);
+        runstats_stop(&(s->rs), RS_READPROD);
+        if (!pt) return(FM_IO_ERR);
+        runstats_count(&(s->rs), RC_FILESREAD, 1);
+        runstats_count(&(s->rs), RC_CUBEBYTES, pt->len);
+        p = fluxval_patch_product(s, pt);
+        if (!p) {
+            fvpatch_free(pt);
+            return(FM_MEMALL_ERR);
+        }
+        status = fluxval_process(s, p);
+        fvlog_flush();
+        if (status != FM_OK) return(status);
+    }
+
+    return(FM_OK);
+}
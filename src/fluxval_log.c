@@ -0,0 +1,213 @@
+/*
+ * NAME:
+ * fluxval_log.c
+ *
+ * PURPOSE:
+ * To log the progress of the processing loops (products, stations,
+ * observation files) at a level chosen at run time, without letting
+ * terminal and log output slow down the validation.
+ *
+ * NOTES:
+ * Messages are formatted as by fmlogmsg and fmerrmsg. Messages above the
+ * level set are dropped before they are formatted. Messages written are
+ * collected in a buffer per thread and written to stdout when it is
+ * full or flushed (after each product and when the thread ends), so
+ * threads do not contend for stdout and the messages of a product are
+ * kept together. Errors are written to stderr at once.
+ *
+ * An error repeated by a call site (e.g. for every station without
+ * observations of a product) is only written FV_LOG_REPEAT times by a
+ * thread until the messages are flushed, then the number of errors
+ * suppressed is written and they are counted anew. Errors are thus
+ * written for every product and every event watched, not only for the
+ * first ones.
+ *
+ * Startup and summary messages of the programs still use fmlogmsg and
+ * fmerrmsg.
+ *
+ * BUGS:
+ * Messages of the main thread not yet flushed when exit is called are
+ * written at exit, those of a process killed are lost.
+ *
+ * RETURN VALUES:
+ * NA
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <fluxval_log.h>
+
+#define FV_LOGBUF 16384
+#define FV_LOGSITES 32
+
+typedef struct {
+    const char *where;
+    const char *what;
+    long n;
+} fvlogsite;
+
+typedef struct {
+    char buf[FV_LOGBUF];
+    int len;
+    int nsite;
+    fvlogsite site[FV_LOGSITES];
+} fvlogbuf;
+
+static int fvlog_lvl = FV_LOG_ERROR;
+static pthread_key_t fvlog_key;
+static pthread_once_t fvlog_once = PTHREAD_ONCE_INIT;
+
+static void fvlog_write(fvlogbuf *b) {
+
+    if (b->len > 0) fwrite(b->buf, 1, b->len, stdout);
+    b->len = 0;
+}
+
+/*
+ * Write the messages left and the number of errors suppressed, and
+ * reset the counts of errors.
+ */
+static void fvlog_drain(fvlogbuf *b) {
+
+    int i;
+
+    fvlog_write(b);
+    for (i=0; i<b->nsite; i++) {
+        if (b->site[i].n <= FV_LOG_REPEAT) continue;
+        fprintf(stderr," ERROR[%s]: %ld more errors like this suppressed\n",
+                b->site[i].where, b->site[i].n-FV_LOG_REPEAT);
+    }
+    b->nsite = 0;
+}
+
+static void fvlog_release(void *p) {
+
+    fvlog_drain((fvlogbuf *) p);
+    free(p);
+}
+
+static void fvlog_atexit(void) {
+
+    fvlogbuf *b;
+
+    b = (fvlogbuf *) pthread_getspecific(fvlog_key);
+    if (b) fvlog_drain(b);
+    fflush(stdout);
+}
+
+static void fvlog_init(void) {
+
+    pthread_key_create(&fvlog_key, fvlog_release);
+    atexit(fvlog_atexit);
+}
+
+static fvlogbuf *fvlog_buf(void) {
+
+    fvlogbuf *b;
+
+    pthread_once(&fvlog_once, fvlog_init);
+    b = (fvlogbuf *) pthread_getspecific(fvlog_key);
+    if (!b) {
+        b = (fvlogbuf *) calloc(1, sizeof(fvlogbuf));
+        if (b) pthread_setspecific(fvlog_key, b);
+    }
+
+    return(b);
+}
+
+/*
+ * Count an error of a call site, returns 0 if it is to be suppressed.
+ */
+static int fvlog_count(fvlogbuf *b, char *where, char *what) {
+
+    int i;
+
+    for (i=0; i<b->nsite; i++) {
+        if (b->site[i].what == what && b->site[i].where == where) break;
+    }
+    if (i == b->nsite) {
+        if (b->nsite == FV_LOGSITES) return(1);
+        b->site[i].where = where;
+        b->site[i].what = what;
+        b->site[i].n = 0;
+        b->nsite++;
+    }
+
+    return(++(b->site[i].n) <= FV_LOG_REPEAT);
+}
+
+void fvlog_set_level(int level) {
+
+    fvlog_lvl = (level < FV_LOG_ERROR) ? FV_LOG_ERROR : level;
+}
+
+int fvlog_level(void) {
+
+    return(fvlog_lvl);
+}
+
+void fvlog(int level, char *where, char *what, ...) {
+
+    va_list ap;
+    fvlogbuf *b;
+    int n;
+
+    if (level > fvlog_lvl) return;
+    b = fvlog_buf();
+    if (!b) return;
+
+    /*
+     * The message is formatted into the buffer, if it does not fit the
+     * buffer is written first and it is formatted again.
+     */
+    for (;;) {
+        n = snprintf(b->buf+b->len, FV_LOGBUF-b->len, " LOG[%s]: ", where);
+        if (n >= 0 && n < FV_LOGBUF-b->len) {
+            va_start(ap, what);
+            n += vsnprintf(b->buf+b->len+n, FV_LOGBUF-b->len-n, what, ap);
+            va_end(ap);
+        }
+        if (n >= 0 && n+1 < FV_LOGBUF-b->len) {
+            b->len += n;
+            b->buf[b->len++] = '\n';
+            break;
+        }
+        if (b->len == 0) {
+            /* Longer than the buffer, written truncated */
+            b->len = FV_LOGBUF-1;
+            b->buf[b->len-1] = '\n';
+            break;
+        }
+        fvlog_write(b);
+    }
+}
+
+void fvlog_err(char *where, char *what, ...) {
+
+    va_list ap;
+    fvlogbuf *b;
+
+    b = fvlog_buf();
+    if (b && !fvlog_count(b, where, what)) return;
+    if (b) fvlog_write(b);
+    fprintf(stderr," ERROR[%s]: ", where);
+    va_start(ap, what);
+    vfprintf(stderr, what, ap);
+    va_end(ap);
+    fprintf(stderr,"\n");
+}
+
+void fvlog_flush(void) {
+
+    fvlogbuf *b;
+
+    b = fvlog_buf();
+    if (b) fvlog_drain(b);
+}
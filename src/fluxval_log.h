@@ -0,0 +1,54 @@
+/*
+ * NAME:
+ * fluxval_log.h
+ *
+ * PURPOSE:
+ * Header file for the leveled and buffered logging of the processing
+ * loops of fluxval.
+ *
+ * NOTES:
+ * See fluxval_log.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * NA
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_LOG_H
+#define _FLUXVAL_LOG_H
+
+#include <stdio.h>
+
+/*
+ * Levels of messages, a message is written if its level is at most the
+ * level set. Errors are always written.
+ */
+#define FV_LOG_ERROR 0		/* Errors only (default) */
+#define FV_LOG_INFO 1		/* Products, directories and months read */
+#define FV_LOG_DEBUG 2		/* Stations, bands and observation files */
+
+/*
+ * Errors of the same call site written per thread before further ones
+ * are only counted, until fvlog_flush.
+ */
+#define FV_LOG_REPEAT 5
+
+/*
+ * Function prototypes.
+ */
+void fvlog_set_level(int level);
+int fvlog_level(void);
+void fvlog(int level, char *where, char *what, ...)
+    __attribute__ ((format (printf, 3, 4)));
+void fvlog_err(char *where, char *what, ...)
+    __attribute__ ((format (printf, 2, 3)));
+void fvlog_flush(void);
+
+#endif /* _FLUXVAL_LOG_H */
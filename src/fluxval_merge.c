@@ -0,0 +1,557 @@
+/*
+ * NAME:
+ * fluxval_merge.c
+ *
+ * PURPOSE:
+ * To merge matchup files written by fluxval (e.g. per run or per
+ * observation network) into one file sorted by time and station,
+ * dropping duplicated matchups and optionally selecting satellite, area
+ * or period.
+ *
+ * NOTES:
+ * The inputs are mapped into memory and merged in one streaming k-way
+ * merge, memory use does not grow with the size of the inputs. fluxval
+ * writes the matchups of a product in station order and the products in
+ * the order of their file names, so an input is first split into the
+ * runs of records already in order (e.g. one per satellite when the
+ * products of several are kept in one directory) and these runs are
+ * merged.
+ *
+ * Records are ordered by time, station and satellite. Matchups of the
+ * same time, station and satellite in several inputs are duplicates,
+ * e.g. from overlapping runs, the records of the input given last are
+ * kept. Within one input only repeated identical records are dropped,
+ * records of the same key with different values (e.g. of several areas
+ * written to one output by earlier versions of fluxval) are all kept and
+ * reported. The number of duplicates dropped that differed from the
+ * record kept is reported as well. The layout of the records is
+ * recognised from the number of fields: passage (14 fields, also
+ * satellite only records of fluxval -a), compact observations (12) and
+ * daily (5, without satellite). All inputs must have the same layout.
+ *
+ * The records do not hold the area of the product, fluxval writes each
+ * area to its own output. -g selects the inputs having the area in
+ * their name, outputs of different areas should not be merged as their
+ * records would be taken as duplicates.
+ *
+ * The merged file is written next to the output and renamed when
+ * complete, so the output may also be one of the inputs.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fmutil.h>
+
+#define FVM_MAXFIELD 16
+
+/*
+ * Record of an input, pointing into the mapped file.
+ */
+typedef struct {
+    long long time;		/* yyyymmddhhmm */
+    int station;
+    const char *source;		/* NULL for daily records */
+    int slen;
+    const char *line;
+    const char *eol;
+    int nfield;
+} fvmrec;
+
+/*
+ * Run of records in order within an input, rec is the current record.
+ */
+typedef struct {
+    int file;
+    const char *pos;		/* Next line */
+    const char *end;		/* End of run */
+    fvmrec rec;
+} fvmrun;
+
+/*
+ * Selection of records.
+ */
+typedef struct {
+    char *source;
+    long long start;
+    long long end;
+} fvmselect;
+
+typedef struct {
+    long nread;
+    long nbad;
+    long nselected;
+    long nduplicate;
+    long ndiffer;		/* Duplicates dropped with other values */
+    long nconflict;		/* Same key, other values, same input */
+    long nwritten;
+} fvmcount;
+
+/*
+ * Records of the current key from the input given last, written when
+ * the key changes, and those of earlier inputs they replaced.
+ */
+typedef struct {
+    int file;
+    int n;
+    int max;
+    fvmrec *rec;
+    int ndrop;
+    int maxdrop;
+    fvmrec *drop;
+} fvmpend;
+
+void usage_merge(void);
+
+/*
+ * Decode a record, returns the number of fields or 0 if it is not a
+ * matchup.
+ */
+static int fvmerge_parse(const char *line, const char *eol, fvmrec *r) {
+
+    const char *c = line, *field[FVM_MAXFIELD];
+    int flen[FVM_MAXFIELD], n = 0, i, stfield;
+
+    while (c < eol) {
+        while (c < eol && (*c == ' ' || *c == '\t' || *c == '\r')) c++;
+        if (c == eol) break;
+        if (n == FVM_MAXFIELD) return(0);
+        field[n] = c;
+        while (c < eol && *c != ' ' && *c != '\t' && *c != '\r') c++;
+        flen[n] = (int) (c-field[n]);
+        n++;
+    }
+    if (n == 5) {
+        stfield = 3;
+        r->source = NULL;
+        r->slen = 0;
+    } else if (n == 12 || n == 14) {
+        stfield = 10;
+        r->source = field[4];
+        r->slen = flen[4];
+    } else {
+        return(0);
+    }
+    if (flen[0] != 12) return(0);
+    r->time = 0;
+    for (i=0; i<12; i++) {
+        if (field[0][i] < '0' || field[0][i] > '9') return(0);
+        r->time = 10*r->time+(field[0][i]-'0');
+    }
+    r->station = 0;
+    for (i=0; i<flen[stfield]; i++) {
+        if (field[stfield][i] < '0' || field[stfield][i] > '9') return(0);
+        r->station = 10*r->station+(field[stfield][i]-'0');
+    }
+    r->line = line;
+    r->eol = eol;
+    r->nfield = n;
+
+    return(n);
+}
+
+/*
+ * Order of records by time, station and satellite.
+ */
+static int fvmerge_cmpkey(fvmrec *a, fvmrec *b) {
+
+    int c;
+
+    if (a->time != b->time) return((a->time < b->time) ? -1 : 1);
+    if (a->station != b->station) return((a->station < b->station) ? -1 : 1);
+    c = memcmp(a->source, b->source, (a->slen < b->slen) ? a->slen : b->slen);
+    if (c != 0 || a->slen == b->slen) return(c);
+
+    return((a->slen < b->slen) ? -1 : 1);
+}
+
+/*
+ * Order of runs in the merge, records of the same key follow the order
+ * of the inputs and their position within them.
+ */
+static int fvmerge_cmprun(fvmrun *a, fvmrun *b) {
+
+    int c;
+
+    if ((c = fvmerge_cmpkey(&(a->rec), &(b->rec))) != 0) return(c);
+    if (a->file != b->file) return((a->file < b->file) ? -1 : 1);
+
+    return((a->rec.line < b->rec.line) ? -1 : 1);
+}
+
+/*
+ * Advance to the next selected record before end, returns 0 at the end.
+ * Lines that are not matchups are counted as bad if count is given.
+ */
+static int fvmerge_next(const char **pos, const char *end, fvmselect *sel,
+        fvmrec *r, fvmcount *count) {
+
+    const char *line, *eol;
+
+    while (*pos < end) {
+        line = *pos;
+        eol = memchr(line, '\n', end-line);
+        if (!eol) eol = end;
+        *pos = (eol < end) ? eol+1 : end;
+        if (eol == line) continue;
+        if (count) count->nread++;
+        if (!fvmerge_parse(line, eol, r)) {
+            if (count) count->nbad++;
+            continue;
+        }
+        if (r->time < sel->start || r->time > sel->end) continue;
+        if (sel->source && (!r->source ||
+                    (int) strlen(sel->source) != r->slen ||
+                    memcmp(sel->source, r->source, r->slen) != 0)) continue;
+        if (count) count->nselected++;
+        return(1);
+    }
+
+    return(0);
+}
+
+static int fvmerge_addrun(fvmrun **run, int *nrun, int *maxrun, int file,
+        const char *start, const char *end) {
+
+    char *where="fvmerge_addrun";
+    fvmrun *r;
+
+    if (*nrun == *maxrun) {
+        r = (fvmrun *) realloc(*run, 2*(*maxrun+32)*sizeof(fvmrun));
+        if (!r) {
+            fmerrmsg(where,"Could not allocate runs");
+            return(FM_MEMALL_ERR);
+        }
+        *run = r;
+        *maxrun = 2*(*maxrun+32);
+    }
+    r = &((*run)[(*nrun)++]);
+    r->file = file;
+    r->pos = start;
+    r->end = end;
+
+    return(FM_OK);
+}
+
+static void fvmerge_write(FILE *fp, fvmrec *r, fvmcount *count) {
+
+    fwrite(r->line, 1, r->eol-r->line, fp);
+    fputc('\n', fp);
+    count->nwritten++;
+}
+
+static int fvmerge_same(fvmrec *a, fvmrec *b) {
+
+    return(a->eol-a->line == b->eol-b->line &&
+            memcmp(a->line, b->line, a->eol-a->line) == 0);
+}
+
+static int fvmerge_add(fvmrec **rec, int *n, int *max, fvmrec *r) {
+
+    fvmrec *t;
+
+    if (*n == *max) {
+        t = (fvmrec *) realloc(*rec, (*max+8)*sizeof(fvmrec));
+        if (!t) return(FM_MEMALL_ERR);
+        *rec = t;
+        *max += 8;
+    }
+    (*rec)[(*n)++] = *r;
+
+    return(FM_OK);
+}
+
+/*
+ * Add record r of input file to the records pending for its key. A key
+ * of a later input replaces the records pending, within an input only
+ * records differing from those pending are added.
+ */
+static int fvmerge_pend(fvmpend *p, fvmrec *r, int file, fvmcount *count) {
+
+    char *where="fvmerge_pend";
+    int i, same = 0;
+
+    if (p->n > 0 && fvmerge_cmpkey(&(p->rec[0]), r) != 0) {
+        fmerrmsg(where,"Records pending of another key");
+        return(FM_IO_ERR);
+    }
+    if (p->n > 0 && file != p->file) {
+        for (i=0; i<p->n; i++) {
+            count->nduplicate++;
+            if (fvmerge_add(&(p->drop), &(p->ndrop), &(p->maxdrop),
+                        &(p->rec[i])) != FM_OK) {
+                fmerrmsg(where,"Could not allocate records");
+                return(FM_MEMALL_ERR);
+            }
+        }
+        p->n = 0;
+    }
+    for (i=0; i<p->n; i++) {
+        if (fvmerge_same(&(p->rec[i]), r)) same = 1;
+    }
+    if (same) {
+        count->nduplicate++;
+        return(FM_OK);
+    }
+    if (p->n > 0) count->nconflict++;
+    if (fvmerge_add(&(p->rec), &(p->n), &(p->max), r) != FM_OK) {
+        fmerrmsg(where,"Could not allocate records");
+        return(FM_MEMALL_ERR);
+    }
+    p->file = file;
+
+    return(FM_OK);
+}
+
+/*
+ * Write the records pending, records replaced are counted as differing
+ * unless identical to one of them.
+ */
+static void fvmerge_flush(FILE *fp, fvmpend *p, fvmcount *count) {
+
+    int i, j;
+
+    for (i=0; i<p->ndrop; i++) {
+        for (j=0; j<p->n; j++) {
+            if (fvmerge_same(&(p->drop[i]), &(p->rec[j]))) break;
+        }
+        if (j == p->n) count->ndiffer++;
+    }
+    for (i=0; i<p->n; i++) fvmerge_write(fp, &(p->rec[i]), count);
+    p->n = 0;
+    p->ndrop = 0;
+}
+
+static void fvmerge_sift(fvmrun **heap, int n, int i) {
+
+    int c;
+    fvmrun *t;
+
+    for (;;) {
+        c = 2*i+1;
+        if (c >= n) break;
+        if (c+1 < n && fvmerge_cmprun(heap[c+1], heap[c]) < 0) c++;
+        if (fvmerge_cmprun(heap[c], heap[i]) >= 0) break;
+        t = heap[c];
+        heap[c] = heap[i];
+        heap[i] = t;
+        i = c;
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    extern char *optarg;
+    extern int optind;
+    char *where="fluxval_merge";
+    char *outfile = NULL, *area = NULL, **input;
+    char stime[FMSTRING16], etime[FMSTRING16], tmpfile[FMSTRING1024];
+    char **map;
+    size_t *size;
+    int i, j, n, fd, nrun = 0, maxrun = 0, nheap, nfield = 0;
+    short sflg = 0, eflg = 0;
+    const char *pos, *start;
+    struct stat sbuf;
+    fvmselect sel;
+    fvmcount count;
+    fvmpend pend;
+    fvmrec r, prev;
+    fvmrun *run = NULL, **heap, *top;
+    FILE *ofp;
+
+    memset(&sel, 0, sizeof(fvmselect));
+    while ((i = getopt(argc, argv, "o:S:g:s:e:")) != EOF) {
+        switch (i) {
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'S':
+                sel.source = optarg;
+                break;
+            case 'g':
+                area = optarg;
+                break;
+            case 's':
+                if (strlen(optarg) != 10) usage_merge();
+                snprintf(stime,FMSTRING16,"%s",optarg);
+                sflg++;
+                break;
+            case 'e':
+                if (strlen(optarg) != 10) usage_merge();
+                snprintf(etime,FMSTRING16,"%s",optarg);
+                eflg++;
+                break;
+            default:
+                usage_merge();
+                break;
+        }
+    }
+    if (!outfile || optind >= argc) usage_merge();
+    sel.start = sflg ? atoll(stime)*100 : 0;
+    sel.end = eflg ? atoll(etime)*100+59 : 999999999999LL;
+    n = argc-optind;
+    input = &(argv[optind]);
+    memset(&count, 0, sizeof(fvmcount));
+
+    map = (char **) calloc(n, sizeof(char *));
+    size = (size_t *) calloc(n, sizeof(size_t));
+    if (!map || !size) {
+        fmerrmsg(where,"Could not allocate inputs");
+        exit(FM_MEMALL_ERR);
+    }
+
+    /*
+     * Map the inputs and split them into runs of records in order.
+     */
+    for (j=0; j<n; j++) {
+        if (area && !strstr(input[j], area)) continue;
+        fd = open(input[j], O_RDONLY);
+        if (fd < 0 || fstat(fd, &sbuf) != 0) {
+            fmerrmsg(where,"Could not open %s", input[j]);
+            exit(FM_IO_ERR);
+        }
+        size[j] = (size_t) sbuf.st_size;
+        if (size[j] > 0) {
+            map[j] = mmap(NULL, size[j], PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map[j] == MAP_FAILED) {
+                fmerrmsg(where,"Could not map %s", input[j]);
+                exit(FM_IO_ERR);
+            }
+        }
+        close(fd);
+        if (size[j] == 0) continue;
+        pos = map[j];
+        start = pos;
+        i = 0;
+        while (fvmerge_next(&pos, map[j]+size[j], &sel, &r, &count)) {
+            if (nfield == 0) nfield = r.nfield;
+            if (r.nfield != nfield) {
+                fmerrmsg(where,"%s holds records of %d fields, expected %d",
+                        input[j], r.nfield, nfield);
+                exit(FM_IO_ERR);
+            }
+            if (i && fvmerge_cmpkey(&r, &prev) < 0) {
+                if (fvmerge_addrun(&run, &nrun, &maxrun, j, start, r.line)
+                        != FM_OK) exit(FM_MEMALL_ERR);
+                start = r.line;
+            }
+            prev = r;
+            i++;
+        }
+        if (i && fvmerge_addrun(&run, &nrun, &maxrun, j, start,
+                    map[j]+size[j]) != FM_OK) exit(FM_MEMALL_ERR);
+    }
+    fmlogmsg(where,"%ld records selected of %ld read in %d runs",
+            count.nselected, count.nread, nrun);
+    if (count.nbad > 0) {
+        fmerrmsg(where,"%ld lines are not matchups and were skipped",
+                count.nbad);
+    }
+
+    /*
+     * Merge the runs, of records with the same key only those of the
+     * last input are written.
+     */
+    heap = (fvmrun **) malloc((nrun+1)*sizeof(fvmrun *));
+    if (!heap) {
+        fmerrmsg(where,"Could not allocate merge");
+        exit(FM_MEMALL_ERR);
+    }
+    nheap = 0;
+    for (i=0; i<nrun; i++) {
+        if (fvmerge_next(&(run[i].pos), run[i].end, &sel, &(run[i].rec),
+                    NULL)) {
+            heap[nheap++] = &(run[i]);
+        }
+    }
+    for (i=nheap/2-1; i>=0; i--) fvmerge_sift(heap, nheap, i);
+
+    snprintf(tmpfile,FMSTRING1024,"%s.tmp",outfile);
+    ofp = fopen(tmpfile,"w");
+    if (!ofp) {
+        fmerrmsg(where,"Could not open %s", tmpfile);
+        exit(FM_IO_ERR);
+    }
+    setvbuf(ofp, NULL, _IOFBF, 1<<20);
+    memset(&pend, 0, sizeof(fvmpend));
+    while (nheap > 0) {
+        top = heap[0];
+        if (pend.n > 0 && fvmerge_cmpkey(&(pend.rec[0]), &(top->rec)) != 0) {
+            fvmerge_flush(ofp, &pend, &count);
+        }
+        if (fvmerge_pend(&pend, &(top->rec), top->file, &count) != FM_OK) {
+            remove(tmpfile);
+            exit(FM_MEMALL_ERR);
+        }
+        if (!fvmerge_next(&(top->pos), top->end, &sel, &(top->rec), NULL)) {
+            heap[0] = heap[--nheap];
+        }
+        fvmerge_sift(heap, nheap, 0);
+    }
+    fvmerge_flush(ofp, &pend, &count);
+    if (pend.rec) free(pend.rec);
+    if (pend.drop) free(pend.drop);
+    if (fclose(ofp) != 0 || rename(tmpfile, outfile) != 0) {
+        fmerrmsg(where,"Could not write %s", outfile);
+        remove(tmpfile);
+        exit(FM_IO_ERR);
+    }
+    for (j=0; j<n; j++) {
+        if (map[j] && size[j] > 0) munmap(map[j], size[j]);
+    }
+    fmlogmsg(where,"%ld matchups written to %s, %ld duplicates dropped",
+            count.nwritten, outfile, count.nduplicate);
+    if (count.ndiffer > 0) {
+        fmlogmsg(where,"%ld duplicates dropped had other values than the "
+                "record kept from a later input", count.ndiffer);
+    }
+    if (count.nconflict > 0) {
+        fmerrmsg(where,"%ld records have the time, station and satellite "
+                "of another record of the same input with other values "
+                "(several areas in one file?), all were kept",
+                count.nconflict);
+    }
+    free(heap);
+    free(run);
+    free(map);
+    free(size);
+
+    exit(FM_OK);
+}
+
+void usage_merge(void) {
+
+    fprintf(stdout,"\n");
+    fprintf(stdout," fluxval_merge -o <output> [-S <satellite> -g <area>");
+    fprintf(stdout," -s <start_time> -e <end_time>]\n");
+    fprintf(stdout,"     <input> [<input> ...]\n");
+    fprintf(stdout,"     -o output: merged matchups sorted by time and\n");
+    fprintf(stdout,"        station, may be one of the inputs\n");
+    fprintf(stdout,"     -S satellite: only matchups of this satellite\n");
+    fprintf(stdout,"        (e.g. noaa19, not for daily matchups)\n");
+    fprintf(stdout,"     -g area: only inputs with area in their name\n");
+    fprintf(stdout,"     -s start_time: yyyymmddhh\n");
+    fprintf(stdout,"     -e end_time: yyyymmddhh\n");
+    fprintf(stdout,"     input: output of fluxval, of matchups repeated\n");
+    fprintf(stdout,"        in several inputs the last given is kept\n");
+    fprintf(stdout,"\n");
+
+    exit(FM_OK);
+}
@@ -0,0 +1,352 @@
+/*
+ * NAME:
+ * fluxval_obsformat.c
+ *
+ * PURPOSE:
+ * To describe the monthly observation files of a network, so that all
+ * networks are read by one reader (fluxval_readobs_format) and new
+ * networks can be added by a description file (fluxval -F).
+ *
+ * NOTES:
+ * A description is lines of keyword and value, # starts a comment:
+ *   name <name>
+ *   file <pattern>     file name within the observation directory,
+ *                      %n station number, %s station name (both take
+ *                      printf flags and width, e.g. %05n), %Y year,
+ *                      %y year in two digits, %m month in two digits
+ *   header <lines>     header lines before the records (default 0)
+ *   check <text>       text required in the last header line
+ *   time <format>      time of a record, YYYY MM DD hh mm ss mark the
+ *                      digits, other characters are skipped. Spaces
+ *                      separate fields. "-" keeps the first field as
+ *                      written (yyyymmddhhmm...)
+ *   columns <var>...   parlist members of the fields following the
+ *                      time, "-" skips a field
+ *   missing <value>    larger values are missing (-999)
+ *   output single|full single gives Q0 or LW (by product) per matchup,
+ *                      full TTM, Q0 and ST (default)
+ *   colloc <spec>      collocation in time as for fluxval -t
+ *   station <field>    the file holds all stations of the month, field
+ *                      (1 is first) of the records is the station
+ *                      number, the time and columns follow in the
+ *                      remaining fields. The file pattern then only
+ *                      uses the time.
+ *
+ * The formats read by fluxval -b, -c, -w and by default are built in.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <fluxval_readobs.h>
+#include <fluxval_obsformat.h>
+
+static char *fvobsformat_builtins[] = {
+    /*
+     * Bioforsk data in original format, prior to ingestion in KDVH.
+     */
+    "name bioforsk\n"
+    "file %m0%05n.c%y\n"
+    "header 1\n"
+    "check TTM   TTN   TTX   TJM TJM20 TJM50 UUM UUX     RR   FM2   FG2"
+    "   FX2     QO   BT  TGM   TGN   TGX  ST\n"
+    "time -\n"
+    "columns TTM TTN TTX TJM10 TJM20 TJM50 UUM UUX RR FM2 FG2 FX2 Q0 BT"
+    " TGM TGN TGX ST TT\n"
+    "missing 100000000\n",
+    /*
+     * IPY data, hourly averages of minute data (R-package ncradflux),
+     * stamped at the centre of the hour.
+     */
+    "name compact\n"
+    "file radflux_%s_%Y%m.txt\n"
+    "header 1\n"
+    "time YYYY-MM-DD hh:mm:ss\n"
+    "columns Q0 - LW -\n"
+    "output single\n"
+    "colloc align=centred\n",
+    /*
+     * Bioforsk data extracted from KDVH through Ulric.
+     */
+    "name ulric\n"
+    "file radflux_%n_%Y%m.txt\n"
+    "header 3\n"
+    "check # Time TA QO OT_1\n"
+    "time YYYYMMDDThhmm\n"
+    "columns TTM Q0 ST\n",
+    /*
+     * Data extracted from the WMO GTS data stream in BUFR.
+     */
+    "name gts\n"
+    "file radflux_%05n_%Y%m.txt\n"
+    "header 3\n"
+    "time YYYY-MM-DD hh:mm:ss\n"
+    "columns Q0 LW ST\n",
+    NULL
+};
+
+#define FVOFF(x) {#x, offsetof(parlist, x)}
+
+static struct {
+    char *name;
+    int offset;
+} fvobsformat_vars[] = {
+    FVOFF(TTM), FVOFF(TTN), FVOFF(TTX), FVOFF(TJM10), FVOFF(TJM20),
+    FVOFF(TJM50), FVOFF(UUM), FVOFF(UUX), FVOFF(RR), FVOFF(FM2),
+    FVOFF(FG2), FVOFF(FX2), FVOFF(Q0), FVOFF(BT), FVOFF(TGM), FVOFF(TGN),
+    FVOFF(TGX), FVOFF(ST), FVOFF(TT), FVOFF(TG), FVOFF(UU), FVOFF(FF2),
+    FVOFF(FF), FVOFF(DD), FVOFF(FM), FVOFF(DM), FVOFF(FG), FVOFF(DG),
+    FVOFF(FX), FVOFF(DX), FVOFF(ARR), FVOFF(RA), FVOFF(LW),
+    {NULL, 0}
+};
+
+static int fvobsformat_var(char *name) {
+
+    int i;
+
+    if (strcmp(name,"-") == 0) return(-1);
+    for (i=0; fvobsformat_vars[i].name; i++) {
+        if (strcmp(name,fvobsformat_vars[i].name) == 0) {
+            return(fvobsformat_vars[i].offset);
+        }
+    }
+
+    return(-2);
+}
+
+/*
+ * Parse a description, source names it in messages.
+ */
+int fvobsformat_parse(char *text, char *source, fvobsformat *f) {
+
+    char *where="fvobsformat_parse";
+    char *line, *next, *key, *value, *tok, *saveptr;
+    int n = 0, v;
+
+    memset(f, 0, sizeof(fvobsformat));
+    sprintf(f->time,"-");
+    f->ntime = 1;
+    for (line=text; line && *line; line=next) {
+        n++;
+        next = strchr(line,'\n');
+        if (next) *next++ = '\0';
+        if (strlen(line) > 0 && line[strlen(line)-1] == '\r') {
+            line[strlen(line)-1] = '\0';
+        }
+        for (key=line; isspace((unsigned char) *key); key++);
+        if (*key == '\0' || *key == '#') continue;
+        for (value=key; *value && !isspace((unsigned char) *value); value++);
+        if (*value) *value++ = '\0';
+        while (isspace((unsigned char) *value)) value++;
+
+        if (strcmp(key,"name") == 0) {
+            snprintf(f->name,FMSTRING32,"%s",value);
+        } else if (strcmp(key,"file") == 0) {
+            snprintf(f->file,FMSTRING256,"%s",value);
+        } else if (strcmp(key,"header") == 0) {
+            f->header = atoi(value);
+        } else if (strcmp(key,"check") == 0) {
+            snprintf(f->check,FMSTRING256,"%s",value);
+        } else if (strcmp(key,"time") == 0) {
+            snprintf(f->time,FMSTRING32,"%s",value);
+            f->ntime = 1;
+            for (tok=f->time; *tok; tok++) {
+                if (*tok == ' ') f->ntime++;
+            }
+        } else if (strcmp(key,"columns") == 0) {
+            f->nfield = 0;
+            f->haslw = 0;
+            for (tok=strtok_r(value," \t",&saveptr); tok;
+                    tok=strtok_r(NULL," \t",&saveptr)) {
+                v = fvobsformat_var(tok);
+                if (v == -2 || f->nfield == FV_MAXFIELDS) {
+                    fmerrmsg(where,"%s line %d: %s", source, n,
+                            (v == -2) ? "unknown variable" :
+                            "too many columns");
+                    return(FM_IO_ERR);
+                }
+                if (v == offsetof(parlist, LW)) f->haslw = 1;
+                f->var[f->nfield++] = v;
+            }
+        } else if (strcmp(key,"missing") == 0) {
+            f->hasmissing = 1;
+            f->missing = (float) atof(value);
+        } else if (strcmp(key,"output") == 0) {
+            if (strcmp(value,"single") == 0) {
+                f->single = 1;
+            } else if (strcmp(value,"full") == 0) {
+                f->single = 0;
+            } else {
+                fmerrmsg(where,"%s line %d: unknown output %s",
+                        source, n, value);
+                return(FM_IO_ERR);
+            }
+        } else if (strcmp(key,"colloc") == 0) {
+            snprintf(f->colloc,FMSTRING256,"%s",value);
+        } else if (strcmp(key,"station") == 0) {
+            f->station = atoi(value);
+            if (f->station < 1) {
+                fmerrmsg(where,"%s line %d: station field starts at 1",
+                        source, n);
+                return(FM_IO_ERR);
+            }
+        } else {
+            fmerrmsg(where,"%s line %d: unknown keyword %s", source, n, key);
+            return(FM_IO_ERR);
+        }
+    }
+    if (f->file[0] == '\0' || f->nfield == 0 || f->header < 0) {
+        fmerrmsg(where,"%s must give file and columns", source);
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+int fvobsformat_read(char *filename, fvobsformat *f) {
+
+    char *where="fvobsformat_read";
+    char *text;
+    long size;
+    int status;
+    FILE *fp;
+
+    fp = fopen(filename,"r");
+    if (!fp) {
+        fmerrmsg(where,"Could not open %s", filename);
+        return(FM_IO_ERR);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    text = (char *) malloc(size+1);
+    if (!text) {
+        fclose(fp);
+        fmerrmsg(where,"Could not allocate description");
+        return(FM_MEMALL_ERR);
+    }
+    size = (long) fread(text, 1, size, fp);
+    text[size] = '\0';
+    fclose(fp);
+    status = fvobsformat_parse(text, filename, f);
+    free(text);
+
+    return(status);
+}
+
+int fvobsformat_builtin(char *name, fvobsformat *f) {
+
+    char *where="fvobsformat_builtin";
+    char text[FMSTRING1024], key[FMSTRING64];
+    int i;
+
+    snprintf(key,FMSTRING64,"name %s\n",name);
+    for (i=0; fvobsformat_builtins[i]; i++) {
+        if (strncmp(fvobsformat_builtins[i],key,strlen(key)) == 0) {
+            snprintf(text,FMSTRING1024,"%s",fvobsformat_builtins[i]);
+            return(fvobsformat_parse(text, name, f));
+        }
+    }
+    fmerrmsg(where,"No built in observation format %s", name);
+
+    return(FM_IO_ERR);
+}
+
+/*
+ * Name of the file of a station and month.
+ */
+int fvobsformat_filename(fvobsformat *f, char *path, int number,
+        char *name, int year, int month, char *out, int len) {
+
+    char *where="fvobsformat_filename";
+    char spec[FMSTRING32], *p;
+    int n, k;
+
+    n = snprintf(out, len, "%s/", path);
+    for (p=f->file; *p && n < len; p++) {
+        if (*p != '%') {
+            out[n++] = *p;
+            continue;
+        }
+        spec[0] = '%';
+        for (k=1, p++; *p && strchr("0123456789-",*p) && k < 16; p++) {
+            spec[k++] = *p;
+        }
+        spec[k] = '\0';
+        switch (*p) {
+            case 'n':
+                strcat(spec,"d");
+                n += snprintf(out+n, len-n, spec, number);
+                break;
+            case 's':
+                strcat(spec,"s");
+                n += snprintf(out+n, len-n, spec, name);
+                break;
+            case 'Y':
+                n += snprintf(out+n, len-n, "%4d", year);
+                break;
+            case 'y':
+                n += snprintf(out+n, len-n, "%02d",
+                        (year < 2000) ? year-1900 : year-2000);
+                break;
+            case 'm':
+                n += snprintf(out+n, len-n, "%02d", month);
+                break;
+            case '%':
+                out[n++] = '%';
+                break;
+            default:
+                fmerrmsg(where,"Unknown conversion in %s", f->file);
+                return(FM_IO_ERR);
+        }
+    }
+    if (n >= len) {
+        fmerrmsg(where,"File name of %s too long", f->file);
+        return(FM_IO_ERR);
+    }
+    out[n] = '\0';
+
+    return(FM_OK);
+}
+
+/*
+ * Decode the time s of a record into date (yyyymmddhhmmss), the digits
+ * are taken from the positions marked in the time format.
+ */
+int fvobsformat_time(fvobsformat *f, char *s, char *date) {
+
+    int i, t[6] = {0, 0, 0, 0, 0, 0};
+    char *c;
+
+    if (f->time[0] == '-') {
+        snprintf(date,16,"%s",s);
+        return(FM_OK);
+    }
+    for (i=0; f->time[i]; i++) {
+        c = strchr("YMDhms",f->time[i]);
+        if (!c) {
+            if (s[i] == '\0') return(FM_IO_ERR);
+            continue;
+        }
+        if (!isdigit((unsigned char) s[i])) return(FM_IO_ERR);
+        t[c-"YMDhms"] = 10*t[c-"YMDhms"]+(s[i]-'0');
+    }
+    snprintf(date,16,"%04d%02d%02d%02d%02d%02d",
+            t[0],t[1],t[2],t[3],t[4],t[5]);
+
+    return(FM_OK);
+}
@@ -0,0 +1,63 @@
+/*
+ * NAME:
+ * fluxval_obsformat.h
+ *
+ * PURPOSE:
+ * Header file for descriptions of observation file formats.
+ *
+ * NOTES:
+ * See fluxval_obsformat.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_OBSFORMAT_H
+#define _FLUXVAL_OBSFORMAT_H
+
+#include <fmutil.h>
+
+#define FV_MAXFIELDS 48
+
+/*
+ * Description of a network's monthly observation files. The fields of
+ * a record following the time are stored in the parlist members given
+ * by var (byte offsets, -1 if the field is skipped).
+ */
+typedef struct {
+    char name[FMSTRING32];
+    char file[FMSTRING256];	/* File name pattern */
+    int station;		/* Field of station number, 0 if per file */
+    int header;			/* Header lines */
+    char check[FMSTRING256];	/* Required in last header line */
+    char time[FMSTRING32];	/* Time format, "-" if kept as written */
+    int ntime;			/* Fields of the time */
+    int nfield;			/* Fields following the time */
+    int var[FV_MAXFIELDS];
+    short hasmissing;
+    float missing;		/* Larger values are missing */
+    short single;		/* Only Q0 or LW, by product, is output */
+    short haslw;		/* A column holds LW */
+    char colloc[FMSTRING256];	/* Collocation in time, as for -t */
+} fvobsformat;
+
+/*
+ * Function prototypes.
+ */
+int fvobsformat_parse(char *text, char *source, fvobsformat *f);
+int fvobsformat_read(char *filename, fvobsformat *f);
+int fvobsformat_builtin(char *name, fvobsformat *f);
+int fvobsformat_filename(fvobsformat *f, char *path, int number,
+        char *name, int year, int month, char *out, int len);
+int fvobsformat_time(fvobsformat *f, char *s, char *date);
+
+#endif /* _FLUXVAL_OBSFORMAT_H */
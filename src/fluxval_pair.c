@@ -0,0 +1,237 @@
+/*
+ * NAME:
+ * fluxval_pair.c
+ *
+ * PURPOSE:
+ * To validate a candidate processing chain against a reference
+ * (operational) chain in one pass (fluxval --reference). Products of the
+ * two chains are paired, both are extracted at the same station boxes
+ * and collocated with the same observations, and the differences are
+ * written per matchup along with paired statistics.
+ *
+ * NOTES:
+ * The candidate products are found as usual (-r), the reference products
+ * in the same directory below the reference root. Products are paired
+ * by time, area and source read from the product headers, candidate
+ * products without a reference product are skipped. Observations are
+ * read and collocated once for both.
+ *
+ * The output holds one line per matchup:
+ *   time, source, station, candidate estimate and valid pixels,
+ *   reference estimate and valid pixels, candidate minus reference
+ *   (-999.00 unless both are valid) and the observation compared (Q0 or
+ *   LW by product, or the daily mean, -999.00 if missing).
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval_pair.h>
+
+static int fvpair_cmp(const void *a, const void *b) {
+
+    const fvpairitem *x = (const fvpairitem *) a;
+    const fvpairitem *y = (const fvpairitem *) b;
+    int c;
+
+    if (x->time != y->time) return((x->time < y->time) ? -1 : 1);
+    if ((c = strcmp(x->area, y->area)) != 0) return(c);
+
+    return(strcmp(x->source, y->source));
+}
+
+static long long fvpair_time(PRODhead *h) {
+
+    return((((h->year*100LL+h->month)*100+h->day)*100+h->hour)*100+
+            h->minute);
+}
+
+void fvpair_index_free(fvpairindex *ix) {
+
+    if (ix->item) free(ix->item);
+    ix->item = NULL;
+    ix->n = 0;
+    ix->dir[0] = '\0';
+    ix->product[0] = '\0';
+}
+
+/*
+ * List the reference products of a directory, the headers are read to
+ * pair them. The index is kept while the directory is the same.
+ */
+int fvpair_index(fvpairindex *ix, char *dir, char *fntest, int nprod,
+        char *product) {
+
+    char *where="fvpair_index";
+    int i;
+    fmfilelist fl;
+    osihdf o;
+    fvpairitem *it;
+
+    if (ix->item && strcmp(ix->dir, dir) == 0 && 
+            strcmp(ix->product, product) == 0) return(FM_OK);
+    fvpair_index_free(ix);
+    snprintf(ix->dir,FILENAMELEN,"%s",dir);
+    snprintf(ix->product,FMSTRING16,"%s",product);
+    if (fmreaddir(dir, &fl)) {
+        fmerrmsg(where,"Could not read content of %s", dir);
+        return(FM_OK);
+    }
+    ix->item = (fvpairitem *) malloc((fl.nfiles+1)*sizeof(fvpairitem));
+    if (!ix->item) {
+        fmerrmsg(where,"Could not allocate index of %s", dir);
+        fmfilelist_free(&fl);
+        return(FM_MEMALL_ERR);
+    }
+    for (i=0; i<fl.nfiles; i++) {
+        if (!fluxval_fntest(fl.filename[i], fntest)) continue;
+        if (nprod > 1 && !strstr(fl.filename[i], product)) continue;
+        it = &(ix->item[ix->n]);
+        snprintf(it->path,FILENAMELEN,"%s/%s",dir,fl.filename[i]);
+        o.d = NULL;
+        if (read_hdf5_product(it->path, &o, 1) != 0) {
+            fmerrmsg(where,"Could not read header of %s", it->path);
+            continue;
+        }
+        it->time = fvpair_time(&(o.h));
+        snprintf(it->area,32,"%s",o.h.area);
+        snprintf(it->source,32,"%s",o.h.source);
+        free_osihdf(&o);
+        ix->n++;
+    }
+    fmfilelist_free(&fl);
+    qsort(ix->item, ix->n, sizeof(fvpairitem), fvpair_cmp);
+    fvlog(FV_LOG_INFO, where,"%d reference products in %s", ix->n, dir);
+
+    return(FM_OK);
+}
+
+/*
+ * Write a pair of matchups and update the statistics.
+ */
+static int fvpair_write(fvsession *s, fvmatchup *m, fvmatchup *mr,
+        fvpairstats *st) {
+
+    char *where="fvpair_write";
+    int hasobs, status;
+    float obs, diff = FV_MISVAL;
+
+    hasobs = fluxval_compared_obs(s, m, &obs);
+    if (m->nvalid > 0 && mr->nvalid > 0) diff = m->flux-mr->flux;
+
+    runstats_start(&(s->rs), RS_OUTPUT);
+    status = fprintf(s->fp,
+            " %4d%02d%02d%02d%02d %s %05d %7.2f %3d %7.2f %3d %7.2f %7.2f\n",
+            m->year, m->month, m->day, m->hour, m->minute, m->source,
+            m->stid, m->flux, m->nvalid, mr->flux, mr->nvalid, diff,
+            (obs > FV_MISVAL) ? obs : FV_MISVAL);
+    runstats_stop(&(s->rs), RS_OUTPUT);
+    if (status < 0) {
+        fmerrmsg(where,"Could not write matchup");
+        return(FM_IO_ERR);
+    }
+    runstats_count(&(s->rs), RC_MATCHUPS, 1);
+
+    st->npairs++;
+    if (m->nvalid > 0 && mr->nvalid > 0) {
+        st->n++;
+        st->sumdiff += diff;
+        st->sumsqdiff += diff*diff;
+        if (hasobs) {
+            st->nobs++;
+            st->sumcand += (m->flux-obs);
+            st->sumsqcand += (m->flux-obs)*(m->flux-obs);
+            st->sumref += (mr->flux-obs);
+            st->sumsqref += (mr->flux-obs)*(mr->flux-obs);
+        }
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Validate a candidate product together with its reference product.
+ */
+int fvpair_process(fvsession *s, char *filename, fvpairindex *ix,
+        fvpairstats *st) {
+
+    char *where="fvpair_process";
+    int k, h, status = FM_OK;
+    fvpairitem key, *it;
+    fvproduct *p, *r;
+    fvmatchup m, mr;
+
+    fvlog(FV_LOG_INFO, where,"Processing %s", filename);
+    p = fluxval_product_read(s, filename);
+    if (!p) return(FM_IO_ERR);
+    key.time = fvpair_time(&(p->ipd.h));
+    snprintf(key.area,32,"%s",p->ipd.h.area);
+    snprintf(key.source,32,"%s",p->ipd.h.source);
+    it = (fvpairitem *) bsearch(&key, ix->item, ix->n, sizeof(fvpairitem),
+            fvpair_cmp);
+    if (!it) {
+        fvlog(FV_LOG_INFO, where,"No reference product for %s", filename);
+        st->nunpaired++;
+        fluxval_product_free(p);
+        return(FM_OK);
+    }
+    r = fluxval_product_read(s, it->path);
+    if (!r) {
+        fluxval_product_free(p);
+        return(FM_IO_ERR);
+    }
+    st->nproducts++;
+
+    if (fluxval_load_obs(s, p->ipd.h.year, p->ipd.h.month) != FM_OK) {
+        status = FM_IO_ERR;
+    } else if (!fluxval_obs_available(s, p)) {
+        fvlog(FV_LOG_INFO, where,"No observations collocated with %s", 
+                filename);
+        runstats_count(&(s->rs), RC_FILESNOOBS, 1);
+    } else {
+        for (k=0; k<s->stl.cnt && status == FM_OK; k++) {
+            if (fluxval_extract(s, p, k, &m) != FM_OK) continue;
+            if (fluxval_extract(s, r, k, &mr) != FM_OK) continue;
+            h = -1;
+            while ((h = fluxval_collocate(s, h+1, &m)) >= 0) {
+                status = fvpair_write(s, &m, &mr, st);
+                if (status != FM_OK || s->mode == FV_MODE_DAILY) break;
+            }
+        }
+    }
+    fluxval_product_free(p);
+    fluxval_product_free(r);
+    fvlog_flush();
+
+    return(status);
+}
+
+void fvpair_report(char *product, fvpairstats *st) {
+
+    char *where="fvpair_report";
+
+    fmlogmsg(where,"%s: %ld products paired, %ld without reference",
+            product, st->nproducts, st->nunpaired);
+    if (st->n > 0) {
+        fmlogmsg(where,
+                "%s: %ld matchups, candidate-reference mean %.2f, rms %.2f",
+                product, st->n, st->sumdiff/st->n, sqrt(st->sumsqdiff/st->n));
+    }
+    if (st->nobs > 0) {
+        fmlogmsg(where,
+                "%s: %ld compared, candidate bias %.2f rmse %.2f, "
+                "reference bias %.2f rmse %.2f", product, st->nobs,
+                st->sumcand/st->nobs, sqrt(st->sumsqcand/st->nobs),
+                st->sumref/st->nobs, sqrt(st->sumsqref/st->nobs));
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * NAME:
+ * fluxval_pair.h
+ *
+ * PURPOSE:
+ * Header file for differential validation of two processing chains.
+ *
+ * NOTES:
+ * See fluxval_pair.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_PAIR_H
+#define _FLUXVAL_PAIR_H
+
+#include <fluxval.h>
+
+/*
+ * Products of a directory of the reference chain, sorted by time, area
+ * and source.
+ */
+typedef struct {
+    long long time;		/* yyyymmddhhmm */
+    char area[32];
+    char source[32];
+    char path[FILENAMELEN];
+} fvpairitem;
+
+typedef struct {
+    char dir[FILENAMELEN];
+    char product[FMSTRING16];	/* Product listed when several share dir */
+    int n;
+    fvpairitem *item;
+} fvpairindex;
+
+/*
+ * Paired statistics. Differences are candidate minus reference for
+ * matchups with valid estimates from both, the comparison against
+ * observations uses the matchups where both and the observation are
+ * valid.
+ */
+typedef struct {
+    long nproducts;		/* Candidate products paired */
+    long nunpaired;		/* Candidate products without reference */
+    long npairs;		/* Matchups written */
+    long n;
+    double sumdiff;
+    double sumsqdiff;
+    long nobs;
+    double sumcand;		/* Candidate minus observation */
+    double sumsqcand;
+    double sumref;		/* Reference minus observation */
+    double sumsqref;
+} fvpairstats;
+
+/*
+ * Function prototypes.
+ */
+int fvpair_index(fvpairindex *ix, char *dir, char *fntest, int nprod,
+        char *product);
+void fvpair_index_free(fvpairindex *ix);
+int fvpair_process(fvsession *s, char *filename, fvpairindex *ix,
+        fvpairstats *st);
+void fvpair_report(char *product, fvpairstats *st);
+
+#endif /* _FLUXVAL_PAIR_H */
@@ -0,0 +1,163 @@
+/*
+ * NAME:
+ * fluxval_prefetch.c
+ *
+ * PURPOSE:
+ * To read product files ahead of their processing, so that waiting for
+ * the archive (network file system) overlaps with decoding and
+ * collocation of the previous products.
+ *
+ * NOTES:
+ * A thread reads the header of the products to come and the storage of
+ * the bands the session will extract (fluxval_product_prefetch), leaving
+ * them in the page cache for fluxval_product_read and the bands read on
+ * demand. Bands that are not extracted are not read. Products whose
+ * bands are not read on demand are read as a whole, as are all files if
+ * no session is given. The kernel is advised of the parts to come
+ * (posix_fadvise WILLNEED) and these are read as well since not all
+ * network file systems act on the advice. The thread keeps at most ahead
+ * files in front of the file being processed to bound the memory used.
+ *
+ * The products are not decoded from memory (HDF5 file images), the
+ * header is read by libosihdf5 which only takes a file name, and an
+ * image of the file would hold the bands skipped as well.
+ *
+ * BUGS:
+ * Files are read twice if the page cache is too small for ahead files.
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fluxval.h>
+#include <fluxval_prefetch.h>
+
+#define FVP_CHUNK (1024*1024)
+
+static void fvprefetch_file(fvprefetch *pf, char *path, char *buf) {
+
+    int fd;
+    ssize_t n;
+    long long bytes;
+
+    if (pf->s) {
+        bytes = fluxval_product_prefetch(pf->s, path, buf, FVP_CHUNK);
+        if (bytes >= 0) {
+            pf->bytes += bytes;
+            return;
+        }
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    while ((n = read(fd, buf, FVP_CHUNK)) > 0) {
+        pf->bytes += n;
+    }
+    close(fd);
+}
+
+static void *fvprefetch_thread(void *arg) {
+
+    fvprefetch *pf = (fvprefetch *) arg;
+    char path[FMSTRING1024*2], *buf;
+    int i;
+
+    buf = (char *) malloc(FVP_CHUNK);
+    if (!buf) return(NULL);
+
+    pthread_mutex_lock(&(pf->lock));
+    while (!pf->stop && pf->fetched < pf->n) {
+        if (pf->fetched >= pf->current+pf->ahead) {
+            pthread_cond_wait(&(pf->cond), &(pf->lock));
+            continue;
+        }
+        i = pf->fetched;
+        pthread_mutex_unlock(&(pf->lock));
+        if (pf->dir[0]) {
+            snprintf(path, sizeof(path), "%s/%s", pf->dir, pf->name[i]);
+        } else {
+            snprintf(path, sizeof(path), "%s", pf->name[i]);
+        }
+        fvprefetch_file(pf, path, buf);
+        pthread_mutex_lock(&(pf->lock));
+        if (pf->fetched == i) pf->fetched++;
+    }
+    pthread_mutex_unlock(&(pf->lock));
+    free(buf);
+
+    return(NULL);
+}
+
+/*
+ * Start reading dir/name[0..n-1] ahead of processing by session s, dir
+ * is NULL if the names are paths. The names must be kept until
+ * fvprefetch_stop is called. Whole files are read if s is NULL.
+ */
+int fvprefetch_start(fvprefetch *pf, fvsession *s, char *dir, char **name,
+        int n, int ahead) {
+
+    char *where="fvprefetch_start";
+
+    memset(pf, 0, sizeof(fvprefetch));
+    pf->s = s;
+    if (dir) snprintf(pf->dir, FMSTRING1024, "%s", dir);
+    pf->name = name;
+    pf->n = n;
+    pf->ahead = ahead;
+    if (n < 1 || ahead < 1) return(FM_OK);
+    pthread_mutex_init(&(pf->lock), NULL);
+    pthread_cond_init(&(pf->cond), NULL);
+    if (pthread_create(&(pf->tid), NULL, fvprefetch_thread, pf)) {
+        fmerrmsg(where,"Could not start prefetch thread");
+        pthread_cond_destroy(&(pf->cond));
+        pthread_mutex_destroy(&(pf->lock));
+        return(FM_IO_ERR);
+    }
+    pf->running = 1;
+
+    return(FM_OK);
+}
+
+/*
+ * Tell the thread that file current is being processed. Files skipped
+ * by the consumer are not read.
+ */
+void fvprefetch_current(fvprefetch *pf, int current) {
+
+    if (!pf->running) return;
+    pthread_mutex_lock(&(pf->lock));
+    pf->current = current;
+    if (pf->fetched < current) pf->fetched = current;
+    pthread_cond_signal(&(pf->cond));
+    pthread_mutex_unlock(&(pf->lock));
+}
+
+/*
+ * Stop the thread, returns the number of bytes read ahead.
+ */
+long long fvprefetch_stop(fvprefetch *pf) {
+
+    if (!pf->running) return(0);
+    pthread_mutex_lock(&(pf->lock));
+    pf->stop = 1;
+    pthread_cond_signal(&(pf->cond));
+    pthread_mutex_unlock(&(pf->lock));
+    pthread_join(pf->tid, NULL);
+    pthread_cond_destroy(&(pf->cond));
+    pthread_mutex_destroy(&(pf->lock));
+    pf->running = 0;
+
+    return(pf->bytes);
+}
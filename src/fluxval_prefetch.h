@@ -0,0 +1,61 @@
+/*
+ * NAME:
+ * fluxval_prefetch.h
+ *
+ * PURPOSE:
+ * Header file for reading product files ahead of their processing.
+ *
+ * NOTES:
+ * See fluxval_prefetch.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_PREFETCH_H
+#define _FLUXVAL_PREFETCH_H
+
+#include <pthread.h>
+#include <fmutil.h>
+#include <fluxval_api.h>
+
+/*
+ * Files dir/name[0..n-1] (name[] if dir is empty) are read by a thread,
+ * at most ahead files in front of the file being processed (current),
+ * as far as session s will read them.
+ */
+typedef struct {
+    fvsession *s;
+    char dir[FMSTRING1024];
+    char **name;
+    int n;
+    int ahead;
+    int current;
+    int fetched;
+    short stop;
+    short running;
+    long long bytes;		/* Bytes read ahead */
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} fvprefetch;
+
+/*
+ * Function prototypes.
+ */
+int fvprefetch_start(fvprefetch *pf, fvsession *s, char *dir, char **name,
+        int n, int ahead);
+void fvprefetch_current(fvprefetch *pf, int current);
+long long fvprefetch_stop(fvprefetch *pf);
+
+#endif /* _FLUXVAL_PREFETCH_H */
@@ -0,0 +1,113 @@
+/*
+ * NAME:
+ * fluxval_query.c
+ *
+ * PURPOSE:
+ * To select matchups from the database written by fluxval -D, either as
+ * the lines fluxval writes to its output or summarised as bias and rmse
+ * per product and area.
+ *
+ * NOTES:
+ * Matchups are selected by product, area, period and station, all
+ * matchups are selected by default. The lines are written ordered by
+ * product and time, each matchup once however often it was validated.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ *
+ * DEPENDENCIES:
+ * o SQLite 3
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fmutil.h>
+#include <fluxval_db.h>
+
+void usage_query(void);
+
+int main(int argc, char *argv[]) {
+
+    extern char *optarg;
+    char *where="fluxval_query";
+    char *dbfile = NULL;
+    int i, status;
+    short Sflg = 0;
+    fvdbquery q;
+    fvdb *db;
+
+    memset(&q, 0, sizeof(fvdbquery));
+    while ((i = getopt(argc, argv, "D:p:g:s:e:i:S")) != EOF) {
+        switch (i) {
+            case 'D':
+                dbfile = optarg;
+                break;
+            case 'p':
+                snprintf(q.product,FMSTRING16,"%s",optarg);
+                break;
+            case 'g':
+                snprintf(q.area,FMSTRING16,"%s",optarg);
+                break;
+            case 's':
+                if (strlen(optarg) != 10) usage_query();
+                q.start = atoll(optarg)*100;
+                break;
+            case 'e':
+                if (strlen(optarg) != 10) usage_query();
+                q.end = atoll(optarg)*100+59;
+                break;
+            case 'i':
+                q.station = atoi(optarg);
+                break;
+            case 'S':
+                Sflg++;
+                break;
+            default:
+                usage_query();
+                break;
+        }
+    }
+    if (!dbfile) usage_query();
+    if (access(dbfile, R_OK) != 0) {
+        fmerrmsg(where,"Could not find matchup database %s", dbfile);
+        exit(FM_IO_ERR);
+    }
+
+    db = fluxval_db_open(dbfile);
+    if (!db) exit(FM_IO_ERR);
+    if (Sflg) {
+        status = fvdb_summary(db, &q, stdout);
+    } else {
+        status = fvdb_query(db, &q, stdout);
+    }
+    if (fluxval_db_close(db) != FM_OK) status = FM_IO_ERR;
+
+    exit(status);
+}
+
+void usage_query(void) {
+
+    fprintf(stdout,"\n");
+    fprintf(stdout," fluxval_query -D <db> [-S -p <product> -g <area>");
+    fprintf(stdout," -s <start_time> -e <end_time> -i <station>]\n");
+    fprintf(stdout,"     -D db: database written by fluxval -D\n");
+    fprintf(stdout,"     -S: write bias and rmse per product and area\n");
+    fprintf(stdout,"        instead of the matchups\n");
+    fprintf(stdout,"     -p product: ssi or dli\n");
+    fprintf(stdout,"     -g area: area of the products\n");
+    fprintf(stdout,"     -s start_time: yyyymmddhh\n");
+    fprintf(stdout,"     -e end_time: yyyymmddhh\n");
+    fprintf(stdout,"     -i station: station number\n");
+    fprintf(stdout,"\n");
+
+    exit(FM_OK);
+}
@@ -6,8 +6,13 @@
  * To read ASCII files containing observations from automatic stations with
  * global radiation measurements.
  *
+ * NOTES:
+ * The formats of the networks are described in fluxval_obsformat.c,
+ * all are read by fluxval_readobs_format.
+ *
  * BUGS:
- * Year is only specified using two digits - care has to be taken...
+ * Year is only specified using two digits in the Bioforsk format - care
+ * has to be taken...
  *
  * RETURN VALUES:
  * 0 - normal and correct ending
@@ -33,501 +38,327 @@
 #include <string.h>
 
 /*
- * Bioforsk data in original format, prior to ingestion in KDVH. Only used
- * for historical data now. ystein Gody, METNO/FOU, 2014-08-21 
+ * Split a line into at most max fields in place, returns the number of
+ * fields.
  */
-int fluxval_readobs(char *path, int year, short month, stlist stl, stdata **std) {
-
-    char *where="fluxval_readobs";
-    char *infile, *dummy;
-    /* while testing
-       char *pl1="TTM       TTN       TTX       TJM     TJM20     TJM50       ";
-       char *pl2="UUM       UUX        RR       FM2       FG2       FX2        ";
-       char *pl3="QO        BT       TGM       TGN       TGX        ST        TT";
-       */
-    char *pl1="TTM   TTN   TTX   TJM TJM20 TJM50 ";
-    char *pl2="UUM UUX     RR   FM2   FG2   FX2     ";
-    char *pl3="QO   BT  TGM   TGN   TGX  ST";
-    char *pl;
-    short i, sy;
-    int j;
-    FILE *fp;
-
-    /*
-     * Change year specification to the required 2 digits...
-     */
-    if (year < 2000) {
-        sy = (short) (year-1900);
-    } else {
-        sy = (short) (year-2000);
+static int fluxval_readobs_split(char *line, char **tok, int max) {
+
+    int n;
+
+    for (n=0; n<max; n++) {
+        while (*line == ' ' || *line == '\t' || *line == '\r' || 
+                *line == '\n') line++;
+        if (*line == '\0') break;
+        tok[n] = line;
+        while (*line && *line != ' ' && *line != '\t' && 
+                *line != '\r' && *line != '\n') line++;
+        if (*line) *line++ = '\0';
     }
 
-    /*
-     * Allocate memory required.
-     */
-    infile = (char *) malloc(FILELEN*sizeof(char));
-    if (!infile) {
-        fmerrmsg(where,"Could not allocate infile");
-        return(FM_MEMALL_ERR);
-    }
-    if (create_stdata(std, stl.cnt)) {
-        clear_stdata(std, stl.cnt);
-        return(FM_IO_ERR);
+    return(n);
+}
+
+/*
+ * Store the n fields of a record. Fields are stored until one is not a
+ * number, the rest of the record is missing.
+ */
+static void fluxval_readobs_record(fvobsformat *fmt, char **tok, int n, 
+        parlist *par) {
+
+    char timestr[FMSTRING64], *end;
+    int k;
+    float v;
+
+    if (n >= fmt->ntime) {
+        timestr[0] = '\0';
+        for (k=0; k<fmt->ntime; k++) {
+            if (k > 0) strcat(timestr," ");
+            strncat(timestr,tok[k],FMSTRING32-1);
+        }
+        fvobsformat_time(fmt, timestr, par->date);
     }
-    dummy = (char *) malloc(OBSRECLEN*sizeof(char));
-    if (!dummy) {
-        clear_stdata(std, stl.cnt);
-        fmerrmsg(where,"Could not allocate dummy");
-        return(FM_MEMALL_ERR);
+    for (k=fmt->ntime; k<n; k++) {
+        v = strtof(tok[k], &end);
+        if (end == tok[k]) break;
+        if (fmt->var[k-fmt->ntime] < 0) continue;
+        if (fmt->hasmissing && v > fmt->missing) v = -999.;
+        *((float *) ((char *) par+fmt->var[k-fmt->ntime])) = v;
     }
-    pl = (char *) malloc(OBSRECLEN*sizeof(char));
-    if (!pl) {
-        clear_stdata(std, stl.cnt);
-        fmerrmsg(where,"Could not allocate pl");
-        return(FM_MEMALL_ERR);
+}
+
+/*
+ * Station index of station numbers by open addressing, size is a power
+ * of two at least twice the number of stations.
+ */
+typedef struct {
+    int size;
+    int *number;
+    int *index;
+} fvsthash;
+
+static int fvsthash_init(fvsthash *h, stlist *stl) {
+
+    int i, k;
+
+    for (h->size=16; h->size < 2*stl->cnt; h->size *= 2);
+    h->number = (int *) malloc(h->size*sizeof(int));
+    h->index = (int *) malloc(h->size*sizeof(int));
+    if (!h->number || !h->index) return(FM_MEMALL_ERR);
+    for (k=0; k<h->size; k++) h->index[k] = -1;
+    for (i=0; i<stl->cnt; i++) {
+        k = ((unsigned int) stl->id[i].number*2654435761U)&(h->size-1);
+        while (h->index[k] >= 0 && h->number[k] != stl->id[i].number) {
+            k = (k+1)&(h->size-1);
+        }
+        if (h->index[k] >= 0) continue;
+        h->number[k] = stl->id[i].number;
+        h->index[k] = i;
     }
-    sprintf(pl,"%s%s%s",pl1,pl2,pl3);
 
+    return(FM_OK);
+}
 
-    for (i=0; i<stl.cnt; i++) {
-        /*
-         * Create filenames to read using year, month and station number
-         * specification (mm0sssss.cyy).
-         */
-        sprintf(infile,"%s/%02d0%05d.c%02d",path,month,stl.id[i].number,sy);
-        fprintf(stdout," Reading autostation file: %s\n", infile);
+static int fvsthash_find(fvsthash *h, int number) {
 
-        /*
-         * Open the specified list of stations and read data into data
-         * structure.  Must read first line and the deceide how to read
-         * data (number of parameters vary). 
-         */
-        fp = fopen(infile,"r");
-        if (!fp) {
-            fmerrmsg(where,"Could not open %s", infile);
-            (*std)[i].missing = 1;
-            continue;
-        }
+    int k;
 
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
-        }
-        if (!strstr(dummy,pl)) {
-            fmerrmsg(where,"Incorrect parameter list\ngot: %s\nexpected: %s",
-                    dummy, pl);
-            return(FM_IO_ERR);
-        }
+    k = ((unsigned int) number*2654435761U)&(h->size-1);
+    while (h->index[k] >= 0) {
+        if (h->number[k] == number) return(h->index[k]);
+        k = (k+1)&(h->size-1);
+    }
 
-        (*std)[i].id = stl.id[i].number;
-        j = 0;
-        while (fgets(dummy, OBSRECLEN, fp)) {
-            sscanf(dummy,
-                    "%s%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f%f",
-                    (*std)[i].param[j].date,
-                    &((*std)[i]).param[j].TTM,&((*std)[i]).param[j].TTN,
-                    &((*std)[i]).param[j].TTX,
-                    &((*std)[i]).param[j].TJM10,&((*std)[i]).param[j].TJM20,
-                    &((*std)[i]).param[j].TJM50,
-                    &((*std)[i]).param[j].UUM,&((*std)[i]).param[j].UUX,
-                    &((*std)[i]).param[j].RR,
-                    &((*std)[i]).param[j].FM2,&((*std)[i]).param[j].FG2,
-                    &((*std)[i]).param[j].FX2,
-                    &((*std)[i]).param[j].Q0,&((*std)[i]).param[j].BT,
-                    &((*std)[i]).param[j].TGM,&((*std)[i]).param[j].TGN,
-                    &((*std)[i]).param[j].TGX,
-                    &((*std)[i]).param[j].ST,
-                    &((*std)[i]).param[j].TT); 
-
-            if ((*std)[i].param[j].TTM > 100000000.) {
-                (*std)[i].param[j].TTM = -999.;
-            } 
-            if ((*std)[i].param[j].TTN > 100000000.) {
-                (*std)[i].param[j].TTN = -999.;
-            } 
-            if ((*std)[i].param[j].TTX > 100000000.) {
-                (*std)[i].param[j].TTX = -999.;
-            } 
-            if ((*std)[i].param[j].TJM10 > 100000000.) {
-                (*std)[i].param[j].TJM10 = -999.;
-            } 
-            if ((*std)[i].param[j].TJM20 > 100000000.) {
-                (*std)[i].param[j].TJM20 = -999.;
-            } 
-            if ((*std)[i].param[j].TJM50 > 100000000.) {
-                (*std)[i].param[j].TJM50 = -999.;
-            } 
-            if ((*std)[i].param[j].UUM > 100000000.) {
-                (*std)[i].param[j].UUM = -999.;
-            } 
-            if ((*std)[i].param[j].UUX > 100000000.) {
-                (*std)[i].param[j].UUX = -999.;
-            } 
-            if ((*std)[i].param[j].RR > 100000000.) {
-                (*std)[i].param[j].RR = -999.;
-            } 
-            if ((*std)[i].param[j].FM2 > 100000000.) {
-                (*std)[i].param[j].FM2 = -999.;
-            } 
-            if ((*std)[i].param[j].FG2 > 100000000.) {
-                (*std)[i].param[j].FG2 = -999.;
-            } 
-            if ((*std)[i].param[j].FX2 > 100000000.) {
-                (*std)[i].param[j].FX2 = -999.;
-            } 
-            if ((*std)[i].param[j].Q0 > 100000000.) {
-                (*std)[i].param[j].Q0 = -999.;
-            } 
-            if ((*std)[i].param[j].BT > 100000000.) {
-                (*std)[i].param[j].BT = -999.;
-            } 
-            if ((*std)[i].param[j].TGM > 100000000.) {
-                (*std)[i].param[j].TGM = -999.;
-            } 
-            if ((*std)[i].param[j].TGN > 100000000.) {
-                (*std)[i].param[j].TGN = -999.;
-            } 
-            if ((*std)[i].param[j].TGX > 100000000.) {
-                (*std)[i].param[j].TGX = -999.;
-            } 
-            if ((*std)[i].param[j].ST > 100000000.) {
-                (*std)[i].param[j].ST = -999.;
-            } 
-            if ((*std)[i].param[j].TT > 100000000.) {
-                (*std)[i].param[j].TT = -999.;
-            }
-            j++;
-        }
+    return(-1);
+}
 
-        fclose(fp);
-    }
+static void fvsthash_free(fvsthash *h) {
 
-    /*
-     * Clean up before function is left.
-     */
-    free(infile);
-    free(dummy);
-    free(pl);
-    return(FM_OK);
+    free(h->number);
+    free(h->index);
 }
 
 /*
- * IPY data
- * These files are generated by the R-package ncradflux function
- * averadflux. The original data are minute data which are transformed
- * into hourly data using averadflux. 
- * Check https://github.com/steingod/R-ncradflux for details.
+ * Read the header lines of fp, the last must contain the check text.
  */
-int fluxval_readobs_ascii(char *path, int year, short month, stlist stl, stdata **std) {
-
-    char *where="fluxval_readobs";
-    char *infile, *dummy;
-    char dummytime[FMSTRING32], dummytime2[FMSTRING32];
-    char *pl="\"time\" \"mssi\" \"nssi\" \"mdli\" \"ndli\"";
-    short i;
-    fmtime obstime;
-    int j;
-    FILE *fp;
-
-    /*
-     * Allocate memory required.
-     */
-    infile = (char *) malloc(FILELEN*sizeof(char));
-    if (!infile) {
-        fmerrmsg(where,"Could not allocate infile");
-        return(FM_MEMALL_ERR);
-    }
-    if (create_stdata(std, stl.cnt)) {
-        clear_stdata(std, stl.cnt);
-        return(FM_IO_ERR);
-    }
-    dummy = (char *) malloc(OBSRECLEN*sizeof(char));
-    if (!dummy) {
-        clear_stdata(std, stl.cnt);
-        fmerrmsg(where,"Could not allocate dummy");
-        return(FM_MEMALL_ERR);
-    }
+static int fluxval_readobs_header(fvobsformat *fmt, FILE *fp, char *infile,
+        char **line, size_t *len) {
 
-    for (i=0; i<stl.cnt; i++) {
-        /*
-         * Create filenames to read using year, month and station number
-         * specification (mm0sssss.cyy).
-         */
-        sprintf(infile,"%s/radflux_%s_%4d%02d.txt",
-                path,stl.id[i].name,year,month);
-        fprintf(stdout," Reading autostation file: %s\n", infile);
+    char *where="fluxval_readobs_header";
+    int k;
 
-        /*
-         * Open the specified list of stations and read data into data
-         * structure.  Must read first line and the deceide how to read
-         * data (number of parameters vary). 
-         */
-        fp = fopen(infile,"r");
-        if (!fp) {
-            fmerrmsg(where,"Could not open %s", infile);
-            (*std)[i].missing = 1;
-            continue;
-        }
-
-        j = 0;
-        /*
-         * Retry 3 times to handle header changes over time
-         */
-        while (!fgets(dummy, OBSRECLEN, fp)) {
-            if (!strstr(dummy,pl)) {
-                fmerrmsg(where,"Incorrect parameter list\ngot: %s\nexpected: %s",
-                        dummy, pl);
-                if (j>2) {
-                    fmerrmsg(where,"Could not read data.");
-                    return(FM_IO_ERR);
-                }
-            j++;}
+    for (k=0; k<fmt->header; k++) {
+        if (getline(line, len, fp) < 0) {
+            fmerrmsg(where,"Could not read header of %s", infile);
+            return(FM_IO_ERR);
         }
-
-        (*std)[i].id = stl.id[i].number;
-        j = 0;
-        while (fgets(dummy, OBSRECLEN, fp)) {
-            sscanf(dummy,
-                    "%s%s%f%*f%f%*f",
-                    dummytime, dummytime2,
-                    &((*std)[i]).param[j].Q0,
-                    &((*std)[i]).param[j].LW); 
-            strcat(dummytime," ");
-            strcat(dummytime, dummytime2);
-            printf("[%s]-[%s]\n", dummytime,dummytime2);
-            fmstring2fmtime(dummytime,"YYYY-MM-DD hh:mm:ss",&obstime);
-            sprintf((*std)[i].param[j].date,"%4d%02d%02d%02d%02d%02d",
-                    obstime.fm_year,obstime.fm_mon,obstime.fm_mday,
-                    obstime.fm_hour,obstime.fm_min,obstime.fm_sec);
-            j++;
+        if (k == fmt->header-1 && !strstr(*line,fmt->check)) {
+            fmerrmsg(where,
+                    "Incorrect parameter list\n\tgot: %s\n\texpected: %s",
+                    *line, fmt->check);
+            return(FM_IO_ERR);
         }
     }
 
-    /*
-     * Clean up before function is left.
-     */
-    free(infile);
-    free(dummy);
     return(FM_OK);
 }
 
 /*
- * Read data extracted from Ulric, the URL interface to KDVH
- * Currently only air temperature, global radiation and sunshine duration
- * is expected for this on an hourly basis.
+ * Files holding all stations of a month, the station number is field
+ * fmt->station of the records. The file is read in one pass and the
+ * records routed to the stations listed, stations without records are
+ * missing.
  */
-int fluxval_readobs_ulric(char *path, int year, short month, stlist stl, stdata **std) {
+static int fluxval_readobs_bulk(char *path, int year, short month, stlist stl, fvobsformat *fmt, stdata **std) {
 
-    char *where="fluxval_readobs";
-    char *infile, *dummy;
-    char dummytime[FMSTRING32], dummytime2[FMSTRING32];
-    char *pl="# Time TA QO OT_1";
-    short i;
-    fmtime obstime;
-    int j;
+    char *where="fluxval_readobs_bulk";
+    char infile[FMSTRING1024], *line = NULL, *tok[FV_MAXFIELDS+FMSTRING32];
+    size_t len = 0;
+    int i, k, n, *nrec, skipped = 0;
+    fvsthash h;
     FILE *fp;
 
-    /*
-     * Allocate memory required.
-     */
-    infile = (char *) malloc(FILELEN*sizeof(char));
-    if (!infile) {
-        fmerrmsg(where,"Could not allocate infile");
+    if (fvobsformat_filename(fmt, path, 0, "", year, month, infile, 
+                FMSTRING1024) != FM_OK) return(FM_IO_ERR);
+    fvlog(FV_LOG_DEBUG, where,"Reading observation file %s", infile);
+    fp = fopen(infile,"r");
+    if (!fp) {
+        fmerrmsg(where,"Could not open %s", infile);
+        for (i=0; i<stl.cnt; i++) (*std)[i].missing = 1;
+        return(FM_OK);
+    }
+    nrec = (int *) calloc(stl.cnt > 0 ? stl.cnt : 1, sizeof(int));
+    if (!nrec || fvsthash_init(&h, &stl) != FM_OK) {
+        fclose(fp);
+        fmerrmsg(where,"Could not allocate station index");
         return(FM_MEMALL_ERR);
     }
-    if (create_stdata(std, stl.cnt)) {
-        clear_stdata(std, stl.cnt);
+    if (fluxval_readobs_header(fmt, fp, infile, &line, &len) != FM_OK) {
+        fclose(fp);
+        free(line);
+        free(nrec);
+        fvsthash_free(&h);
         return(FM_IO_ERR);
     }
-    dummy = (char *) malloc(OBSRECLEN*sizeof(char));
-    if (!dummy) {
-        clear_stdata(std, stl.cnt);
-        fmerrmsg(where,"Could not allocate dummy");
-        return(FM_MEMALL_ERR);
-    }
-
-    for (i=0; i<stl.cnt; i++) {
-        /*
-         * Create filenames to read using year, month and station number
-         * specification (mm0sssss.cyy).
-         */
-        sprintf(infile,"%s/radflux_%d_%4d%02d.txt",
-                path,stl.id[i].number,year,month);
-        fprintf(stdout," Reading autostation file: %s\n", infile);
 
-        /*
-         * Open the specified list of stations and read data into data
-         * structure.  Must read first line and the deceide how to read
-         * data (number of parameters vary). 
-         */
-        fp = fopen(infile,"r");
-        if (!fp) {
-            fmerrmsg(where,"Could not open %s", infile);
-            (*std)[i].missing = 1;
+    while (getline(&line, &len, fp) >= 0) {
+        n = fluxval_readobs_split(line, tok, 
+                fmt->ntime+fmt->nfield+1);
+        if (n < fmt->station) continue;
+        i = fvsthash_find(&h, atoi(tok[fmt->station-1]));
+        if (i < 0) {
+            skipped++;
             continue;
         }
-
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
-        }
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
-        }
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
-        }
-        if (!strstr(dummy,pl)) {
-            fmerrmsg(where,"Incorrect parameter list\n\tgot: %s\n\texpected: %s",
-                    dummy, pl);
-            return(FM_IO_ERR);
+        if (nrec[i] == NO_MONTHOBS) {
+            fmerrmsg(where,"More than %d records of station %d in %s",
+                    NO_MONTHOBS, stl.id[i].number, infile);
+            nrec[i]++;
+            continue;
         }
+        if (nrec[i] > NO_MONTHOBS) continue;
+        for (k=fmt->station-1; k<n-1; k++) tok[k] = tok[k+1];
+        fluxval_readobs_record(fmt, tok, n-1, 
+                &((*std)[i].param[nrec[i]++]));
+    }
+    fclose(fp);
 
-        (*std)[i].id = stl.id[i].number;
-        j = 0;
-        while (fgets(dummy, OBSRECLEN, fp)) {
-            sscanf(dummy,
-                    "%s%f%f%f",
-                    dummytime,
-                    &((*std)[i]).param[j].TTM,
-                    &((*std)[i]).param[j].Q0,
-                    &((*std)[i]).param[j].ST); 
-            /*
-            strcat(dummytime," ");
-            strcat(dummytime, dummytime2);
-            */
-            fmstring2fmtime(dummytime,"YYYYMMDDThhmm",&obstime);
-            sprintf((*std)[i].param[j].date,"%4d%02d%02d%02d%02d%02d",
-                    obstime.fm_year,obstime.fm_mon,obstime.fm_mday,
-                    obstime.fm_hour,obstime.fm_min,obstime.fm_sec);
-            j++;
+    for (i=0; i<stl.cnt; i++) {
+        if (nrec[i] > 0) {
+            (*std)[i].id = stl.id[i].number;
+        } else {
+            (*std)[i].missing = 1;
         }
     }
+    if (skipped > 0) {
+        fvlog(FV_LOG_INFO, where,"%d records of stations not listed in %s", 
+                skipped, infile);
+    }
+    free(line);
+    free(nrec);
+    fvsthash_free(&h);
 
-    /*
-     * Clean up before function is left.
-     */
-    free(infile);
-    free(dummy);
     return(FM_OK);
 }
 
-/* 
- * Read data extracted from the WMO GTS data stream in BUFR. A wrapper
- * around bufrdump.pl has been used to generate monthly ASCII files. All
- * files look the same regardless of which parameters that are available.
- * No header is applied in files.
+/*
+ * Read the observations of a month for the stations listed, in the
+ * format described by fmt (see fluxval_obsformat.c). Each file is read
+ * in one piece and split into fields in place, records are the lines
+ * following the header lines, blank lines are skipped. Files holding
+ * all stations are read by fluxval_readobs_bulk.
  */
-int fluxval_readobs_gts(char *path, int year, short month, stlist stl, stdata **std) {
+int fluxval_readobs_format(char *path, int year, short month, stlist stl, fvobsformat *fmt, stdata **std, fvarena *arena) {
 
-    char *where="fluxval_readobs";
-    char *infile, *dummy;
-    char dummytime[FMSTRING32], dummytime2[FMSTRING32];
-    char *pl=""; /* Not used currently */
+    char *where="fluxval_readobs_format";
+    char infile[FMSTRING1024];
+    char *buf = NULL, *line, *next, *tok[FV_MAXFIELDS+FMSTRING32];
+    size_t bufsize = 0, size;
     short i;
-    fmtime obstime;
-    int j;
+    int j, k, n;
     FILE *fp;
 
-    /*
-     * Allocate memory required.
-     */
-    infile = (char *) malloc(FILELEN*sizeof(char));
-    if (!infile) {
-        fmerrmsg(where,"Could not allocate infile");
+    if (create_stdata(std, stl.cnt, arena)) {
+        clear_stdata(std, stl.cnt, arena);
         return(FM_MEMALL_ERR);
     }
-    if (create_stdata(std, stl.cnt)) {
-        clear_stdata(std, stl.cnt);
-        return(FM_IO_ERR);
-    }
-    dummy = (char *) malloc(OBSRECLEN*sizeof(char));
-    if (!dummy) {
-        clear_stdata(std, stl.cnt);
-        fmerrmsg(where,"Could not allocate dummy");
-        return(FM_MEMALL_ERR);
+    if (fmt->station > 0) {
+        return(fluxval_readobs_bulk(path, year, month, stl, fmt, std));
     }
 
     for (i=0; i<stl.cnt; i++) {
-        /*
-         * Create filenames to read using year, month and station number
-         */
-        sprintf(infile,"%s/radflux_%05d_%4d%02d.txt",
-                path,stl.id[i].number,year,month);
-        fprintf(stdout," Reading autostation file: %s\n", infile);
+        if (fvobsformat_filename(fmt, path, stl.id[i].number, 
+                    stl.id[i].name, year, month, infile, 
+                    FMSTRING1024) != FM_OK) {
+            free(buf);
+            return(FM_IO_ERR);
+        }
+        fvlog(FV_LOG_DEBUG, where,"Reading autostation file %s", infile);
 
-        /*
-         * Open the specified list of stations and read data into data
-         * structure.  Must read first line and the deceide how to read
-         * data (number of parameters vary). 
-         */
         fp = fopen(infile,"r");
         if (!fp) {
-            fmerrmsg(where,"Could not open %s", infile);
+            fvlog_err(where,"Could not open %s", infile);
             (*std)[i].missing = 1;
             continue;
         }
-
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
-        }
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
-        }
-        if (!fgets(dummy, OBSRECLEN, fp)) {
-            fmerrmsg(where,"Could not read data.");
-            return(FM_IO_ERR);
+        fseek(fp, 0, SEEK_END);
+        size = (size_t) ftell(fp);
+        rewind(fp);
+        if (size+1 > bufsize) {
+            free(buf);
+            bufsize = size+1;
+            buf = (char *) malloc(bufsize);
+            if (!buf) {
+                fclose(fp);
+                fmerrmsg(where,"Could not allocate buffer for %s", infile);
+                return(FM_MEMALL_ERR);
+            }
         }
-        if (!strstr(dummy,pl)) {
-            fmerrmsg(where,"Incorrect parameter list\n\tgot: %s\n\texpected: %s",
-                    dummy, pl);
-            return(FM_IO_ERR);
+        size = fread(buf, 1, size, fp);
+        buf[size] = '\0';
+        fclose(fp);
+
+        /*
+         * Header lines, the last must contain the check text.
+         */
+        next = buf;
+        for (k=0; k<fmt->header; k++) {
+            line = next;
+            if (!line || *line == '\0') {
+                fmerrmsg(where,"Could not read header of %s", infile);
+                free(buf);
+                return(FM_IO_ERR);
+            }
+            next = strchr(line,'\n');
+            if (next) *next++ = '\0';
+            if (k == fmt->header-1 && !strstr(line,fmt->check)) {
+                fmerrmsg(where,
+                        "Incorrect parameter list\n\tgot: %s\n\texpected: %s",
+                        line, fmt->check);
+                free(buf);
+                return(FM_IO_ERR);
+            }
         }
 
         (*std)[i].id = stl.id[i].number;
         j = 0;
-        while (fgets(dummy, OBSRECLEN, fp)) {
-            sscanf(dummy,
-                    "%s%s%f%f%f",
-                    dummytime, dummytime2,
-                    &((*std)[i]).param[j].Q0,
-                    &((*std)[i]).param[j].LW,
-                    &((*std)[i]).param[j].ST); 
-            strcat(dummytime," ");
-            strcat(dummytime, dummytime2);
-            fmstring2fmtime(dummytime,"YYYY-MM-DD hh:mm:ss",&obstime);
-            sprintf((*std)[i].param[j].date,"%4d%02d%02d%02d%02d%02d",
-                    obstime.fm_year,obstime.fm_mon,obstime.fm_mday,
-                    obstime.fm_hour,obstime.fm_min,obstime.fm_sec);
+        for (line=next; line && *line; line=next) {
+            next = strchr(line,'\n');
+            if (next) *next++ = '\0';
+            n = fluxval_readobs_split(line, tok, fmt->ntime+fmt->nfield);
+            if (n == 0) continue;
+            if (j == NO_MONTHOBS) {
+                fmerrmsg(where,"More than %d records in %s, rest skipped",
+                        NO_MONTHOBS, infile);
+                break;
+            }
+            fluxval_readobs_record(fmt, tok, n, &((*std)[i].param[j]));
             j++;
         }
     }
 
-    /*
-     * Clean up before function is left.
-     */
-    free(infile);
-    free(dummy);
+    free(buf);
     return(FM_OK);
 }
 
-int create_stdata(stdata **pt, int size) {
+/*
+ * The observations of a month are allocated in one piece from the arena
+ * given, which is reset first. Memory is thus reused from month to month
+ * and released by clear_stdata in one operation.
+ */
+int create_stdata(stdata **pt, int size, fvarena *arena) {
     int i, j;
+    parlist *param;
 
-    *pt = (stdata *) malloc(size*sizeof(stdata));
+    if (fvarena_reset(arena) != FM_OK) return(FM_MEMALL_ERR);
+    *pt = (stdata *) fvarena_alloc(arena, size*sizeof(stdata));
     if (!(*pt)) return(FM_MEMALL_ERR);
+    param = (parlist *) fvarena_alloc(arena, 
+            (size_t) size*NO_MONTHOBS*sizeof(parlist));
+    if (!param) return(FM_MEMALL_ERR);
 
     for (i=0; i<size; i++) {
         (*pt)[i].missing = 0;
-        (*pt)[i].param = (parlist *) malloc(NO_MONTHOBS*sizeof(parlist));
-        if (!(*pt)[i].param) {
-            free(*pt);
-            return(FM_MEMALL_ERR);
-        }
+        (*pt)[i].param = &param[i*NO_MONTHOBS];
         for (j=0; j<NO_MONTHOBS; j++) {
             sprintf((*pt)[i].param[j].date,"xxxxxxxxxxxx");
             (*pt)[i].param[j].TTM=-999.;
@@ -555,15 +386,10 @@ int create_stdata(stdata **pt, int size) {
     return(FM_OK);
 }
 
-int clear_stdata(stdata **pt, int size) {
-    int i;
+int clear_stdata(stdata **pt, int size, fvarena *arena) {
 
-    if (size == 0) return(FM_OK);
-    for (i=0; i<size; i++) {
-        free((*pt)[i].param);
-    }
-    free(*pt);
+    *pt = NULL;
 
-    return(FM_OK);
+    return(fvarena_reset(arena));
 }
 
@@ -33,10 +33,16 @@
  * $Id$
  */
 
+#ifndef _FLUXVAL_READOBS_H
+#define _FLUXVAL_READOBS_H
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <fmutil.h>
+#include <fluxval_arena.h>
+#include <fluxval_obsformat.h>
+#include <fluxval_log.h>
 
 #define FILELEN 100
 #define ST_NAMELEN 20
@@ -55,6 +61,7 @@ typedef struct {
 typedef struct {
     short cnt;
     stid *id;
+    fvarena mem;	/* Holds id and names */
 } stlist;
 
 typedef struct {
@@ -107,9 +114,8 @@ int decode_stlist(char *filename, stlist *stl);
 int create_stlist(int size, stlist *pts);
 int copy_stlist(stlist *lhs, stlist *rhs);
 int clear_stlist(stlist *pts);
-int create_stdata(stdata **pt, int size);
-int clear_stdata(stdata **pt, int size);
-int fluxval_readobs(char *path, int year, short month, stlist stl, stdata **std);
-int fluxval_readobs_ascii(char *path, int year, short month, stlist stl, stdata **std); 
-int fluxval_readobs_ulric(char *path, int year, short month, stlist stl, stdata **std); 
-int fluxval_readobs_gts(char *path, int year, short month, stlist stl, stdata **std); 
+int create_stdata(stdata **pt, int size, fvarena *arena);
+int clear_stdata(stdata **pt, int size, fvarena *arena);
+int fluxval_readobs_format(char *path, int year, short month, stlist stl, fvobsformat *fmt, stdata **std, fvarena *arena); 
+
+#endif /* _FLUXVAL_READOBS_H */
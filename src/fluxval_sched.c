@@ -0,0 +1,427 @@
+/*
+ * NAME:
+ * fluxval_sched.c
+ *
+ * PURPOSE:
+ * To validate the products of a long period (reprocessing) using several
+ * threads, producing the same output as a serial run.
+ *
+ * NOTES:
+ * The products are collected in the order a serial run would process
+ * them and split into shards of consecutive products of one type
+ * (directory listing, at most FV_SHARDFILES products). Each thread has
+ * its own sessions (fluxval_session_clone) and thereby its own
+ * observation window and product grids.
+ *
+ * The shards are initially divided into one contiguous range per thread
+ * to keep the observations read by a thread within few months. A thread
+ * having finished its range steals shards from the end of the range of
+ * the thread with most shards left. The matchups of a shard are written
+ * to memory and the calling thread appends them to the output files in
+ * shard order, so the files are identical to those of a serial run.
+ *
+ * If a product can not be processed, the matchups up to that product are
+ * written and processing stops as in a serial run.
+ *
+ * The timing and counters of a shard are added to those of the run when
+ * it is completed. A report requested by SIGUSR1 is written by the
+ * calling thread while waiting for the shards, holding the work of the
+ * shards completed so far (to the report files of q->report, stderr if
+ * not set).
+ *
+ * With prefetch set, each thread reads the products of its shard ahead
+ * of processing (see fluxval_prefetch.c).
+ *
+ * The shards can also be divided between several runs (fluxval --shard),
+ * fvsched_select keeps a contiguous part so that the outputs of the runs
+ * concatenated in order equal the output of a single run.
+ *
+ * BUGS:
+ * Reading of products is serialised (see fluxval_lib.c), the speedup is
+ * limited by the time spent in read_hdf5_product.
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval.h>
+#include <fluxval_sched.h>
+#include <fluxval_prefetch.h>
+#include <pthread.h>
+#include <time.h>
+
+#define FV_POLLSECONDS 1	/* Interval to check for report requests */
+
+/*
+ * Shards to process per thread, next is taken by the owner and end is
+ * moved down by thieves.
+ */
+typedef struct {
+    int next;
+    int end;
+} fvrange;
+
+typedef struct {
+    fvsched *q;
+    fvsession **ws;		/* Sessions per thread and product */
+    int nprod;
+    int nthreads;
+    fvrange *range;
+    runstats *work;		/* Work of the shards completed per product */
+    short stop;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} fvpool;
+
+typedef struct {
+    fvpool *pool;
+    int id;
+} fvworker;
+
+int fvsched_init(fvsched *q) {
+
+    memset(q, 0, sizeof(fvsched));
+    fvarena_init(&(q->mem), 0);
+
+    return(FM_OK);
+}
+
+/*
+ * Add a product to be validated by session prod, a new shard is started
+ * if the current is closed, full or for another session.
+ */
+int fvsched_add(fvsched *q, int prod, char *path) {
+
+    char *where="fvsched_add";
+    char **tp;
+    fvshard *ts, *sh;
+
+    if (q->nitems == q->maxitems) {
+        tp = (char **) realloc(q->path,
+                (q->maxitems+FMSTRING1024)*sizeof(char *));
+        if (!tp) {
+            fmerrmsg(where,"Could not allocate product list");
+            return(FM_MEMALL_ERR);
+        }
+        q->path = tp;
+        q->maxitems += FMSTRING1024;
+    }
+    q->path[q->nitems] = fvarena_strdup(&(q->mem), path);
+    if (!q->path[q->nitems]) {
+        fmerrmsg(where,"Could not allocate product list");
+        return(FM_MEMALL_ERR);
+    }
+
+    sh = (q->nshards > 0) ? &(q->shard[q->nshards-1]) : NULL;
+    if (!q->open || !sh || sh->prod != prod || sh->n >= FV_SHARDFILES) {
+        if (q->nshards == q->maxshards) {
+            ts = (fvshard *) realloc(q->shard,
+                    (q->maxshards+FMSTRING256)*sizeof(fvshard));
+            if (!ts) {
+                fmerrmsg(where,"Could not allocate shards");
+                return(FM_MEMALL_ERR);
+            }
+            q->shard = ts;
+            q->maxshards += FMSTRING256;
+        }
+        sh = &(q->shard[q->nshards++]);
+        memset(sh, 0, sizeof(fvshard));
+        sh->prod = prod;
+        sh->first = q->nitems;
+        q->open = 1;
+    }
+    sh->n++;
+    q->nitems++;
+
+    return(FM_OK);
+}
+
+/*
+ * End the current shard, e.g. at the end of a directory listing.
+ */
+void fvsched_cut(fvsched *q) {
+
+    q->open = 0;
+}
+
+/*
+ * Keep part (0 to nparts-1) of nparts contiguous parts of the shards.
+ * The parts only depend on the products collected, so runs
+ * listing the same archive select disjoint parts covering all.
+ */
+int fvsched_select(fvsched *q, int part, int nparts) {
+
+    int first, last;
+
+    if (nparts < 1 || part < 0 || part >= nparts) return(FM_IO_ERR);
+    first = (int) ((long) part*q->nshards/nparts);
+    last = (int) ((long) (part+1)*q->nshards/nparts);
+    if (first > 0) {
+        memmove(q->shard, &(q->shard[first]), (last-first)*sizeof(fvshard));
+    }
+    q->nshards = last-first;
+    q->open = 0;
+
+    return(FM_OK);
+}
+
+void fvsched_free(fvsched *q) {
+
+    int i;
+
+    for (i=0; i<q->nshards; i++) {
+        if (q->shard[i].buf) free(q->shard[i].buf);
+    }
+    if (q->shard) free(q->shard);
+    if (q->path) free(q->path);
+    fvarena_free(&(q->mem));
+    memset(q, 0, sizeof(fvsched));
+}
+
+/*
+ * Next shard for thread id, from its own range or stolen from the end of
+ * the largest range left. Returns -1 when all are taken.
+ */
+static int fvsched_take(fvpool *pool, int id) {
+
+    int i, victim, left, best;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->stop) {
+        pthread_mutex_unlock(&(pool->lock));
+        return(-1);
+    }
+    if (pool->range[id].next < pool->range[id].end) {
+        i = pool->range[id].next++;
+        pthread_mutex_unlock(&(pool->lock));
+        return(i);
+    }
+    victim = -1;
+    best = 0;
+    for (i=0; i<pool->nthreads; i++) {
+        left = pool->range[i].end-pool->range[i].next;
+        if (left > best) {
+            best = left;
+            victim = i;
+        }
+    }
+    i = (victim < 0) ? -1 : --(pool->range[victim].end);
+    pthread_mutex_unlock(&(pool->lock));
+
+    return(i);
+}
+
+static void *fvsched_worker(void *arg) {
+
+    char *where="fvsched_worker";
+    fvworker *wk = (fvworker *) arg;
+    fvpool *pool = wk->pool;
+    fvsession *s;
+    fvshard *sh;
+    fvprefetch pf;
+    FILE *mfp;
+    int i, j, status;
+
+    while ((i = fvsched_take(pool, wk->id)) >= 0) {
+        sh = &(pool->q->shard[i]);
+        s = pool->ws[wk->id*pool->nprod+sh->prod];
+        status = FM_OK;
+        mfp = open_memstream(&(sh->buf), &(sh->len));
+        if (!mfp) {
+            fmerrmsg(where,"Could not open memory stream for shard %d", i);
+            status = FM_MEMALL_ERR;
+        } else {
+            fluxval_session_set_output(s, mfp);
+            fvprefetch_start(&pf, s, NULL, &(pool->q->path[sh->first]),
+                    sh->n, pool->q->prefetch);
+            for (j=sh->first; j<sh->first+sh->n; j++) {
+                fvprefetch_current(&pf, j-sh->first);
+                status = fluxval_process_product(s, pool->q->path[j]);
+                if (status != FM_OK) {
+                    fmerrmsg(where,"Could not process %s", pool->q->path[j]);
+                    break;
+                }
+            }
+            runstats_count(&(s->rs), RC_BYTESPREFETCHED, 
+                    fvprefetch_stop(&pf));
+            fclose(mfp);
+            fluxval_session_set_output(s, stdout);
+        }
+        pthread_mutex_lock(&(pool->lock));
+        runstats_merge(&(pool->work[sh->prod]), &(s->rs));
+        memset(s->rs.elapsed, 0, sizeof(s->rs.elapsed));
+        memset(s->rs.calls, 0, sizeof(s->rs.calls));
+        memset(s->rs.count, 0, sizeof(s->rs.count));
+        sh->status = status;
+        sh->done = 1;
+        pthread_cond_broadcast(&(pool->done));
+        pthread_mutex_unlock(&(pool->lock));
+    }
+
+    return(NULL);
+}
+
+/*
+ * Write the reports of the run requested by SIGUSR1, holding the work of
+ * the shards completed.
+ */
+static void fvsched_report(fvpool *pool, fvsession **sp) {
+
+    int k;
+    runstats rs;
+
+    for (k=0; k<pool->nprod; k++) {
+        pthread_mutex_lock(&(pool->lock));
+        rs = sp[k]->rs;
+        runstats_merge(&rs, &(pool->work[k]));
+        pthread_mutex_unlock(&(pool->lock));
+        runstats_report(&rs, pool->q->report ? pool->q->report[k] : NULL);
+    }
+}
+
+/*
+ * Validate the products collected using nthreads threads with sessions
+ * cloned from sp (one per product) and append the matchups to fp (one
+ * per product). Timing, counters and comparison statistics of the
+ * threads are added to the sessions in sp.
+ */
+int fvsched_run(fvsched *q, fvsession **sp, int nprod, int nthreads,
+        FILE **fp) {
+
+    char *where="fvsched_run";
+    int i, k, w, status = FM_OK;
+    struct timespec ts;
+    fvpool pool;
+    fvworker *wk;
+    fvshard *sh;
+    pthread_t *tid;
+
+    if (q->nshards == 0) return(FM_OK);
+    if (nthreads > q->nshards) nthreads = q->nshards;
+    fmlogmsg(where,"Validating %d products in %d shards using %d threads",
+            q->nitems, q->nshards, nthreads);
+
+    memset(&pool, 0, sizeof(fvpool));
+    pool.q = q;
+    pool.nprod = nprod;
+    pool.nthreads = nthreads;
+    pool.ws = (fvsession **) calloc(nthreads*nprod, sizeof(fvsession *));
+    pool.range = (fvrange *) calloc(nthreads, sizeof(fvrange));
+    pool.work = (runstats *) calloc(nprod, sizeof(runstats));
+    wk = (fvworker *) calloc(nthreads, sizeof(fvworker));
+    tid = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+    if (!pool.ws || !pool.range || !pool.work || !wk || !tid) {
+        fmerrmsg(where,"Could not allocate threads");
+        status = FM_MEMALL_ERR;
+        goto cleanup;
+    }
+
+    /*
+     * Sessions per thread, the products of a thread share observations.
+     */
+    for (w=0; w<nthreads; w++) {
+        for (k=0; k<nprod; k++) {
+            pool.ws[w*nprod+k] = fluxval_session_clone(sp[k]);
+            if (!pool.ws[w*nprod+k] || (k > 0 &&
+                        fluxval_session_share_obs(pool.ws[w*nprod+k],
+                            pool.ws[w*nprod]) != FM_OK)) {
+                fmerrmsg(where,"Could not create sessions for threads");
+                status = FM_MEMALL_ERR;
+                goto cleanup;
+            }
+        }
+        pool.range[w].next = (int) ((long) w*q->nshards/nthreads);
+        pool.range[w].end = (int) ((long) (w+1)*q->nshards/nthreads);
+    }
+
+    pthread_mutex_init(&(pool.lock), NULL);
+    pthread_cond_init(&(pool.done), NULL);
+    for (w=0; w<nthreads; w++) {
+        wk[w].pool = &pool;
+        wk[w].id = w;
+        if (pthread_create(&(tid[w]), NULL, fvsched_worker, &(wk[w]))) {
+            fmerrmsg(where,"Could not start thread %d", w);
+            pthread_mutex_lock(&(pool.lock));
+            pool.stop = 1;
+            pthread_mutex_unlock(&(pool.lock));
+            nthreads = w;
+            status = FM_MEMALL_ERR;
+            break;
+        }
+    }
+
+    /*
+     * Write the shards in order as they are completed, reports are
+     * written while waiting.
+     */
+    for (i=0; i<q->nshards && status == FM_OK; i++) {
+        sh = &(q->shard[i]);
+        pthread_mutex_lock(&(pool.lock));
+        while (!sh->done) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += FV_POLLSECONDS;
+            pthread_cond_timedwait(&(pool.done), &(pool.lock), &ts);
+            if (!sh->done && runstats_requested()) {
+                pthread_mutex_unlock(&(pool.lock));
+                fvsched_report(&pool, sp);
+                pthread_mutex_lock(&(pool.lock));
+            }
+        }
+        pthread_mutex_unlock(&(pool.lock));
+        if (sh->len > 0 && fwrite(sh->buf, 1, sh->len, fp[sh->prod])
+                != sh->len) {
+            fmerrmsg(where,"Could not write matchups");
+            sh->status = FM_IO_ERR;
+        }
+        free(sh->buf);
+        sh->buf = NULL;
+        if (sh->status != FM_OK) {
+            status = sh->status;
+            pthread_mutex_lock(&(pool.lock));
+            pool.stop = 1;
+            pthread_mutex_unlock(&(pool.lock));
+        }
+    }
+
+    for (w=0; w<nthreads; w++) pthread_join(tid[w], NULL);
+    pthread_cond_destroy(&(pool.done));
+    pthread_mutex_destroy(&(pool.lock));
+
+    /*
+     * Add the work of the threads to the sessions of the run.
+     */
+    for (k=0; k<nprod; k++) {
+        runstats_merge(&(sp[k]->rs), &(pool.work[k]));
+    }
+    for (w=0; w<pool.nthreads; w++) {
+        for (k=0; k<nprod; k++) {
+            fvsession *ws = pool.ws[w*nprod+k];
+            runstats_merge(&(sp[k]->rs), &(ws->rs));
+            sp[k]->st.nmatchups += ws->st.nmatchups;
+            sp[k]->st.n += ws->st.n;
+            sp[k]->st.sumdiff += ws->st.sumdiff;
+            sp[k]->st.sumsqdiff += ws->st.sumsqdiff;
+        }
+    }
+
+cleanup:
+    if (pool.ws) {
+        for (i=0; i<pool.nthreads*nprod; i++) {
+            fluxval_session_free(pool.ws[i]);
+        }
+        free(pool.ws);
+    }
+    if (pool.range) free(pool.range);
+    if (pool.work) free(pool.work);
+    if (wk) free(wk);
+    if (tid) free(tid);
+
+    return(status);
+}
@@ -0,0 +1,75 @@
+/*
+ * NAME:
+ * fluxval_sched.h
+ *
+ * PURPOSE:
+ * Header file for parallel validation of the products of a run.
+ *
+ * NOTES:
+ * See fluxval_sched.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_SCHED_H
+#define _FLUXVAL_SCHED_H
+
+#include <stdio.h>
+#include <fluxval_api.h>
+#include <fluxval_arena.h>
+
+#define FV_SHARDFILES 8	/* Products per shard at most */
+
+/*
+ * Consecutive products of one product type (session), validated by one
+ * thread. The matchups are held in buf until written in order.
+ */
+typedef struct {
+    int prod;
+    int first;
+    int n;
+    char *buf;
+    size_t len;
+    int status;
+    short done;
+} fvshard;
+
+/*
+ * Products of a run in the order of a serial run, split into shards.
+ */
+typedef struct {
+    int nitems;
+    int maxitems;
+    char **path;
+    int nshards;
+    int maxshards;
+    fvshard *shard;
+    short open;			/* Last shard takes more products */
+    int prefetch;		/* Products read ahead by each thread */
+    char **report;		/* Report per session for SIGUSR1, or NULL */
+    fvarena mem;		/* Holds the filenames */
+} fvsched;
+
+/*
+ * Function prototypes.
+ */
+int fvsched_init(fvsched *q);
+int fvsched_add(fvsched *q, int prod, char *path);
+void fvsched_cut(fvsched *q);
+int fvsched_select(fvsched *q, int part, int nparts);
+int fvsched_run(fvsched *q, fvsession **sp, int nprod, int nthreads,
+        FILE **fp);
+void fvsched_free(fvsched *q);
+
+#endif /* _FLUXVAL_SCHED_H */
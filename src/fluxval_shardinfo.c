@@ -0,0 +1,143 @@
+/*
+ * NAME:
+ * fluxval_shardinfo.c
+ *
+ * PURPOSE:
+ * To describe the output of a shard (part of a period processed by one
+ * run of fluxval --shard) so that the shards can be merged and checked
+ * by fluxval_shardmerge.
+ *
+ * NOTES:
+ * The description is written next to the output file, with the suffix
+ * FV_SHARDSUFFIX, as lines of keyword and value:
+ *   shard <index> <nshards>
+ *   product <product>
+ *   offset <first byte written by this run>
+ *   bytes <bytes written by this run>
+ *   crc32 <CRC-32 of these bytes, hexadecimal>
+ *   nmatchups, n, sumdiff, sumsqdiff <comparison statistics>
+ * Statistics are written with full precision so that merged values equal
+ * those of a single run. Unknown keywords are ignored when reading.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o zlib (crc32)
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <string.h>
+#include <zlib.h>
+#include <fluxval_shardinfo.h>
+
+/*
+ * CRC-32 of bytes bytes of fp starting at offset.
+ */
+int fvshardinfo_crc(FILE *fp, long offset, long bytes, unsigned long *crc) {
+
+    char *where="fvshardinfo_crc";
+    unsigned char buf[FMSTRING1024*64];
+    size_t n, want;
+    uLong c;
+
+    if (fseek(fp, offset, SEEK_SET) != 0) {
+        fmerrmsg(where,"Could not seek to %ld", offset);
+        return(FM_IO_ERR);
+    }
+    c = crc32(0L, Z_NULL, 0);
+    while (bytes > 0) {
+        want = (bytes > (long) sizeof(buf)) ? sizeof(buf) : (size_t) bytes;
+        n = fread(buf, 1, want, fp);
+        if (n != want) {
+            fmerrmsg(where,"File ended %ld bytes early", bytes);
+            return(FM_IO_ERR);
+        }
+        c = crc32(c, buf, (uInt) n);
+        bytes -= n;
+    }
+    *crc = (unsigned long) c;
+
+    return(FM_OK);
+}
+
+int fvshardinfo_write(char *filename, fvshardinfo *si) {
+
+    char *where="fvshardinfo_write";
+    FILE *fp;
+
+    fp = fopen(filename,"w");
+    if (!fp) {
+        fmerrmsg(where,"Could not open %s", filename);
+        return(FM_IO_ERR);
+    }
+    fprintf(fp,"shard %d %d\n", si->index, si->nshards);
+    fprintf(fp,"product %s\n", si->product);
+    fprintf(fp,"offset %ld\n", si->offset);
+    fprintf(fp,"bytes %ld\n", si->bytes);
+    fprintf(fp,"crc32 %08lx\n", si->crc);
+    fprintf(fp,"nmatchups %ld\n", si->nmatchups);
+    fprintf(fp,"n %ld\n", si->n);
+    fprintf(fp,"sumdiff %.17g\n", si->sumdiff);
+    fprintf(fp,"sumsqdiff %.17g\n", si->sumsqdiff);
+    if (fclose(fp) != 0) {
+        fmerrmsg(where,"Could not write %s", filename);
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+int fvshardinfo_read(char *filename, fvshardinfo *si) {
+
+    char *where="fvshardinfo_read";
+    char line[FMSTRING256], key[FMSTRING64];
+    int nkeys = 0;
+    FILE *fp;
+
+    memset(si, 0, sizeof(fvshardinfo));
+    si->index = -1;
+    fp = fopen(filename,"r");
+    if (!fp) {
+        fmerrmsg(where,"Could not open %s", filename);
+        return(FM_IO_ERR);
+    }
+    while (fgets(line, FMSTRING256, fp)) {
+        if (sscanf(line,"%63s",key) != 1) continue;
+        if (strcmp(key,"shard") == 0) {
+            nkeys += (sscanf(line,"%*s %d %d",
+                        &(si->index),&(si->nshards)) == 2);
+        } else if (strcmp(key,"product") == 0) {
+            nkeys += (sscanf(line,"%*s %15s",si->product) == 1);
+        } else if (strcmp(key,"offset") == 0) {
+            nkeys += (sscanf(line,"%*s %ld",&(si->offset)) == 1);
+        } else if (strcmp(key,"bytes") == 0) {
+            nkeys += (sscanf(line,"%*s %ld",&(si->bytes)) == 1);
+        } else if (strcmp(key,"crc32") == 0) {
+            nkeys += (sscanf(line,"%*s %lx",&(si->crc)) == 1);
+        } else if (strcmp(key,"nmatchups") == 0) {
+            sscanf(line,"%*s %ld",&(si->nmatchups));
+        } else if (strcmp(key,"n") == 0) {
+            sscanf(line,"%*s %ld",&(si->n));
+        } else if (strcmp(key,"sumdiff") == 0) {
+            sscanf(line,"%*s %lf",&(si->sumdiff));
+        } else if (strcmp(key,"sumsqdiff") == 0) {
+            sscanf(line,"%*s %lf",&(si->sumsqdiff));
+        }
+    }
+    fclose(fp);
+    if (nkeys != 5 || si->index < 0 || si->nshards < 1 ||
+            si->index >= si->nshards) {
+        fmerrmsg(where,"%s is not a valid shard description", filename);
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
@@ -0,0 +1,59 @@
+/*
+ * NAME:
+ * fluxval_shardinfo.h
+ *
+ * PURPOSE:
+ * Header file for the description of shard output files, used to merge
+ * the output of runs processing parts of a period (fluxval --shard).
+ *
+ * NOTES:
+ * See fluxval_shardinfo.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_SHARDINFO_H
+#define _FLUXVAL_SHARDINFO_H
+
+#include <stdio.h>
+#include <fmutil.h>
+
+#define FV_SHARDSUFFIX ".shard"
+
+/*
+ * Part of an output file written by shard index of nshards. The
+ * matchups are the bytes from offset, crc is the CRC-32 of these. The
+ * comparison statistics are those of fvstats.
+ */
+typedef struct {
+    int index;
+    int nshards;
+    char product[FMSTRING16];
+    long offset;
+    long bytes;
+    unsigned long crc;
+    long nmatchups;
+    long n;
+    double sumdiff;
+    double sumsqdiff;
+} fvshardinfo;
+
+/*
+ * Function prototypes.
+ */
+int fvshardinfo_crc(FILE *fp, long offset, long bytes, unsigned long *crc);
+int fvshardinfo_write(char *filename, fvshardinfo *si);
+int fvshardinfo_read(char *filename, fvshardinfo *si);
+
+#endif /* _FLUXVAL_SHARDINFO_H */
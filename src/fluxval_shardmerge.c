@@ -0,0 +1,220 @@
+/*
+ * NAME:
+ * fluxval_shardmerge.c
+ *
+ * PURPOSE:
+ * To merge the output of runs of fluxval each validating a part (shard)
+ * of the products of a period (fluxval --shard i/N) into the output a
+ * single run would have produced.
+ *
+ * NOTES:
+ * Each shard output is described by <output>.shard (see
+ * fluxval_shardinfo.c). All N parts of one product must be given, in any
+ * order. The checksums of all parts are verified before anything is
+ * written, the parts are then appended to the output in order.
+ *
+ * The merged output is described by <output>.shard as part 0 of 1, with
+ * the statistics accumulated over the parts, so merged outputs can be
+ * verified and merged further in the same way. The statistics equal
+ * those of a single run except for rounding in the last digits as the
+ * sums are formed per part.
+ *
+ * Only plain files are used, the shards can be written by runs on
+ * different nodes to a shared file system.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ * o zlib (crc32)
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fmutil.h>
+#include <fluxval_shardinfo.h>
+
+void usage_shardmerge(void);
+
+int main(int argc, char *argv[]) {
+
+    extern char *optarg;
+    extern int optind;
+    char *where="fluxval_shardmerge";
+    char *outfile = NULL, **part;
+    char infofile[FMSTRING1024], buf[FMSTRING1024*64];
+    int i, j, n, nparts, *pos;
+    long left;
+    size_t got;
+    unsigned long crc;
+    fvshardinfo *si, merged;
+    FILE *fp, *ofp;
+
+    while ((i = getopt(argc, argv, "o:")) != EOF) {
+        switch (i) {
+            case 'o':
+                outfile = optarg;
+                break;
+            default:
+                usage_shardmerge();
+                break;
+        }
+    }
+    if (!outfile || optind >= argc) usage_shardmerge();
+    n = argc-optind;
+    part = &(argv[optind]);
+
+    si = (fvshardinfo *) calloc(n, sizeof(fvshardinfo));
+    pos = (int *) calloc(n, sizeof(int));
+    if (!si || !pos) {
+        fmerrmsg(where,"Could not allocate shard descriptions");
+        exit(FM_MEMALL_ERR);
+    }
+
+    /*
+     * Check that the parts belong together and that all are present.
+     */
+    for (i=0; i<n; i++) {
+        if (snprintf(infofile,FMSTRING1024,"%s%s",part[i],FV_SHARDSUFFIX)
+                >= FMSTRING1024) {
+            fmerrmsg(where,"File name %s is too long", part[i]);
+            exit(FM_IO_ERR);
+        }
+        if (fvshardinfo_read(infofile, &(si[i])) != FM_OK) exit(FM_IO_ERR);
+    }
+    nparts = si[0].nshards;
+    if (n != nparts) {
+        fmerrmsg(where,"%d parts given, the run was split in %d", n, nparts);
+        exit(FM_IO_ERR);
+    }
+    for (i=0; i<n; i++) {
+        if (si[i].nshards != nparts || strcmp(si[i].product,si[0].product)) {
+            fmerrmsg(where,"%s does not belong to the same run as %s",
+                    part[i], part[0]);
+            exit(FM_IO_ERR);
+        }
+        if (pos[si[i].index]) {
+            fmerrmsg(where,"Part %d given twice", si[i].index);
+            exit(FM_IO_ERR);
+        }
+        pos[si[i].index] = i+1;
+    }
+
+    /*
+     * Verify the checksums before writing.
+     */
+    for (j=0; j<nparts; j++) {
+        i = pos[j]-1;
+        fp = fopen(part[i],"r");
+        if (!fp) {
+            fmerrmsg(where,"Could not open %s", part[i]);
+            exit(FM_IO_ERR);
+        }
+        if (fvshardinfo_crc(fp, si[i].offset, si[i].bytes, &crc)
+                != FM_OK || crc != si[i].crc) {
+            fmerrmsg(where,"Checksum of %s does not match its description",
+                    part[i]);
+            fclose(fp);
+            exit(FM_IO_ERR);
+        }
+        fclose(fp);
+    }
+
+    /*
+     * Append the parts in order.
+     */
+    ofp = fopen(outfile,"a");
+    if (!ofp) {
+        fmerrmsg(where,"Could not open %s", outfile);
+        exit(FM_IO_ERR);
+    }
+    fseek(ofp, 0, SEEK_END);
+    memset(&merged, 0, sizeof(fvshardinfo));
+    merged.index = 0;
+    merged.nshards = 1;
+    snprintf(merged.product,FMSTRING16,"%s",si[0].product);
+    merged.offset = ftell(ofp);
+    for (j=0; j<nparts; j++) {
+        i = pos[j]-1;
+        fp = fopen(part[i],"r");
+        if (!fp || fseek(fp, si[i].offset, SEEK_SET) != 0) {
+            fmerrmsg(where,"Could not read %s", part[i]);
+            exit(FM_IO_ERR);
+        }
+        for (left=si[i].bytes; left>0; left-=got) {
+            got = fread(buf, 1,
+                    (left > (long) sizeof(buf)) ? sizeof(buf) : (size_t) left,
+                    fp);
+            if (got == 0 || fwrite(buf, 1, got, ofp) != got) {
+                fmerrmsg(where,"Could not copy %s", part[i]);
+                exit(FM_IO_ERR);
+            }
+        }
+        fclose(fp);
+        merged.bytes += si[i].bytes;
+        merged.nmatchups += si[i].nmatchups;
+        merged.n += si[i].n;
+        merged.sumdiff += si[i].sumdiff;
+        merged.sumsqdiff += si[i].sumsqdiff;
+    }
+    if (fclose(ofp) != 0) {
+        fmerrmsg(where,"Could not write %s", outfile);
+        exit(FM_IO_ERR);
+    }
+
+    /*
+     * Describe the merged output.
+     */
+    fp = fopen(outfile,"r");
+    if (!fp || fvshardinfo_crc(fp, merged.offset, merged.bytes,
+                &(merged.crc)) != FM_OK) {
+        fmerrmsg(where,"Could not verify %s", outfile);
+        exit(FM_IO_ERR);
+    }
+    fclose(fp);
+    if (snprintf(infofile,FMSTRING1024,"%s%s",outfile,FV_SHARDSUFFIX)
+            >= FMSTRING1024) {
+        fmerrmsg(where,"File name %s is too long", outfile);
+        exit(FM_IO_ERR);
+    }
+    if (fvshardinfo_write(infofile, &merged) != FM_OK) exit(FM_IO_ERR);
+
+    if (merged.n > 0) {
+        fmlogmsg(where,
+                "%s: %d parts, %ld bytes, crc32 %08lx, %ld matchups, "
+                "bias %.2f, rmse %.2f", merged.product, nparts, merged.bytes,
+                merged.crc, merged.nmatchups, merged.sumdiff/merged.n,
+                sqrt(merged.sumsqdiff/merged.n));
+    } else {
+        fmlogmsg(where,"%s: %d parts, %ld bytes, crc32 %08lx, %ld matchups",
+                merged.product, nparts, merged.bytes, merged.crc,
+                merged.nmatchups);
+    }
+    free(si);
+    free(pos);
+
+    exit(FM_OK);
+}
+
+void usage_shardmerge(void) {
+
+    fprintf(stdout,"\n");
+    fprintf(stdout," fluxval_shardmerge -o <output> <part> [<part> ...]\n");
+    fprintf(stdout,"     -o output: file to append the merged parts to\n");
+    fprintf(stdout,"     part: output of fluxval --shard i/N, all N parts\n");
+    fprintf(stdout,"        of a run are required\n");
+    fprintf(stdout,"\n");
+
+    exit(FM_OK);
+}
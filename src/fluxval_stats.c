@@ -0,0 +1,205 @@
+/*
+ * NAME:
+ * fluxval_stats.c
+ *
+ * PURPOSE:
+ * To time the processing stages of fluxval and count files, bytes,
+ * stations and matchups processed. The result is dumped as JSON at the
+ * end of the run or when the process receives SIGUSR1, making it possible
+ * to see where the time is spent in long running jobs.
+ *
+ * NOTES:
+ * Timing uses the monotonic clock and costs two clock_gettime calls per
+ * stage entered. The signal handler only sets a flag, the report is
+ * written the next time runstats_poll is called from the processing
+ * loop.
+ *
+ * If no report file is given, the report is written to stderr.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 1 - i/o problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval_stats.h>
+#include <string.h>
+
+static char *stagenames[RS_NSTAGES] = {
+    "dirlist", "readprod", "cmconv", "extract", 
+    "readobs", "colloc", "output"
+};
+
+static char *countnames[RC_NCOUNTERS] = {
+    "files_scanned", "files_skipped", "files_read", "files_without_obs",
+    "bytes_read",
+    "stations_hit", "stations_missed", "obs_months_read", "matchups_written",
+    "bytes_prefetched", "band_bytes_skipped", "cube_bytes"
+};
+
+static volatile sig_atomic_t reportrequested = 0;
+
+static double tsdiff(struct timespec *t1, struct timespec *t0) {
+    return((double) (t1->tv_sec-t0->tv_sec)+
+            1.e-9*(double) (t1->tv_nsec-t0->tv_nsec));
+}
+
+int runstats_init(runstats *rs) {
+
+    memset(rs, 0, sizeof(runstats));
+    clock_gettime(CLOCK_MONOTONIC, &(rs->t0));
+
+    return(FM_OK);
+}
+
+void runstats_start(runstats *rs, rsstage st) {
+
+    clock_gettime(CLOCK_MONOTONIC, &(rs->started[st]));
+}
+
+void runstats_stop(runstats *rs, rsstage st) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rs->elapsed[st] += tsdiff(&now, &(rs->started[st]));
+    rs->calls[st]++;
+}
+
+void runstats_count(runstats *rs, rscounter c, long long n) {
+
+    rs->count[c] += n;
+}
+
+/*
+ * Add the stage timings and counters of rs to those of total, e.g. from
+ * sessions processing in parallel. Stage times are then summed over
+ * threads while the elapsed time of the run is kept from total.
+ */
+void runstats_merge(runstats *total, runstats *rs) {
+
+    int i;
+
+    for (i=0; i<RS_NSTAGES; i++) {
+        total->elapsed[i] += rs->elapsed[i];
+        total->calls[i] += rs->calls[i];
+    }
+    for (i=0; i<RC_NCOUNTERS; i++) {
+        total->count[i] += rs->count[i];
+    }
+}
+
+/*
+ * Write the report as JSON. The file is written to a temporary name and
+ * renamed to avoid readers seeing partial reports.
+ */
+int runstats_report(runstats *rs, char *filename) {
+
+    char *where="runstats_report";
+    char tmpfile[FMSTRING1024];
+    int i;
+    double total;
+    struct timespec now;
+    FILE *fp;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    total = tsdiff(&now, &(rs->t0));
+
+    if (filename) {
+        snprintf(tmpfile,FMSTRING1024,"%s.tmp",filename);
+        fp = fopen(tmpfile,"w");
+        if (!fp) {
+            fmerrmsg(where,"Could not open %s", tmpfile);
+            return(FM_IO_ERR);
+        }
+    } else {
+        fp = stderr;
+    }
+
+    fprintf(fp,"{\n");
+    fprintf(fp,"  \"elapsed_seconds\": %.6f,\n", total);
+    fprintf(fp,"  \"stages\": {\n");
+    for (i=0; i<RS_NSTAGES; i++) {
+        fprintf(fp,"    \"%s\": {\"seconds\": %.6f, \"calls\": %ld}%s\n",
+                stagenames[i], rs->elapsed[i], rs->calls[i],
+                (i < RS_NSTAGES-1) ? "," : "");
+    }
+    fprintf(fp,"  },\n");
+    fprintf(fp,"  \"counters\": {\n");
+    for (i=0; i<RC_NCOUNTERS; i++) {
+        fprintf(fp,"    \"%s\": %lld%s\n",
+                countnames[i], rs->count[i],
+                (i < RC_NCOUNTERS-1) ? "," : "");
+    }
+    fprintf(fp,"  }\n");
+    fprintf(fp,"}\n");
+
+    if (filename) {
+        if (fclose(fp)) {
+            fmerrmsg(where,"Could not write %s", tmpfile);
+            return(FM_IO_ERR);
+        }
+        if (rename(tmpfile, filename)) {
+            fmerrmsg(where,"Could not rename %s to %s", tmpfile, filename);
+            return(FM_IO_ERR);
+        }
+    } else {
+        fflush(fp);
+    }
+
+    return(FM_OK);
+}
+
+static void runstats_handler(int sig) {
+
+    reportrequested = 1;
+}
+
+/*
+ * Install handler making SIGUSR1 request a report.
+ */
+int runstats_catch_signal(void) {
+
+    char *where="runstats_catch_signal";
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = runstats_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &sa, NULL)) {
+        fmerrmsg(where,"Could not install handler for SIGUSR1");
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Returns 1 if a report was requested through SIGUSR1 since last call,
+ * e.g. to report several sessions.
+ */
+int runstats_requested(void) {
+
+    if (!reportrequested) return(0);
+    reportrequested = 0;
+
+    return(1);
+}
+
+/*
+ * Write the report if requested through SIGUSR1 since last call.
+ */
+int runstats_poll(runstats *rs, char *filename) {
+
+    if (!runstats_requested()) return(FM_OK);
+
+    return(runstats_report(rs, filename));
+}
@@ -0,0 +1,88 @@
+/*
+ * NAME:
+ * fluxval_stats.h
+ * 
+ * PURPOSE:
+ * Header file for timing and counting of the processing stages of
+ * fluxval.
+ *
+ * NOTES:
+ * See fluxval_stats.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 1 - i/o problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_STATS_H
+#define _FLUXVAL_STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <signal.h>
+#include <fmutil.h>
+
+/*
+ * Processing stages timed. Remember to update stagenames in
+ * fluxval_stats.c if changed.
+ */
+typedef enum {
+    RS_DIRLIST,		/* Listing of product directories */
+    RS_READPROD,	/* Reading of product headers and bands */
+    RS_CMCONV,		/* Cloud mask box, extraction and conversion */
+    RS_EXTRACT,		/* return_product_area and averaging */
+    RS_READOBS,		/* Reading of observations */
+    RS_COLLOC,		/* Search for collocated observations */
+    RS_OUTPUT,		/* Writing of matchups */
+    RS_NSTAGES
+} rsstage;
+
+/*
+ * Counters. Remember to update countnames in fluxval_stats.c if changed.
+ */
+typedef enum {
+    RC_FILESSCANNED,	/* Directory entries examined */
+    RC_FILESSKIPPED,	/* Entries not matching the product requested */
+    RC_FILESREAD,	/* Products read */
+    RC_FILESNOOBS,	/* Products skipped, no observations collocated */
+    RC_BYTESREAD,	/* Size of products read */
+    RC_STATIONSHIT,	/* Stations with valid product data */
+    RC_STATIONSMISSED,	/* Stations without valid product data */
+    RC_OBSFILES,	/* Observation months read */
+    RC_MATCHUPS,	/* Matchups written */
+    RC_BYTESPREFETCHED,	/* Size of products read ahead */
+    RC_BANDBYTESSKIPPED,	/* Size of product bands not decoded */
+    RC_CUBEBYTES,	/* Size of patch cube records written or read */
+    RC_NCOUNTERS
+} rscounter;
+
+typedef struct {
+    double elapsed[RS_NSTAGES];
+    long calls[RS_NSTAGES];
+    struct timespec started[RS_NSTAGES];
+    long long count[RC_NCOUNTERS];
+    struct timespec t0;
+} runstats;
+
+/*
+ * Function prototypes.
+ */
+int runstats_init(runstats *rs);
+void runstats_start(runstats *rs, rsstage st);
+void runstats_stop(runstats *rs, rsstage st);
+void runstats_count(runstats *rs, rscounter c, long long n);
+void runstats_merge(runstats *total, runstats *rs);
+int runstats_report(runstats *rs, char *filename);
+int runstats_catch_signal(void);
+int runstats_requested(void);
+int runstats_poll(runstats *rs, char *filename);
+
+#endif /* _FLUXVAL_STATS_H */
@@ -12,6 +12,9 @@
  * containing the number of stations in the first line, then station name,
  * number, latitude and longitude on the subsequent lines...
  *
+ * Station entries and names are allocated in one region (mem) which is
+ * released by clear_stlist.
+ *
  * BUGS:
  * Proper typechecking of input data is not performed yet...
  *
@@ -37,6 +40,7 @@
 #include <fluxval_readobs.h>
 
 int decode_stlist(char *filename, stlist *stl) {
+    char *where="decode_stlist";
     char *dummy;
     int size, i;
     FILE *fp;
@@ -45,20 +49,30 @@ int decode_stlist(char *filename, stlist *stl) {
     if (!dummy) return(2);
 
     fp = fopen(filename,"r");
-    if (!fp) return(1);
+    if (!fp) {
+        free(dummy);
+        return(1);
+    }
 
-    if (!fgets(dummy, ST_RECLEN, fp)) return(1);
-    sscanf(dummy,"%d", &size);
-    if (create_stlist(size, stl) != 0) return(3); 
+    if (!fgets(dummy, ST_RECLEN, fp) || sscanf(dummy,"%d", &size) != 1) {
+        fclose(fp);
+        free(dummy);
+        return(1);
+    }
+    if (create_stlist(size, stl) != 0) {
+        fclose(fp);
+        free(dummy);
+        return(3); 
+    }
     stl->cnt = size; 
 
     i = 0;
-    printf(" Using stations:\n");
-    while (fgets(dummy,ST_RECLEN,fp)) {
-        sscanf(dummy,"%s%d%f%f",
+    fvlog(FV_LOG_INFO, where,"Using %d stations", size);
+    while (i < size && fgets(dummy,ST_RECLEN,fp)) {
+        sscanf(dummy,"%19s%d%f%f",
                 stl->id[i].name,&(stl->id[i].number),
                 &(stl->id[i].lat),&(stl->id[i].lon));
-        printf(" %s %d %.2f %.2f\n", 
+        fvlog(FV_LOG_DEBUG, where,"%s %d %.2f %.2f", 
                 stl->id[i].name,stl->id[i].number,
                 stl->id[i].lat,stl->id[i].lon);
         i++;
@@ -74,24 +88,28 @@ int decode_stlist(char *filename, stlist *stl) {
 int create_stlist(int size, stlist *pts) {
     int i;
     char *inistr="xxxxxxxxxxxxxxxxxxx\0";
+    char *names;
 
     if (size > 0) {
-        pts->id = (stid *) malloc(size*sizeof(stid));
-        if (!pts->id) return(2);
+        fvarena_init(&(pts->mem), size*(sizeof(stid)+ST_NAMELEN));
+        pts->id = (stid *) fvarena_alloc(&(pts->mem), size*sizeof(stid));
+        names = (char *) fvarena_alloc(&(pts->mem), size*ST_NAMELEN);
+        if (!pts->id || !names) {
+            fvarena_free(&(pts->mem));
+            return(2);
+        }
         pts->cnt = size;
         for (i = 0; i < pts->cnt; i++){
-            pts->id[i].name = (char *) malloc(ST_NAMELEN*sizeof(char));
-            if (!pts->id[i].name) {
-                clear_stlist(pts);
-                return(1);
-            }
+            pts->id[i].name = &names[i*ST_NAMELEN];
             strcpy(pts->id[i].name, inistr);
             pts->id[i].number = 0;
             pts->id[i].lat = -999.0;
             pts->id[i].lon = -999.0;
         }
     } else {
-        clear_stlist(pts);
+        pts->cnt = 0;
+        pts->id = NULL;
+        fvarena_init(&(pts->mem), 0);
     }
     return(FM_OK);
 }
@@ -102,13 +120,19 @@ int copy_stlist(stlist *lhs, stlist *rhs) {
     if (lhs->cnt) clear_stlist(lhs);
 
     if (rhs->cnt) {
-        create_stlist(rhs->cnt, lhs);
+        if (create_stlist(rhs->cnt, lhs) != FM_OK) return(FM_MEMALL_ERR);
 
         for (size = 0;  size < lhs->cnt; size++ ) {
-            lhs->id[size].name = 
-                (char *) malloc(sizeof(char)*strlen(rhs->id[size].name)+1);
-            strcpy(lhs->id[size].name,rhs->id[size].name);
+            if (strlen(rhs->id[size].name) >= ST_NAMELEN) {
+                lhs->id[size].name = 
+                    fvarena_strdup(&(lhs->mem), rhs->id[size].name);
+                if (!lhs->id[size].name) return(FM_MEMALL_ERR);
+            } else {
+                strcpy(lhs->id[size].name,rhs->id[size].name);
+            }
             lhs->id[size].number = rhs->id[size].number;
+            lhs->id[size].lat = rhs->id[size].lat;
+            lhs->id[size].lon = rhs->id[size].lon;
         }
     } else {
         lhs->id = NULL;
@@ -118,16 +142,11 @@ int copy_stlist(stlist *lhs, stlist *rhs) {
 }
 
 int clear_stlist(stlist *pts) { 
-    int i;
 
     if (!pts->cnt) return(FM_MEMALL_ERR);
 
-    for(i = 0; i < pts->cnt; i++) {
-        free(pts->id[i].name);
-    }
-
+    fvarena_free(&(pts->mem));
     pts->cnt = 0;
-    free(pts->id);
     pts->id = NULL;
     return(FM_OK);
 }
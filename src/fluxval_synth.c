@@ -0,0 +1,562 @@
+/*
+ * NAME:
+ * fluxval_synth.c
+ *
+ * PURPOSE:
+ * To generate a synthetic OSISAF-like archive of radiative flux products
+ * in HDF5 together with matching observation files in all formats read by
+ * fluxval. The output is used by the benchmark (fluxval_bench) to measure
+ * the performance of fluxval without access to the production archive and
+ * the observation stores.
+ *
+ * NOTES:
+ * The product grid is centred on the stations in the station list given
+ * and extended with a margin. Resolution, grid size, number of bands,
+ * position of the cloud mask band, number of passages per day and number
+ * of days are configurable. The output directory is organised as:
+ *
+ *   <outdir>/passage/   passage products (<product>_<sat>_<date>_<time>.<area>.hdf5)
+ *   <outdir>/daily/     daily products (<product>_24h_hl_<date>_daily.<area>.hdf5)
+ *   <outdir>/obs/bioforsk/  original Bioforsk format (fluxval default)
+ *   <outdir>/obs/compact/   compact format (-c)
+ *   <outdir>/obs/ulric/     Ulric/KDVH format (-b)
+ *   <outdir>/obs/gts/       WMO GTS format (-w)
+ *
+ * Instead of a station list, a number of stations can be given. These are
+ * then spread regularly over Scandinavia and the list is written to
+ * <outdir>/stlist.txt for use with fluxval.
+ *
+ * The flux fields are smooth analytical functions of position and time
+ * with a small fraction of missing pixels, observations follow the same
+ * diurnal cycle. Values are not physically meaningful.
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 1 - i/o problem
+ * 2 - memory problem
+ *
+ * DEPENDENCIES:
+ * o I/O functions for HDF5 file handling (including libhdf5)
+ * o SAF product definitions
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SYNTH_MISVAL -999.99
+#define SYNTH_MARGIN 64
+#define SYNTH_NSAT 3
+
+static char *satnames[SYNTH_NSAT] = {"noaa18","noaa19","metop02"};
+static char *banddesc[7] = {"SSI","SSI_ST","QF","SOZ","SAZ","RAZ","CM"};
+
+void usage_synth(void);
+static int mkpath(char *path);
+static int synth_stlist(char *outfile, int nst, stlist *stl);
+static float synth_flux(char *product, fmtime t, int i, int j);
+static int synth_product(char *outfile, char *product, char *area,
+        char *source, fmtime t, PRODhead grid, int z, int cmband);
+static int synth_obs(char *obsdir, char *product, stlist stl,
+        int year, int month);
+
+int main(int argc, char *argv[]) {
+
+    extern char *optarg;
+    char *where="fluxval_synth";
+    char *outdir = NULL, *stfile = NULL;
+    char stime[FMSTRING16], product[FMSTRING16], area[FMSTRING16];
+    char dirname[FMSTRING512], fname[FMSTRING1024];
+    int i, k, ndays = 1, npass = 12, nbands = 7, cmband = -2;
+    int iw = 0, ih = 0, nfiles = 0, nst = 0;
+    int lastmonth = 0;
+    float res = 5.;
+    short sflg = 0, oflg = 0, iflg = 0, dflg = 0;
+    double emin, emax, nmin, nmax;
+    fmsec1970 tstart, t;
+    fmtime ft;
+    fmucspos upos;
+    fmgeopos gpos;
+    PRODhead grid;
+    stlist stl;
+
+    sprintf(product,"ssi");
+    sprintf(area,"ns");
+    while ((i = getopt(argc, argv, "ds:n:t:p:g:r:x:y:z:c:i:N:o:")) != EOF) {
+        switch (i) {
+            case 's':
+                if (strlen(optarg) != 10) {
+                    fmerrmsg(where,
+                        "stime (%s) is not of appropriate length", optarg);
+                    exit(FM_IO_ERR);
+                }
+                strcpy(stime,optarg);
+                sflg++;
+                break;
+            case 'n':
+                ndays = atoi(optarg);
+                break;
+            case 't':
+                npass = atoi(optarg);
+                break;
+            case 'p':
+                snprintf(product,FMSTRING16,"%s",optarg);
+                break;
+            case 'g':
+                snprintf(area,FMSTRING16,"%s",optarg);
+                break;
+            case 'r':
+                res = atof(optarg);
+                break;
+            case 'x':
+                iw = atoi(optarg);
+                break;
+            case 'y':
+                ih = atoi(optarg);
+                break;
+            case 'z':
+                nbands = atoi(optarg);
+                break;
+            case 'c':
+                cmband = atoi(optarg);
+                break;
+            case 'i':
+                stfile = optarg;
+                iflg++;
+                break;
+            case 'N':
+                nst = atoi(optarg);
+                break;
+            case 'o':
+                outdir = optarg;
+                oflg++;
+                break;
+            case 'd':
+                dflg++;
+                break;
+            default:
+                usage_synth();
+                break;
+        }
+    }
+    if (!sflg || !oflg || (!iflg && nst <= 0)) usage_synth();
+    if (ndays < 1 || npass < 1 || nbands < 1 || res <= 0.) usage_synth();
+    if (cmband == -2) cmband = (nbands == 7) ? 6 : -1;
+    if (cmband >= nbands) usage_synth();
+
+    if (mkpath(outdir)) exit(FM_IO_ERR);
+    if (!iflg) {
+        sprintf(fname,"%s/stlist.txt",outdir);
+        if (synth_stlist(fname, nst, &stl)) exit(FM_IO_ERR);
+    } else if (decode_stlist(stfile, &stl) != 0) {
+        fmerrmsg(where," Could not decode station file.");
+        exit(FM_IO_ERR);
+    }
+
+    /*
+     * Create a grid covering all stations with a margin.
+     */
+    emin = nmin = 1.e30;
+    emax = nmax = -1.e30;
+    for (k=0; k<stl.cnt; k++) {
+        gpos.lat = stl.id[k].lat;
+        gpos.lon = stl.id[k].lon;
+        upos = fmgeo2ucs(gpos, MI);
+        if (upos.eastings < emin) emin = upos.eastings;
+        if (upos.eastings > emax) emax = upos.eastings;
+        if (upos.northings < nmin) nmin = upos.northings;
+        if (upos.northings > nmax) nmax = upos.northings;
+    }
+    memset(&grid, 0, sizeof(PRODhead));
+    grid.Ax = res;
+    grid.Ay = res;
+    grid.iw = (iw > 0) ? iw : (int) ((emax-emin)/res)+2*SYNTH_MARGIN;
+    grid.ih = (ih > 0) ? ih : (int) ((nmax-nmin)/res)+2*SYNTH_MARGIN;
+    grid.Bx = (float) (0.5*(emin+emax)-0.5*grid.iw*res);
+    grid.By = (float) (0.5*(nmin+nmax)+0.5*grid.ih*res);
+    fmlogmsg(where,"Grid is %d x %d pixels at %.2f resolution",
+            grid.iw, grid.ih, res);
+
+    tstart = ymdh2fmsec1970(stime,0);
+
+    /*
+     * Passage products.
+     */
+    sprintf(dirname,"%s/passage",outdir);
+    if (mkpath(dirname)) exit(FM_IO_ERR);
+    for (i=0; i<ndays*npass; i++) {
+        t = tstart+(fmsec1970) (i*(86400./npass))+17*60;
+        if (tofmtime(t,&ft)) {
+            fmerrmsg(where,"Could not convert time");
+            exit(FM_IO_ERR);
+        }
+        sprintf(fname,"%s/%s_%s_%04d%02d%02d_%02d%02d.%s.hdf5",
+                dirname, product, satnames[i%SYNTH_NSAT],
+                ft.fm_year, ft.fm_mon, ft.fm_mday, ft.fm_hour, ft.fm_min,
+                area);
+        if (synth_product(fname, product, area, satnames[i%SYNTH_NSAT],
+                    ft, grid, nbands, cmband)) {
+            exit(FM_IO_ERR);
+        }
+        nfiles++;
+    }
+
+    /*
+     * Daily products, these are only containing the flux band.
+     */
+    if (dflg) {
+        sprintf(dirname,"%s/daily",outdir);
+        if (mkpath(dirname)) exit(FM_IO_ERR);
+        for (i=0; i<ndays; i++) {
+            t = tstart+(fmsec1970) i*86400;
+            if (tofmtime(t,&ft)) {
+                fmerrmsg(where,"Could not convert time");
+                exit(FM_IO_ERR);
+            }
+            ft.fm_hour = 12;
+            ft.fm_min = 0;
+            sprintf(fname,"%s/%s_24h_hl_%04d%02d%02d_daily.%s.hdf5",
+                    dirname, product,
+                    ft.fm_year, ft.fm_mon, ft.fm_mday, area);
+            if (synth_product(fname, product, area, "multi",
+                        ft, grid, 1, -1)) {
+                exit(FM_IO_ERR);
+            }
+            nfiles++;
+        }
+    }
+
+    /*
+     * Observations, one set of files per month covered.
+     */
+    for (i=0; i<ndays; i++) {
+        if (tofmtime(tstart+(fmsec1970) i*86400,&ft)) {
+            fmerrmsg(where,"Could not convert time");
+            exit(FM_IO_ERR);
+        }
+        if (ft.fm_mon == lastmonth) continue;
+        sprintf(dirname,"%s/obs",outdir);
+        if (synth_obs(dirname, product, stl, ft.fm_year, ft.fm_mon)) {
+            exit(FM_IO_ERR);
+        }
+        lastmonth = ft.fm_mon;
+    }
+
+    fprintf(stdout,"%d\n", nfiles);
+
+    exit(FM_OK);
+}
+
+static int mkpath(char *path) {
+
+    char *where="fluxval_synth";
+    char tmp[FMSTRING1024];
+    char *p;
+
+    snprintf(tmp,FMSTRING1024,"%s",path);
+    for (p=tmp+1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+    if (mkdir(tmp, 0755) && access(tmp, W_OK)) {
+        fmerrmsg(where,"Could not create %s", path);
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Spread stations regularly between 58N and 71N, 5E and 30E and store
+ * the list in the format read by decode_stlist.
+ */
+static int synth_stlist(char *outfile, int nst, stlist *stl) {
+
+    char *where="synth_stlist";
+    int k, nx;
+    FILE *fp;
+
+    if (create_stlist(nst, stl)) {
+        fmerrmsg(where,"Could not allocate station list");
+        return(FM_MEMALL_ERR);
+    }
+    fp = fopen(outfile,"w");
+    if (!fp) {
+        fmerrmsg(where,"Could not create %s", outfile);
+        return(FM_IO_ERR);
+    }
+    nx = (int) ceil(sqrt((double) nst));
+    fprintf(fp,"%d\n",nst);
+    for (k=0; k<nst; k++) {
+        sprintf(stl->id[k].name,"synth%05d",k);
+        stl->id[k].number = 90000+k;
+        stl->id[k].lat = 58.+13.*((k/nx)+0.5)/nx;
+        stl->id[k].lon = 5.+25.*((k%nx)+0.5)/nx;
+        fprintf(fp,"%s %05d %.4f %.4f\n",
+                stl->id[k].name,stl->id[k].number,
+                stl->id[k].lat,stl->id[k].lon);
+    }
+    fclose(fp);
+
+    return(FM_OK);
+}
+
+/*
+ * Diurnal cycle modulated by a smooth spatial pattern. Pixel position
+ * (i,j) is given as column and row, a negative column returns the value
+ * at the station (no spatial modulation).
+ */
+static float synth_flux(char *product, fmtime t, int i, int j) {
+
+    float hour, base, mod;
+
+    hour = t.fm_hour+t.fm_min/60.;
+    mod = (i < 0) ? 1. : 1.+0.2*sin(i/37.)*cos(j/23.);
+    if (strstr(product,"dli")) {
+        base = 300.+40.*sin(PI*(hour-9.)/12.);
+    } else {
+        base = 800.*sin(PI*(hour-6.)/12.);
+        if (base < 0.) base = 0.;
+    }
+
+    return(base*mod);
+}
+
+static int synth_product(char *outfile, char *product, char *area,
+        char *source, fmtime t, PRODhead grid, int z, int cmband) {
+
+    char *where="synth_product";
+    char **desc;
+    char bname[FMSTRING16];
+    int i, j, k;
+    long l;
+    float *fdata;
+    unsigned short *udata;
+    osi_dtype *ft;
+    osihdf ipd;
+
+    init_osihdf(&ipd);
+    ipd.h = grid;
+    sprintf(ipd.h.source,"%s",source);
+    sprintf(ipd.h.product,"%s",product);
+    sprintf(ipd.h.area,"%s",area);
+    ipd.h.year = t.fm_year;
+    ipd.h.month = t.fm_mon;
+    ipd.h.day = t.fm_mday;
+    ipd.h.hour = t.fm_hour;
+    ipd.h.minute = t.fm_min;
+    ipd.h.z = z;
+
+    ft = (osi_dtype *) malloc(z*sizeof(osi_dtype));
+    desc = (char **) malloc(z*sizeof(char *));
+    if (!ft || !desc) {
+        fmerrmsg(where,"Could not allocate band descriptions");
+        return(FM_MEMALL_ERR);
+    }
+    for (k=0; k<z; k++) {
+        desc[k] = (char *) malloc(FMSTRING16*sizeof(char));
+        if (!desc[k]) {
+            fmerrmsg(where,"Could not allocate band descriptions");
+            return(FM_MEMALL_ERR);
+        }
+        if (k == cmband) {
+            ft[k] = OSI_USHORT;
+            sprintf(desc[k],"CM");
+        } else {
+            ft[k] = OSI_FLOAT;
+            if (k < 6) {
+                sprintf(desc[k],"%s",banddesc[k]);
+            } else {
+                sprintf(bname,"BAND%d",k);
+                sprintf(desc[k],"%s",bname);
+            }
+        }
+    }
+    if (malloc_osihdf(&ipd, ft, desc)) {
+        fmerrmsg(where,"Could not allocate product");
+        return(FM_MEMALL_ERR);
+    }
+
+    for (k=0; k<z; k++) {
+        if (k == cmband) {
+            udata = (unsigned short *) ipd.d[k].data;
+            for (j=0; j<grid.ih; j++) {
+                for (i=0; i<grid.iw; i++) {
+                    l = (long) j*grid.iw+i;
+                    udata[l] = (unsigned short) (1+((i/7+j/5+t.fm_hour)%19));
+                }
+            }
+            continue;
+        }
+        fdata = (float *) ipd.d[k].data;
+        for (j=0; j<grid.ih; j++) {
+            for (i=0; i<grid.iw; i++) {
+                l = (long) j*grid.iw+i;
+                if (l%97 == 0) {
+                    fdata[l] = SYNTH_MISVAL;
+                } else if (k == 0) {
+                    fdata[l] = synth_flux(product, t, i, j);
+                } else if (k >= 3 && k <= 5) {
+                    fdata[l] = 30.*(k-2)+10.*sin((i+j)/50.);
+                } else {
+                    fdata[l] = (float) ((i+j+k)%100);
+                }
+            }
+        }
+    }
+
+    if (store_hdf5_product(outfile, ipd)) {
+        fmerrmsg(where,"Could not store %s", outfile);
+        return(FM_IO_ERR);
+    }
+
+    free_osihdf(&ipd);
+    for (k=0; k<z; k++) free(desc[k]);
+    free(desc);
+    free(ft);
+
+    return(FM_OK);
+}
+
+/*
+ * Generate one month of hourly observations for all stations in the four
+ * formats supported by fluxval.
+ */
+static int synth_obs(char *obsdir, char *product, stlist stl,
+        int year, int month) {
+
+    char *where="synth_obs";
+    char *pl="TTM   TTN   TTX   TJM TJM20 TJM50 UUM UUX     RR   FM2   FG2   FX2     QO   BT  TGM   TGN   TGX  ST";
+    char dirname[FMSTRING1024], fname[FMSTRING1024];
+    char *fmt[4] = {"bioforsk","compact","ulric","gts"};
+    int f, k, d, h, n, ndays;
+    int mdays[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+    float q0, lw;
+    fmtime t;
+    FILE *fp;
+
+    ndays = mdays[month-1];
+    if (month == 2 &&
+            ((year%4 == 0 && year%100 != 0) || year%400 == 0)) ndays = 29;
+
+    for (f=0; f<4; f++) {
+        snprintf(dirname,FMSTRING1024,"%s/%s",obsdir,fmt[f]);
+        if (mkpath(dirname)) return(FM_IO_ERR);
+        for (k=0; k<stl.cnt; k++) {
+            if (f == 0) {
+                n = snprintf(fname,FMSTRING1024,"%s/%02d0%05d.c%02d",dirname,
+                        month,stl.id[k].number,year%100);
+            } else if (f == 1) {
+                n = snprintf(fname,FMSTRING1024,"%s/radflux_%s_%4d%02d.txt",
+                        dirname,stl.id[k].name,year,month);
+            } else if (f == 2) {
+                n = snprintf(fname,FMSTRING1024,"%s/radflux_%d_%4d%02d.txt",
+                        dirname,stl.id[k].number,year,month);
+            } else {
+                n = snprintf(fname,FMSTRING1024,"%s/radflux_%05d_%4d%02d.txt",
+                        dirname,stl.id[k].number,year,month);
+            }
+            if (n < 0 || n >= FMSTRING1024) {
+                fmerrmsg(where,"File name in %s too long", dirname);
+                return(FM_IO_ERR);
+            }
+            fp = fopen(fname,"w");
+            if (!fp) {
+                fmerrmsg(where,"Could not create %s", fname);
+                return(FM_IO_ERR);
+            }
+            if (f == 0) {
+                fprintf(fp,"Date         %s\n",pl);
+            } else if (f == 1) {
+                fprintf(fp,"\"time\" \"mssi\" \"nssi\" \"mdli\" \"ndli\"\n");
+            } else if (f == 2) {
+                fprintf(fp,"# Synthetic observations\n# Station %d\n",
+                        stl.id[k].number);
+                fprintf(fp,"# Time TA QO OT_1\n");
+            } else {
+                fprintf(fp,"# Synthetic observations\n# Station %05d\n",
+                        stl.id[k].number);
+                fprintf(fp,"# Time QO LW OT\n");
+            }
+            for (d=1; d<=ndays; d++) {
+                for (h=0; h<24; h++) {
+                    t.fm_year = year;
+                    t.fm_mon = month;
+                    t.fm_mday = d;
+                    t.fm_hour = h;
+                    t.fm_min = (f == 1) ? 30 : 0;
+                    t.fm_sec = 0;
+                    q0 = synth_flux("ssi", t, -1, -1)+(k%5);
+                    lw = synth_flux("dli", t, -1, -1)-(k%5);
+                    if ((d*24+h+k)%53 == 0) {
+                        q0 = (f == 0) ? 1.e9 : -999.;
+                    }
+                    if (f == 0) {
+                        fprintf(fp,"%04d%02d%02d%02d00 ",year,month,d,h);
+                        fprintf(fp,"%6.1f %6.1f %6.1f %6.1f %6.1f %6.1f ",
+                                5.,3.,7.,4.,4.,4.);
+                        fprintf(fp,"%6.1f %6.1f %6.1f %6.1f %6.1f %6.1f ",
+                                80.,90.,0.,2.,4.,3.);
+                        fprintf(fp,"%6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f\n",
+                                q0,0.,5.,3.,7.,30.,5.);
+                    } else if (f == 1) {
+                        fprintf(fp,"%04d-%02d-%02d %02d:30:00 %.2f 60 %.2f 60\n",
+                                year,month,d,h,q0,lw);
+                    } else if (f == 2) {
+                        fprintf(fp,"%04d%02d%02dT%02d00 %.1f %.1f %.1f\n",
+                                year,month,d,h,5.,q0,30.);
+                    } else {
+                        fprintf(fp,"%04d-%02d-%02d %02d:00:00 %.1f %.1f %.1f\n",
+                                year,month,d,h,q0,lw,30.);
+                    }
+                }
+            }
+            fclose(fp);
+        }
+    }
+
+    if (strstr(product,"dli")) {
+        fmlogmsg(where,
+                "Bioforsk and Ulric formats do not carry DLI observations");
+    }
+
+    return(FM_OK);
+}
+
+void usage_synth(void) {
+
+    fprintf(stdout,"\n");
+    fprintf(stdout," fluxval_synth -s <start_time> -i <stlist>|-N <nst>");
+    fprintf(stdout," -o <outdir>");
+    fprintf(stdout," [-d -n <days> -t <passages> -p <product> -g <area>");
+    fprintf(stdout," -r <resolution> -x <width> -y <height>");
+    fprintf(stdout," -z <bands> -c <cmband>]\n");
+    fprintf(stdout,"     -s start_time: yyyymmddhh\n");
+    fprintf(stdout,"     -i stlist: ASCII file containing station ids\n");
+    fprintf(stdout,"     -N nst: generate nst stations instead of reading a list\n");
+    fprintf(stdout,"     -o outdir: directory to create archive in\n");
+    fprintf(stdout,"     -d: create daily products as well\n");
+    fprintf(stdout,"     -n days: number of days to generate (default 1)\n");
+    fprintf(stdout,"     -t passages: passages per day (default 12)\n");
+    fprintf(stdout,"     -p product: ssi or dli (default ssi)\n");
+    fprintf(stdout,"     -g area: area name used in file names (default ns)\n");
+    fprintf(stdout,"     -r resolution: pixel size in UCS units (default 5)\n");
+    fprintf(stdout,"     -x width: image width (default covers stations)\n");
+    fprintf(stdout,"     -y height: image height (default covers stations)\n");
+    fprintf(stdout,"     -z bands: number of bands (default 7)\n");
+    fprintf(stdout,"     -c cmband: band holding the cloud mask, -1 for none\n");
+    fprintf(stdout,"                (default 6 for 7 bands)\n");
+    fprintf(stdout,"\n");
+
+    exit(FM_OK);
+}
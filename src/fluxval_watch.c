@@ -0,0 +1,591 @@
+/*
+ * NAME:
+ * fluxval_watch.c
+ *
+ * PURPOSE:
+ * To validate products in near real time. The product tree is monitored
+ * using inotify and new products are collocated with observations as
+ * soon as they are completely written, instead of waiting for the nightly
+ * batch runs.
+ *
+ * NOTES:
+ * A product is considered complete when the file written is closed
+ * (IN_CLOSE_WRITE) or moved into the tree (IN_MOVED_TO). Subdirectories
+ * created in the tree (e.g. a new day in the OSISAF archive) are watched
+ * as they appear.
+ *
+ * Each product is processed exactly once. Products processed are kept in
+ * a state file which is read at startup, products already in the tree
+ * that are not listed there are processed when the watch is started.
+ * Products that could not be read are not recorded and will be tried
+ * again next time the watch is started.
+ *
+ * Observations are kept in memory by the session and are dropped when
+ * any file in the observation directory is written, forcing them to be
+ * read again for the next product. As observations represent the hour
+ * following the passage, new products are held back for a while (delay,
+ * 60 minutes by default) to give the observations time to arrive.
+ * Products without any collocated observation when processed are not
+ * recorded but wait for the observations, they are processed again when
+ * observations were updated and no more updates followed for FVW_SETTLE
+ * seconds. Products still without observations FVW_MAXWAIT seconds after
+ * they arrived are recorded as processed.
+ *
+ * Matchups are appended to the output file and flushed for each product.
+ * If requested, one line of statistics is appended per product:
+ *   processing time, product, matchups, matchups compared, bias, rmse,
+ *   and the same three numbers accumulated since the watch was started.
+ * Bias and rmse are -999.00 if nothing could be compared.
+ *
+ * The watch is terminated by SIGINT or SIGTERM.
+ *
+ * BUGS:
+ * Linux only (inotify).
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * VERSION:
+ * $Id$
+ */
+
+#include <fluxval.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define FVW_MAXDEPTH 4
+#define FVW_EVENTBUF 16384
+#define FVW_PRODMASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_Q_OVERFLOW)
+#define FVW_OBSMASK (IN_CLOSE_WRITE|IN_MOVED_TO)
+#define FVW_MAXWAIT 86400
+#define FVW_SETTLE 60
+
+/*
+ * Set of products processed, open addressing on the full pathname.
+ */
+typedef struct {
+    int size;
+    int cnt;
+    char **key;
+} fvwset;
+
+/*
+ * Directories watched.
+ */
+typedef struct {
+    int cnt;
+    int *wd;
+    char **path;
+} fvwdirs;
+
+/*
+ * Products waiting to be processed, due is when they are processed or,
+ * for products waiting for observations, when waiting ends.
+ */
+typedef struct {
+    int cnt;
+    int size;
+    char **path;
+    time_t *due;
+} fvwqueue;
+
+static volatile sig_atomic_t stoprequested = 0;
+
+static void fvw_stop(int sig) {
+    stoprequested = 1;
+}
+
+static unsigned int fvw_hash(char *str) {
+    unsigned int h = 5381;
+
+    while (*str) h = h*33+(unsigned char) *str++;
+
+    return(h);
+}
+
+static int fvw_set_find(fvwset *set, char *key) {
+    unsigned int i;
+
+    if (set->size == 0) return(0);
+    i = fvw_hash(key)%set->size;
+    while (set->key[i]) {
+        if (strcmp(set->key[i], key) == 0) return(1);
+        i = (i+1)%set->size;
+    }
+
+    return(0);
+}
+
+static int fvw_set_add(fvwset *set, char *key) {
+    char *where="fvw_set_add";
+    char **old;
+    int i, oldsize;
+    unsigned int j;
+
+    if (fvw_set_find(set, key)) return(FM_OK);
+
+    /*
+     * Keep the table at most half full.
+     */
+    if (2*(set->cnt+1) > set->size) {
+        old = set->key;
+        oldsize = set->size;
+        set->size = (oldsize == 0) ? 1024 : 2*oldsize;
+        set->key = (char **) calloc(set->size, sizeof(char *));
+        if (!set->key) {
+            fmerrmsg(where,"Could not allocate set of processed products");
+            return(FM_MEMALL_ERR);
+        }
+        for (i=0; i<oldsize; i++) {
+            if (!old[i]) continue;
+            j = fvw_hash(old[i])%set->size;
+            while (set->key[j]) j = (j+1)%set->size;
+            set->key[j] = old[i];
+        }
+        if (old) free(old);
+    }
+
+    j = fvw_hash(key)%set->size;
+    while (set->key[j]) j = (j+1)%set->size;
+    set->key[j] = strdup(key);
+    if (!set->key[j]) {
+        fmerrmsg(where,"Could not allocate set of processed products");
+        return(FM_MEMALL_ERR);
+    }
+    set->cnt++;
+
+    return(FM_OK);
+}
+
+static void fvw_set_free(fvwset *set) {
+    int i;
+
+    for (i=0; i<set->size; i++) {
+        if (set->key[i]) free(set->key[i]);
+    }
+    if (set->key) free(set->key);
+    set->size = set->cnt = 0;
+}
+
+/*
+ * Read the products processed by earlier runs.
+ */
+static int fvw_read_state(char *statefile, fvwset *set) {
+    char *where="fvw_read_state";
+    char line[FMSTRING1024];
+    FILE *fp;
+
+    fp = fopen(statefile,"r");
+    if (!fp) return(FM_OK);
+    while (fgets(line, FMSTRING1024, fp)) {
+        line[strcspn(line,"\n")] = '\0';
+        if (strlen(line) == 0) continue;
+        if (fvw_set_add(set, line) != FM_OK) {
+            fclose(fp);
+            return(FM_MEMALL_ERR);
+        }
+    }
+    fclose(fp);
+    fmlogmsg(where,"%d products already processed according to %s",
+            set->cnt, statefile);
+
+    return(FM_OK);
+}
+
+static int fvw_enqueue(fvwqueue *q, char *path, time_t due) {
+    char *where="fvw_enqueue";
+    int i;
+
+    for (i=0; i<q->cnt; i++) {
+        if (strcmp(q->path[i], path) == 0) {
+            q->due[i] = due;
+            return(FM_OK);
+        }
+    }
+    if (q->cnt == q->size) {
+        q->size = (q->size == 0) ? 64 : 2*q->size;
+        q->path = (char **) realloc(q->path, q->size*sizeof(char *));
+        q->due = (time_t *) realloc(q->due, q->size*sizeof(time_t));
+        if (!q->path || !q->due) {
+            fmerrmsg(where,"Could not allocate queue of products");
+            return(FM_MEMALL_ERR);
+        }
+    }
+    q->path[q->cnt] = strdup(path);
+    if (!q->path[q->cnt]) {
+        fmerrmsg(where,"Could not allocate queue of products");
+        return(FM_MEMALL_ERR);
+    }
+    q->due[q->cnt] = due;
+    q->cnt++;
+
+    return(FM_OK);
+}
+
+static int fvw_cmpstr(const void *a, const void *b) {
+    return(strcmp(*(char **) a, *(char **) b));
+}
+
+/*
+ * Add a directory (and its subdirectories) to the watch. Products found
+ * that are not processed are queued in alphabetical order.
+ */
+static int fvw_add_tree(int fd, char *path, int depth, fvwatch *w,
+        fvwdirs *dirs, fvwset *set, fvwqueue *q) {
+    char *where="fvw_add_tree";
+    char fullpath[FMSTRING1024];
+    char **names = NULL;
+    int i, wd, nnames = 0, status = FM_OK;
+    DIR *dirp;
+    struct dirent *de;
+    struct stat sbuf;
+
+    wd = inotify_add_watch(fd, path, FVW_PRODMASK);
+    if (wd < 0) {
+        fmerrmsg(where,"Could not watch %s (%s)", path, strerror(errno));
+        return(FM_IO_ERR);
+    }
+    for (i=0; i<dirs->cnt && dirs->wd[i] != wd; i++);
+    if (i == dirs->cnt) {
+        dirs->wd = (int *) realloc(dirs->wd, (dirs->cnt+1)*sizeof(int));
+        dirs->path = (char **) realloc(dirs->path,
+                (dirs->cnt+1)*sizeof(char *));
+        if (!dirs->wd || !dirs->path) {
+            fmerrmsg(where,"Could not allocate list of directories");
+            return(FM_MEMALL_ERR);
+        }
+        dirs->wd[dirs->cnt] = wd;
+        dirs->path[dirs->cnt] = strdup(path);
+        dirs->cnt++;
+        fmlogmsg(where,"Watching %s", path);
+    }
+
+    dirp = opendir(path);
+    if (!dirp) {
+        fmerrmsg(where,"Could not read content of %s", path);
+        return(FM_IO_ERR);
+    }
+    while ((de = readdir(dirp)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        names = (char **) realloc(names, (nnames+1)*sizeof(char *));
+        if (!names) {
+            closedir(dirp);
+            return(FM_MEMALL_ERR);
+        }
+        names[nnames++] = strdup(de->d_name);
+    }
+    closedir(dirp);
+    if (nnames > 0) qsort(names, nnames, sizeof(char *), fvw_cmpstr);
+
+    for (i=0; i<nnames; i++) {
+        snprintf(fullpath, FMSTRING1024, "%s/%s", path, names[i]);
+        if (stat(fullpath, &sbuf) != 0) continue;
+        if (S_ISDIR(sbuf.st_mode)) {
+            if (depth < FVW_MAXDEPTH) {
+                fvw_add_tree(fd, fullpath, depth+1, w, dirs, set, q);
+            }
+        } else if (fluxval_fntest(names[i], w->fntest) &&
+                !fvw_set_find(set, fullpath)) {
+            if (fvw_enqueue(q, fullpath, sbuf.st_mtime+w->delay) != FM_OK) {
+                status = FM_MEMALL_ERR;
+            }
+        }
+    }
+    for (i=0; i<nnames; i++) free(names[i]);
+    if (names) free(names);
+
+    return(status);
+}
+
+static int fvw_record(char *path, fvwset *set, FILE *statefp) {
+
+    if (fvw_set_add(set, path) != FM_OK) return(FM_MEMALL_ERR);
+    fprintf(statefp,"%s\n",path);
+    fflush(statefp);
+
+    return(FM_OK);
+}
+
+/*
+ * Process a product and record it as processed. A product without
+ * collocated observations is added to the products waiting for
+ * observations instead, until deadline.
+ */
+static int fvw_process(fvsession *s, fvwatch *w, char *path,
+        fvwset *set, FILE *statefp, FILE *statsfp, fvstats *total,
+        fvwqueue *wait, time_t deadline) {
+    char *where="fvw_process";
+    char tstr[FMSTRING32];
+    char *bname;
+    fvstats st;
+    time_t now;
+
+    if (fluxval_process_product(s, path) != FM_OK) {
+        fmerrmsg(where,"Could not process %s, will retry on restart", path);
+        fluxval_session_stats(s, &st, 1);
+        return(FM_IO_ERR);
+    }
+    fflush(s->fp);
+    if (s->noobs && time(NULL) < deadline) {
+        fluxval_session_stats(s, &st, 1);
+        fvlog(FV_LOG_INFO, where,"Waiting for observations of %s", path);
+        fvlog_flush();
+        return(fvw_enqueue(wait, path, deadline));
+    }
+    if (s->noobs) {
+        fmlogmsg(where,"No observations arrived for %s", path);
+    }
+    if (fvw_record(path, set, statefp) != FM_OK) return(FM_MEMALL_ERR);
+
+    fluxval_session_stats(s, &st, 1);
+    total->nmatchups += st.nmatchups;
+    total->n += st.n;
+    total->sumdiff += st.sumdiff;
+    total->sumsqdiff += st.sumsqdiff;
+    if (statsfp) {
+        now = time(NULL);
+        strftime(tstr, FMSTRING32, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+        bname = strrchr(path,'/');
+        bname = bname ? bname+1 : path;
+        fprintf(statsfp,"%s %s %5ld %5ld %8.2f %8.2f %7ld %8.2f %8.2f\n",
+                tstr, bname, st.nmatchups, st.n,
+                (st.n > 0) ? st.sumdiff/st.n : -999.,
+                (st.n > 0) ? sqrt(st.sumsqdiff/st.n) : -999.,
+                total->n,
+                (total->n > 0) ? total->sumdiff/total->n : -999.,
+                (total->n > 0) ? sqrt(total->sumsqdiff/total->n) : -999.);
+        fflush(statsfp);
+    }
+    fvlog(FV_LOG_INFO, where,"Processed %s, %ld matchups", 
+            path, st.nmatchups);
+    fvlog_flush();
+    runstats_poll(&(s->rs),
+            (strlen(w->reportfile) > 0) ? w->reportfile : NULL);
+
+    return(FM_OK);
+}
+
+int fluxval_watch(fvsession *s, fvwatch *w) {
+
+    char *where="fluxval_watch";
+    char buf[FVW_EVENTBUF]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    char path[FMSTRING1024];
+    int fd, obswd = -1, i, k, timeout, status = FM_OK;
+    ssize_t len;
+    time_t now, next, due;
+    struct pollfd pfd;
+    struct sigaction sa;
+    struct inotify_event *ev;
+    fvwset set = {0, 0, NULL};
+    fvwdirs dirs = {0, NULL, NULL};
+    fvwqueue q = {0, 0, NULL, NULL};
+    fvwqueue wait = {0, 0, NULL, NULL};
+    fvwqueue retry;
+    time_t retryat = 0;
+    short obsupdated;
+    fvstats total;
+    FILE *statefp, *statsfp = NULL;
+
+    memset(&total, 0, sizeof(fvstats));
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fvw_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /*
+     * Products processed by earlier runs.
+     */
+    if (fvw_read_state(w->statefile, &set) != FM_OK) return(FM_MEMALL_ERR);
+    statefp = fopen(w->statefile,"a");
+    if (!statefp) {
+        fmerrmsg(where,"Could not open state file %s", w->statefile);
+        fvw_set_free(&set);
+        return(FM_IO_ERR);
+    }
+    if (strlen(w->statsfile) > 0) {
+        statsfp = fopen(w->statsfile,"a");
+        if (!statsfp) {
+            fmerrmsg(where,"Could not open statistics file %s", w->statsfile);
+            fclose(statefp);
+            fvw_set_free(&set);
+            return(FM_IO_ERR);
+        }
+    }
+
+    /*
+     * Set up the watches, products already in the tree are queued.
+     */
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        fmerrmsg(where,"Could not initialise inotify (%s)", strerror(errno));
+        status = FM_IO_ERR;
+        goto cleanup;
+    }
+    if (fvw_add_tree(fd, w->proddir, 0, w, &dirs, &set, &q) != FM_OK) {
+        status = FM_IO_ERR;
+        goto cleanup;
+    }
+    if (!s->satonly) {
+        obswd = inotify_add_watch(fd, w->obsdir, FVW_OBSMASK);
+        if (obswd < 0) {
+            fmerrmsg(where,"Could not watch observations in %s", w->obsdir);
+            status = FM_IO_ERR;
+            goto cleanup;
+        }
+    }
+    fmlogmsg(where,"%d products queued at startup", q.cnt);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!stoprequested) {
+
+        /*
+         * Process products that are due, in the order they arrived.
+         */
+        now = time(NULL);
+        next = 0;
+        for (i=0; i<q.cnt && !stoprequested;) {
+            if (q.due[i] > now) {
+                if (next == 0 || q.due[i] < next) next = q.due[i];
+                i++;
+                continue;
+            }
+            sprintf(path,"%s",q.path[i]);
+            due = q.due[i];
+            free(q.path[i]);
+            for (k=i+1; k<q.cnt; k++) {
+                q.path[k-1] = q.path[k];
+                q.due[k-1] = q.due[k];
+            }
+            q.cnt--;
+            if (fvw_set_find(&set, path)) continue;
+            if (fvw_process(s, w, path, &set, statefp, statsfp, &total,
+                        &wait, due-w->delay+FVW_MAXWAIT) == FM_MEMALL_ERR) {
+                status = FM_MEMALL_ERR;
+                goto cleanup;
+            }
+        }
+
+        /*
+         * Products waiting for observations are processed again when
+         * observations were updated, and recorded when waiting ends.
+         */
+        obsupdated = (retryat > 0 && retryat <= now);
+        if (obsupdated) retryat = 0;
+        for (i=0; i<wait.cnt && !obsupdated && wait.due[i] > now; i++);
+        if (i < wait.cnt && !stoprequested) {
+            retry = wait;
+            memset(&wait, 0, sizeof(fvwqueue));
+            for (i=0; i<retry.cnt; i++) {
+                if (stoprequested || fvw_set_find(&set, retry.path[i]) ||
+                        (!obsupdated && retry.due[i] > now)) {
+                    if (!fvw_set_find(&set, retry.path[i]) &&
+                            fvw_enqueue(&wait, retry.path[i], retry.due[i])
+                            != FM_OK) status = FM_MEMALL_ERR;
+                } else if (!obsupdated) {
+                    fmlogmsg(where,"No observations arrived for %s",
+                            retry.path[i]);
+                    if (fvw_record(retry.path[i], &set, statefp) != FM_OK) {
+                        status = FM_MEMALL_ERR;
+                    }
+                } else if (fvw_process(s, w, retry.path[i], &set, statefp,
+                            statsfp, &total, &wait, retry.due[i])
+                        == FM_MEMALL_ERR) {
+                    status = FM_MEMALL_ERR;
+                }
+                free(retry.path[i]);
+            }
+            if (retry.path) free(retry.path);
+            if (retry.due) free(retry.due);
+            if (status != FM_OK) goto cleanup;
+        }
+
+        /*
+         * Wait for events, but wake up when the next product is due and
+         * regularly to check for report requests.
+         */
+        timeout = 1000;
+        if (next > 0 && (next-time(NULL))*1000 < timeout) {
+            timeout = (next > time(NULL)) ? (next-time(NULL))*1000 : 0;
+        }
+        if (poll(&pfd, 1, timeout) <= 0) {
+            runstats_poll(&(s->rs),
+                    (strlen(w->reportfile) > 0) ? w->reportfile : NULL);
+            continue;
+        }
+        len = read(fd, buf, FVW_EVENTBUF);
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+            fmerrmsg(where,"Could not read inotify events");
+            status = FM_IO_ERR;
+            break;
+        }
+        for (i=0; i<len; i+=sizeof(struct inotify_event)+ev->len) {
+            ev = (struct inotify_event *) &buf[i];
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /*
+                 * Events were lost, rescan the whole tree.
+                 */
+                fmerrmsg(where,"Event queue overflow, rescanning %s",
+                        w->proddir);
+                fluxval_session_refresh_obs(s);
+                fvw_add_tree(fd, w->proddir, 0, w, &dirs, &set, &q);
+                continue;
+            }
+            if (ev->len == 0) continue;
+            if (ev->wd == obswd && !(ev->mask & IN_ISDIR)) {
+                fmlogmsg(where,"Observations updated (%s)", ev->name);
+                fluxval_session_refresh_obs(s);
+                if (wait.cnt > 0) retryat = time(NULL)+FVW_SETTLE;
+            }
+            for (k=0; k<dirs.cnt && dirs.wd[k] != ev->wd; k++);
+            if (k == dirs.cnt) continue;
+            snprintf(path, FMSTRING1024, "%s/%s", dirs.path[k], ev->name);
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE|IN_MOVED_TO)) {
+                    fvw_add_tree(fd, path, 1, w, &dirs, &set, &q);
+                }
+            } else if ((ev->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)) &&
+                    fluxval_fntest(ev->name, w->fntest) &&
+                    !fvw_set_find(&set, path)) {
+                fvlog(FV_LOG_INFO, where,"New product %s", path);
+                if (fvw_enqueue(&q, path, time(NULL)+w->delay) != FM_OK) {
+                    status = FM_MEMALL_ERR;
+                    goto cleanup;
+                }
+            }
+        }
+    }
+    if (stoprequested) {
+        fmlogmsg(where,"Watch stopped, %d products not processed", 
+                q.cnt+wait.cnt);
+    }
+
+cleanup:
+    if (fd >= 0) close(fd);
+    fclose(statefp);
+    if (statsfp) fclose(statsfp);
+    fvw_set_free(&set);
+    for (i=0; i<dirs.cnt; i++) free(dirs.path[i]);
+    if (dirs.wd) free(dirs.wd);
+    if (dirs.path) free(dirs.path);
+    for (i=0; i<q.cnt; i++) free(q.path[i]);
+    if (q.path) free(q.path);
+    if (q.due) free(q.due);
+    for (i=0; i<wait.cnt; i++) free(wait.path[i]);
+    if (wait.path) free(wait.path);
+    if (wait.due) free(wait.due);
+
+    return(status);
+}
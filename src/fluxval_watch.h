@@ -0,0 +1,51 @@
+/*
+ * NAME:
+ * fluxval_watch.h
+ *
+ * PURPOSE:
+ * Header file for the watch mode of fluxval, validating products as they
+ * arrive in the archive.
+ *
+ * NOTES:
+ * See fluxval_watch.c
+ *
+ * BUGS:
+ * NA
+ *
+ * RETURN VALUES:
+ * 0 - normal and correct ending
+ * 2 - i/o problem
+ * 3 - memory problem
+ *
+ * DEPENDENCIES:
+ *
+ * ID:
+ * $Id$
+ */
+
+#ifndef _FLUXVAL_WATCH_H
+#define _FLUXVAL_WATCH_H
+
+#include <fmutil.h>
+#include <fluxval_api.h>
+
+/*
+ * Configuration of watch mode. statsfile and reportfile are optional
+ * (empty strings).
+ */
+typedef struct {
+    char proddir[FMSTRING1024];	/* Top of product tree watched */
+    char obsdir[FMSTRING1024];	/* Directory holding observations */
+    char fntest[FMSTRING1024];	/* Filename patterns, comma separated */
+    char statefile[FMSTRING1024];	/* Products already processed */
+    char statsfile[FMSTRING1024];	/* Statistics per product */
+    char reportfile[FMSTRING1024];	/* JSON report of processing */
+    int delay;			/* Seconds to hold new products */
+} fvwatch;
+
+/*
+ * Function prototypes.
+ */
+int fluxval_watch(fvsession *s, fvwatch *w);
+
+#endif /* _FLUXVAL_WATCH_H */
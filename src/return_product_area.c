@@ -11,6 +11,31 @@
  * Only quadratic regions with odd dimension are supported yet. The
  * function should return viewing geometry angles as well in time.
  *
+ * When several products and bands are processed for the same station
+ * list, return_product_positions should be used to project all stations
+ * in one call and return_product_area_ind to extract the data using the
+ * stored indices. The projection to the user coordinate system is then
+ * only done once per station and the conversion to image indices once
+ * per grid. The indices are identical to those used by
+ * return_product_area as the same fmucs2ind conversion is applied to
+ * the same UCS positions. When products of several areas are processed
+ * one s_pos is kept per grid, return_product_positions_match tells
+ * which one belongs to a product.
+ *
+ * return_product_area_typed extracts from bands of any type. The box
+ * sizes and band types met in practice (1x1 and 13x13 boxes of float
+ * and unsigned short bands) are extracted by kernels specialised for
+ * them, selected in a table by size and type. They copy rows of fixed
+ * length from row pointers and test the sentinels in one pass over the
+ * copy, so the compiler can unroll and vectorise the loops (when
+ * optimising). Boxes not entirely within the image and other sizes and
+ * types are extracted by the generic loop, which also converts the
+ * values to float.
+ *
+ * Boxes stored earlier (e.g. in a patch cube) are reduced to a smaller
+ * box by return_product_area_crop, with the same treatment of missing
+ * data as when extracted from the image.
+ *
  * BUGS:
  * NA
  *
@@ -34,15 +59,35 @@
 
 #define OUTOFIMAGE -40100
 #define MISVAL -99999
+#define RPA_GENERIC -1		/* Kernel not applicable, use generic */
+#define RPA_BOX 13		/* Box size of the specialised kernels */
+
+typedef int (*rpa_kernel)(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a);
+
+static int rpa_point_float(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a);
+static int rpa_point_ushort(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a);
+static int rpa_box_float(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a);
+static int rpa_box_ushort(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a);
+
+static const struct {
+    int size;
+    osi_dtype type;
+    rpa_kernel kernel;
+} rpa_kernels[] = {
+    {1, OSI_FLOAT, rpa_point_float},
+    {1, OSI_USHORT, rpa_point_ushort},
+    {RPA_BOX, OSI_FLOAT, rpa_box_float},
+    {RPA_BOX, OSI_USHORT, rpa_box_ushort},
+};
 
 int return_product_area(fmgeopos gpos, 
         PRODhead header, float *data, s_data *a) {
 
-    char *where="return_product_area";
-    int dx, dy, i, j, k;
-    long l, maxsize;
-    int nodata = 1;
-
     fmucsref uref;
     fmucspos upos;
     fmindex xyp;
@@ -53,7 +98,6 @@ int return_product_area(fmgeopos gpos,
     uref.Ay = header.Ay;
     uref.iw = header.iw;
     uref.ih = header.ih;
-    maxsize = header.iw*header.ih;
 
     upos = fmgeo2ucs(gpos, MI);
     xyp = fmucs2ind(uref, upos);
@@ -65,8 +109,157 @@ int return_product_area(fmgeopos gpos,
     printf("%.2f %.2f\n", upos.eastings, upos.northings);
     */
 
+    return(return_product_area_ind(xyp, header, data, a));
+}
+
+/*
+ * Extract the box surrounding an image index already computed by
+ * return_product_positions.
+ */
+int return_product_area_ind(fmindex xyp, 
+        PRODhead header, float *data, s_data *a) {
+
+    return(return_product_area_typed(xyp, header, data, OSI_FLOAT, a));
+}
+
+/*
+ * Value of pixel l of a band of type type as float.
+ */
+static float rpa_value(void *data, osi_dtype type, long l) {
+
+    switch (type) {
+        case OSI_USHORT:
+            return((float) ((unsigned short *) data)[l]);
+        case OSI_UCHAR:
+            return((float) ((unsigned char *) data)[l]);
+        default:
+            return(((float *) data)[l]);
+    }
+}
+
+/*
+ * Returns 1 unless v is one of the sentinels of pixels outside the
+ * image or missing, tested as (int) floorf(v*100.) is without branches.
+ */
+static int rpa_isdata(float v) {
+
+    float x = v*100.;
+
+    return(!(((x >= OUTOFIMAGE) & (x < OUTOFIMAGE+1)) |
+                ((x >= MISVAL) & (x < MISVAL+1))));
+}
+
+/*
+ * Returns 1 if the RPA_BOX box around xyp is entirely within the image.
+ */
+static int rpa_box_inside(fmindex xyp, int iw, int ih) {
+
+    return(xyp.col >= RPA_BOX/2 && xyp.col+RPA_BOX/2 < iw &&
+            xyp.row >= RPA_BOX/2 && xyp.row+RPA_BOX/2 < ih);
+}
+
+static int rpa_point_float(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a) {
+
+    (*a).data[0] = ((float *) data)[fmivec(xyp.col,xyp.row,iw)];
+
+    return(FM_OK);
+}
+
+static int rpa_point_ushort(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a) {
+
+    (*a).data[0] = 
+        (float) ((unsigned short *) data)[fmivec(xyp.col,xyp.row,iw)];
+
+    return(FM_OK);
+}
+
+static int rpa_box_float(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a) {
+
+    char *where="return_product_area";
+    const float *src;
+    float *dst;
+    int i, j, valid;
+
+    if (!rpa_box_inside(xyp, iw, ih)) return(RPA_GENERIC);
+
+    src = (const float *) data+
+        (long) (xyp.row-RPA_BOX/2)*iw+(xyp.col-RPA_BOX/2);
+    dst = (*a).data;
+    for (i=0; i<RPA_BOX; i++, src+=iw, dst+=RPA_BOX) {
+        for (j=0; j<RPA_BOX; j++) {
+            dst[j] = src[j];
+        }
+    }
+
+    valid = 0;
+    for (i=0; i<RPA_BOX*RPA_BOX; i++) {
+        valid |= rpa_isdata((*a).data[i]);
+    }
+    if (!valid) {
+        fmerrmsg(where,"No data were found.");
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Values converted from unsigned short are never sentinels.
+ */
+static int rpa_box_ushort(fmindex xyp, int iw, int ih, void *data, 
+        s_data *a) {
+
+    const unsigned short *src;
+    float *dst;
+    int i, j;
+
+    if (!rpa_box_inside(xyp, iw, ih)) return(RPA_GENERIC);
+
+    src = (const unsigned short *) data+
+        (long) (xyp.row-RPA_BOX/2)*iw+(xyp.col-RPA_BOX/2);
+    dst = (*a).data;
+    for (i=0; i<RPA_BOX; i++, src+=iw, dst+=RPA_BOX) {
+        for (j=0; j<RPA_BOX; j++) {
+            dst[j] = (float) src[j];
+        }
+    }
+
+    return(FM_OK);
+}
+
+/*
+ * Extract the box around an image index from a band of type type,
+ * converted to float.
+ */
+int return_product_area_typed(fmindex xyp, 
+        PRODhead header, void *data, osi_dtype type, s_data *a) {
+
+    char *where="return_product_area";
+    int dx, dy, i, j, k, status;
+    size_t kk;
+    long l, maxsize;
+    int nodata = 1;
+    float v;
+
+    if ((*a).iw == (*a).ih) {
+        for (kk=0; kk<sizeof(rpa_kernels)/sizeof(rpa_kernels[0]); kk++) {
+            if (rpa_kernels[kk].size != (*a).iw || 
+                    rpa_kernels[kk].type != type) continue;
+            status = rpa_kernels[kk].kernel(xyp, header.iw, header.ih, 
+                    data, a);
+            if (status != RPA_GENERIC) return(status);
+            break;
+        }
+    }
+
+    maxsize = header.iw*header.ih;
+
     if ((*a).iw == 1 && (*a).ih == 1) {
-        *((*a).data) = data[fmivec(xyp.col,xyp.row,header.iw)];
+        *((*a).data) = rpa_value(data, type, 
+                fmivec(xyp.col,xyp.row,header.iw));
         return(FM_OK);
     }
 
@@ -92,14 +285,15 @@ int return_product_area(fmgeopos gpos,
                         maxsize, l);
                 return(FM_IO_ERR);
             }
+            v = rpa_value(data, type, l);
             /*
-               printf("%4d %4d %3d %3d %.2f\n", k, l, i, j, data[l]);
+               printf("%4d %4d %3d %3d %.2f\n", k, l, i, j, v);
                */
-            if ((int) (floorf (data[l]*100.)) != OUTOFIMAGE &&
-                    (int) (floorf (data[l]*100.)) != MISVAL) {
+            if ((int) (floorf (v*100.)) != OUTOFIMAGE &&
+                    (int) (floorf (v*100.)) != MISVAL) {
                 nodata = 0;
             }
-            (*a).data[k] = data[l];
+            (*a).data[k] = v;
             k++;
         }
     }
@@ -112,3 +306,181 @@ int return_product_area(fmgeopos gpos,
     return(FM_OK);
 }
 
+/*
+ * Extract the box of a (smaller) size centred in a box extracted
+ * earlier.
+ */
+int return_product_area_crop(s_data *box, s_data *a) {
+
+    char *where="return_product_area_crop";
+    int dx, dy, i, j, k;
+    int nodata = 1;
+    float v;
+
+    if ((*a).iw == 1 && (*a).ih == 1) {
+        *((*a).data) = (*box).data[((*box).ih/2)*(*box).iw+(*box).iw/2];
+        return(FM_OK);
+    }
+
+    if ((*a).iw%2 == 0 || (*a).ih%2 == 0) {
+        fmerrmsg(where,
+                "The area specified must contain an odd number of pixels.");
+        return(FM_IO_ERR); 
+    }
+    if ((*a).iw > (*box).iw || (*a).ih > (*box).ih) {
+        fmerrmsg(where,"Box of %dx%d is larger than the %dx%d stored",
+                (*a).iw, (*a).ih, (*box).iw, (*box).ih);
+        return(FM_IO_ERR);
+    }
+
+    dx = ((*box).iw-(*a).iw)/2;
+    dy = ((*box).ih-(*a).ih)/2;
+    k = 0;
+    for (i=dy; i<dy+(*a).ih; i++) {
+        for (j=dx; j<dx+(*a).iw; j++) {
+            v = (*box).data[i*(*box).iw+j];
+            if ((int) (floorf (v*100.)) != OUTOFIMAGE &&
+                    (int) (floorf (v*100.)) != MISVAL) {
+                nodata = 0;
+            }
+            (*a).data[k] = v;
+            k++;
+        }
+    }
+
+    if (nodata) {
+        fmerrmsg(where,"No data were found.");
+        return(FM_IO_ERR);
+    }
+
+    return(FM_OK);
+}
+
+int init_product_positions(s_pos *p) {
+
+    p->npos = 0;
+    p->gpos = NULL;
+    p->eastings = NULL;
+    p->northings = NULL;
+    p->xyp = NULL;
+    p->sx = NULL;
+    p->sy = NULL;
+    p->inside = NULL;
+    p->gridset = 0;
+
+    return(FM_OK);
+}
+
+/*
+ * Project npos geographical positions to the grid of the product
+ * described by header. Positions are only projected to UCS when the
+ * structure is first used or the station list differs from the one it
+ * was filled for, subsequent calls only recompute image indices and
+ * sub-pixel offsets if the grid differs from the previous call.
+ */
+int return_product_positions(fmgeopos *gpos, int npos, 
+        PRODhead header, s_pos *p) {
+
+    char *where="return_product_positions";
+    int i;
+    double *e, *n;
+    float *sx, *sy;
+    fmucspos upos;
+    fmucsref uref;
+
+    if (p->npos == npos && p->gpos) {
+        for (i=0; i<npos; i++) {
+            if (p->gpos[i].lat != gpos[i].lat || 
+                    p->gpos[i].lon != gpos[i].lon) break;
+        }
+    } else {
+        i = -1;
+    }
+    if (i != npos) {
+        clear_product_positions(p);
+        p->gpos = (fmgeopos *) malloc(npos*sizeof(fmgeopos));
+        p->eastings = (double *) malloc(npos*sizeof(double));
+        p->northings = (double *) malloc(npos*sizeof(double));
+        p->xyp = (fmindex *) malloc(npos*sizeof(fmindex));
+        p->sx = (float *) malloc(npos*sizeof(float));
+        p->sy = (float *) malloc(npos*sizeof(float));
+        p->inside = (char *) malloc(npos*sizeof(char));
+        if (!p->gpos || !p->eastings || !p->northings || !p->xyp || !p->sx || !p->sy ||
+                !p->inside) {
+            fmerrmsg(where,"Could not allocate memory for %d positions",
+                    npos);
+            clear_product_positions(p);
+            return(FM_MEMALL_ERR);
+        }
+        p->npos = npos;
+        for (i=0; i<npos; i++) {
+            p->gpos[i] = gpos[i];
+            upos = fmgeo2ucs(gpos[i], MI);
+            p->eastings[i] = upos.eastings;
+            p->northings[i] = upos.northings;
+        }
+    }
+
+    uref.Bx = header.Bx;
+    uref.By = header.By;
+    uref.Ax = header.Ax;
+    uref.Ay = header.Ay;
+    uref.iw = header.iw;
+    uref.ih = header.ih;
+
+    if (return_product_positions_match(header, p)) {
+        return(FM_OK);
+    }
+    p->uref = uref;
+
+    for (i=0; i<npos; i++) {
+        upos.eastings = p->eastings[i];
+        upos.northings = p->northings[i];
+        p->xyp[i] = fmucs2ind(uref, upos);
+        p->inside[i] = (p->xyp[i].col >= 0 && p->xyp[i].col < uref.iw &&
+                p->xyp[i].row >= 0 && p->xyp[i].row < uref.ih);
+    }
+
+    /*
+     * Sub-pixel offsets relative to the centre of the pixel the station
+     * is snapped to. Kept as a separate loop over flat arrays so that
+     * the compiler can vectorise it.
+     */
+    e = p->eastings;
+    n = p->northings;
+    sx = p->sx;
+    sy = p->sy;
+    for (i=0; i<npos; i++) {
+        sx[i] = (float) ((e[i]-uref.Bx)/uref.Ax-(p->xyp[i].col+0.5));
+        sy[i] = (float) ((uref.By-n[i])/uref.Ay-(p->xyp[i].row+0.5));
+    }
+    p->gridset = 1;
+
+    return(FM_OK);
+}
+
+/*
+ * Check whether the indices held are for the grid of the product
+ * described by header.
+ */
+int return_product_positions_match(PRODhead header, s_pos *p) {
+
+    return(p->gridset && 
+            p->uref.Bx == header.Bx && p->uref.By == header.By &&
+            p->uref.Ax == header.Ax && p->uref.Ay == header.Ay &&
+            p->uref.iw == header.iw && p->uref.ih == header.ih);
+}
+
+int clear_product_positions(s_pos *p) {
+
+    if (p->gpos) free(p->gpos);
+    if (p->eastings) free(p->eastings);
+    if (p->northings) free(p->northings);
+    if (p->xyp) free(p->xyp);
+    if (p->sx) free(p->sx);
+    if (p->sy) free(p->sy);
+    if (p->inside) free(p->inside);
+    init_product_positions(p);
+
+    return(FM_OK);
+}
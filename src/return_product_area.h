@@ -37,5 +37,42 @@ typedef struct {
     float *data;
 } s_data;
 
+/*
+ * Station positions in the user coordinate system and as image indices
+ * for the product grid described by uref. gpos is a copy of the
+ * geographical positions the structure was filled for; the projection
+ * to UCS is only redone when the station list changes and the indices
+ * only when the grid changes. sx and sy hold the sub-pixel offset of the station
+ * relative to the centre of the pixel it is snapped to, in units of
+ * pixels (positive towards increasing column and row). inside flags the
+ * stations whose pixel is within the grid, i.e. covered by the area.
+ */
+typedef struct {
+    int npos;
+    fmgeopos *gpos;
+    double *eastings;
+    double *northings;
+    fmindex *xyp;
+    float *sx;
+    float *sy;
+    char *inside;
+    fmucsref uref;
+    short gridset;
+} s_pos;
+
+/*
+ * Function prototypes.
+ */
+int init_product_positions(s_pos *p);
+int return_product_positions(fmgeopos *gpos, int npos, 
+    PRODhead header, s_pos *p);
+int return_product_positions_match(PRODhead header, s_pos *p);
+int clear_product_positions(s_pos *p);
+int return_product_area_ind(fmindex xyp, 
+    PRODhead header, float *data, s_data *a);
+int return_product_area_typed(fmindex xyp, 
+    PRODhead header, void *data, osi_dtype type, s_data *a);
+int return_product_area_crop(s_data *box, s_data *a);
+
 #endif
 